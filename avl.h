@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "splay.h"
+
+namespace avl {
+/**
+ * avl tree node with parent links
+ * provides same interface as splay::splay_node, but every operation is
+ * worst case O(log n) and lookups never restructure the tree, so there is no
+ * difference between `frozen` and usual functions
+ * handles passed to cut/merge may be any node of the tree
+ */
+template <typename Tag> struct avl_node {
+  mutable avl_node *left = nullptr, *right = nullptr, *up = nullptr;
+  mutable int height = 1;
+  // count of nodes in subtree, for order statistics
+  mutable std::size_t size = 1;
+
+private:
+  static int height_of(avl_node const *n) noexcept {
+    return n == nullptr ? 0 : n->height;
+  }
+  static std::size_t size_of(avl_node const *n) noexcept {
+    return n == nullptr ? 0 : n->size;
+  }
+  static avl_node *unconst(avl_node const *n) noexcept {
+    return const_cast<avl_node *>(n);
+  }
+
+  void update() const noexcept {
+    height = 1 + std::max(height_of(left), height_of(right));
+    size = 1 + size_of(left) + size_of(right);
+  }
+
+  template <avl_node *avl_node::*getter>
+  static constexpr avl_node *avl_node::*cogetter_v =
+      getter == &avl_node::left ? &avl_node::right : &avl_node::left;
+
+  // replaces `from` with `to` in parent of `from`
+  static void relink_parent(avl_node const *from, avl_node const *to,
+                            avl_node *parent) noexcept {
+    if (to != nullptr)
+      to->up = parent;
+    if (parent == nullptr)
+      return;
+    if (parent->left == from)
+      parent->left = unconst(to);
+    else
+      parent->right = unconst(to);
+  }
+
+  /**
+   * lifts child `getter` of this node, returns it
+   */
+  template <avl_node *avl_node::*getter>
+  avl_node const *rotate() const noexcept {
+    constexpr auto cogetter = cogetter_v<getter>;
+    auto r = this->*getter;
+    relink_parent(this, r, up);
+    unconst(this)->*getter = r->*cogetter;
+    if (auto got = this->*getter; got != nullptr)
+      got->up = unconst(this);
+    r->*cogetter = unconst(this);
+    up = r;
+    update();
+    r->update();
+    return r;
+  }
+
+  // restores balance of this subtree, returns its new root
+  avl_node const *rebalance() const noexcept {
+    update();
+    auto balance = height_of(left) - height_of(right);
+    if (balance > 1) {
+      if (height_of(left->left) < height_of(left->right))
+        left->template rotate<&avl_node::right>();
+      return rotate<&avl_node::left>();
+    }
+    if (balance < -1) {
+      if (height_of(right->right) < height_of(right->left))
+        right->template rotate<&avl_node::left>();
+      return rotate<&avl_node::right>();
+    }
+    return this;
+  }
+
+  // rebalances every node on the path to root, returns root
+  static avl_node const *fix_up(avl_node const *cur) noexcept {
+    avl_node const *res = nullptr;
+    while (cur != nullptr) {
+      res = cur->rebalance();
+      cur = res->up;
+    }
+    return res;
+  }
+
+  // unlinks node with at most one child, returns root of remaining tree
+  avl_node const *unlink() const noexcept {
+    assert(left == nullptr || right == nullptr);
+    auto child = left != nullptr ? left : right;
+    auto parent = up;
+    relink_parent(this, child, parent);
+    left = right = up = nullptr;
+    height = 1;
+    size = 1;
+    if (parent == nullptr)
+      return child;
+    return fix_up(parent);
+  }
+
+  template <avl_node *avl_node::*getter>
+  static avl_node const *join_side(avl_node const *tall, avl_node const *k,
+                                   avl_node const *low) noexcept {
+    constexpr auto cogetter = cogetter_v<getter>;
+    // descend spine of taller tree until heights match
+    avl_node const *parent = nullptr;
+    auto cur = tall;
+    while (height_of(cur) > height_of(low) + 1) {
+      parent = cur;
+      cur = cur->*getter;
+    }
+    unconst(k)->*cogetter = unconst(cur);
+    unconst(k)->*getter = unconst(low);
+    if (cur != nullptr)
+      cur->up = unconst(k);
+    if (low != nullptr)
+      low->up = unconst(k);
+    k->update();
+    k->up = unconst(parent);
+    unconst(parent)->*getter = unconst(k);
+    return fix_up(parent);
+  }
+
+  /**
+   * joins trees with detached `k` between them, trees must be roots
+   */
+  static avl_node const *join(avl_node const *l, avl_node const *k,
+                              avl_node const *r) noexcept {
+    assert(k->left == nullptr && k->right == nullptr && k->up == nullptr);
+    if (height_of(l) > height_of(r) + 1)
+      return join_side<&avl_node::right>(l, k, r);
+    if (height_of(r) > height_of(l) + 1)
+      return join_side<&avl_node::left>(r, k, l);
+    k->left = unconst(l);
+    k->right = unconst(r);
+    if (l != nullptr)
+      l->up = unconst(k);
+    if (r != nullptr)
+      r->up = unconst(k);
+    k->update();
+    return k;
+  }
+
+  static avl_node const *root_of(avl_node const *n) noexcept {
+    return n == nullptr ? nullptr : n->top();
+  }
+
+public:
+  template <avl_node *avl_node::*getter>
+  avl_node const *left_right_most() const noexcept {
+    auto cur = this;
+    while (cur->*getter != nullptr)
+      cur = cur->*getter;
+    return cur;
+  }
+
+  template <avl_node *avl_node::*getter>
+  avl_node const *next_prev_impl() const noexcept {
+    constexpr auto cogetter = cogetter_v<getter>;
+    if (auto r = this->*getter; r != nullptr)
+      return r->template left_right_most<cogetter>();
+    auto prev = this;
+    auto cur = up;
+    while (cur != nullptr && cur->*getter == prev) {
+      prev = cur;
+      cur = cur->up;
+    }
+    return cur;
+  }
+  avl_node const *next() const noexcept {
+    return next_prev_impl<&avl_node::right>();
+  }
+  avl_node const *prev() const noexcept {
+    return next_prev_impl<&avl_node::left>();
+  }
+
+  avl_node const *top() const noexcept {
+    auto cur = this;
+    while (cur->up != nullptr)
+      cur = cur->up;
+    return cur;
+  }
+  avl_node const *front() const noexcept {
+    return top()->template left_right_most<&avl_node::left>();
+  }
+  avl_node const *back() const noexcept {
+    return top()->template left_right_most<&avl_node::right>();
+  }
+
+  avl_node const *next_frozen() const noexcept { return next(); }
+  avl_node const *prev_frozen() const noexcept { return prev(); }
+  avl_node const *left_most_frozen() const noexcept { return front(); }
+  avl_node const *right_most_frozen() const noexcept { return back(); }
+
+  /**
+   * cuts as {[0..cur), [cur..end]}, returns roots
+   */
+  std::pair<avl_node const *, avl_node const *> cut() const noexcept {
+    auto l = left, r = right;
+    auto parent = up;
+    auto child = this;
+    if (l != nullptr)
+      l->up = nullptr;
+    if (r != nullptr)
+      r->up = nullptr;
+    left = right = up = nullptr;
+    avl_node const *res_l = l;
+    avl_node const *res_r = join(nullptr, this, r);
+    while (parent != nullptr) {
+      auto next_parent = parent->up;
+      bool from_right = parent->right == child;
+      auto other = from_right ? parent->left : parent->right;
+      if (other != nullptr)
+        other->up = nullptr;
+      parent->left = parent->right = parent->up = nullptr;
+      if (from_right)
+        res_l = join(other, parent, res_l);
+      else
+        res_r = join(res_r, parent, other);
+      child = parent;
+      parent = next_parent;
+    }
+    return {res_l, res_r};
+  }
+
+  /**
+   * joins two trees around detached current element
+   */
+  void merge(avl_node const *treel, avl_node const *treer) const noexcept {
+    join(root_of(treel), this, root_of(treer));
+  }
+
+  /**
+   * detaches current element from tree, returns root of remaining one
+   */
+  avl_node const *cutcutmerge() const noexcept {
+    if (left == nullptr || right == nullptr)
+      return unlink();
+    // successor takes place of this node
+    auto succ = right->template left_right_most<&avl_node::left>();
+    auto root = succ->unlink();
+    succ->left = left;
+    succ->right = right;
+    succ->height = height;
+    succ->size = size;
+    if (left != nullptr)
+      left->up = unconst(succ);
+    if (right != nullptr)
+      right->up = unconst(succ);
+    relink_parent(this, succ, up);
+    left = right = up = nullptr;
+    height = 1;
+    size = 1;
+    return root == this ? succ : root;
+  }
+
+  /**
+   * copies balancing information, used for structural copy
+   */
+  void copy_metadata(avl_node const *from) const noexcept {
+    height = from->height;
+    size = from->size;
+  }
+
+  /**
+   * links `n` nodes given in increasing order into perfectly balanced tree
+   * `get` maps iterator value to node, returns root
+   */
+  template <typename It, typename F>
+  static avl_node const *build(It first, std::size_t n, F const &get) {
+    if (n == 0)
+      return nullptr;
+    auto mid = n / 2;
+    avl_node const *cur = get(first[mid]);
+    auto l = build(first, mid, get);
+    auto r = build(first + mid + 1, n - mid - 1, get);
+    cur->left = unconst(l);
+    cur->right = unconst(r);
+    cur->up = nullptr;
+    if (l != nullptr)
+      l->up = unconst(cur);
+    if (r != nullptr)
+      r->up = unconst(cur);
+    cur->update();
+    return cur;
+  }
+
+  // position of node in its tree
+  std::size_t rank() const noexcept {
+    auto res = size_of(left);
+    for (auto cur = this; cur->up != nullptr; cur = cur->up)
+      if (cur->up->right == cur)
+        res += size_of(cur->up->left) + 1;
+    return res;
+  }
+
+  /**
+   * `k`-th node of tree which contains this one, `k` must be less than size
+   * of the tree
+   */
+  avl_node const *select(std::size_t k) const noexcept {
+    auto cur = top();
+    while (true) {
+      auto ls = size_of(cur->left);
+      if (k == ls)
+        return cur;
+      if (k < ls) {
+        cur = cur->left;
+      } else {
+        k -= ls + 1;
+        cur = cur->right;
+      }
+    }
+  }
+
+  std::size_t rank_frozen() const noexcept { return rank(); }
+  avl_node const *select_frozen(std::size_t k) const noexcept {
+    return select(k);
+  }
+};
+
+template <typename T, typename Tag = splay::default_tag_t<T>>
+class avl_holder : public avl_node<void> {
+public:
+  using node_t = avl_node<void>;
+  using value_type = T;
+
+  T data;
+
+  explicit avl_holder(T const &data) noexcept(
+      std::is_nothrow_constructible_v<T, T const &>)
+      : data(data) {}
+  explicit avl_holder(T &&data) noexcept(
+      std::is_nothrow_constructible_v<T, T &&>)
+      : data(std::move(data)) {}
+  // constructs value in place from arguments
+  template <typename... A>
+  avl_holder(std::piecewise_construct_t, std::tuple<A...> args)
+      : data(std::make_from_tuple<T>(std::move(args))) {}
+
+  constexpr node_t const *as_node() const noexcept {
+    return static_cast<node_t const *>(this);
+  }
+
+  static avl_holder const *cast(node_t const *from) noexcept {
+    if (from == nullptr)
+      return nullptr;
+    return static_cast<avl_holder const *>(from);
+  }
+
+  template <typename F, typename... A>
+  avl_holder const *call(F f, A &&... a) const noexcept {
+    return cast((this->*f)(std::forward<A>(a)...));
+  }
+
+  /**
+   * least element not less than `e` in tree whose top is `top`, or nullptr.
+   * lookup does not restructure the tree, so `top` stays the same
+   */
+  template <typename K, typename C>
+  static avl_holder const *find_ge(K const &e, C const &c,
+                                   node_t const *const &top)
+      noexcept(is_nothrow_comparable_v<T, C, K>) {
+    node_t const *cur = top;
+    avl_holder const *best = nullptr;
+    while (cur != nullptr) {
+      auto const &cd = cast(cur)->data;
+      if (c(e, cd)) {
+        best = cast(cur);
+        cur = cur->left;
+      } else if (!c(cd, e)) { // eq
+        return cast(cur);
+      } else {
+        cur = cur->right;
+      }
+    }
+    return best;
+  }
+  template <typename K, typename C>
+  avl_holder const *find_ge_frozen(K const &e, C const &c) const
+      noexcept(is_nothrow_comparable_v<T, C, K>) {
+    return find_ge(e, c, this->top());
+  }
+};
+
+/**
+ * bimap tree policy: worst case logarithmic operations
+ */
+struct policy {
+  template <typename T, typename Tag> using holder = avl_holder<T, Tag>;
+};
+} // namespace avl
@@ -0,0 +1,584 @@
+#include "bimap.h"
+#include "concurrent-bimap.h"
+
+#include "benchmark/benchmark.h"
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<boost/bimap.hpp>)
+#include <boost/bimap.hpp>
+#include <boost/bimap/set_of.hpp>
+#define BIMAP_BENCH_BOOST 1
+#endif
+
+/**
+ * run with `--benchmark_format=json` (or see bench.sh) for machine readable
+ * output. names are `operation/container<key>/pattern/size`
+ */
+
+namespace {
+constexpr std::size_t queries_per_iteration = 1 << 14;
+
+// bijective on 32 bits, so keys are distinct
+std::uint32_t scramble(std::uint32_t x, std::uint32_t salt) {
+  x ^= salt;
+  x *= 0x9E3779B1u;
+  x ^= x >> 15;
+  x *= 0x85EBCA77u;
+  x ^= x >> 13;
+  return x;
+}
+
+template <typename K> K make_key(std::uint32_t x);
+template <> int make_key<int>(std::uint32_t x) {
+  return static_cast<int>(x);
+}
+template <> std::string make_key<std::string>(std::uint32_t x) {
+  // long enough to never fit into small string buffer
+  static char const digits[] = "0123456789abcdef";
+  std::string res = "bimap-key-";
+  for (int i = 28; i >= 0; i -= 4)
+    res += digits[(x >> i) & 15];
+  return res;
+}
+
+template <typename K> struct dataset {
+  std::vector<K> lefts, rights;
+  // left keys bounding ~10% of elements, for range erase
+  K range_from, range_to;
+};
+
+template <typename K> dataset<K> const &get_dataset(std::size_t n) {
+  static std::unordered_map<std::size_t, dataset<K>> cache;
+  auto found = cache.find(n);
+  if (found != cache.end())
+    return found->second;
+  auto &res = cache[n];
+  res.lefts.reserve(n);
+  res.rights.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    res.lefts.push_back(make_key<K>(scramble(i, 0x1234567u)));
+    res.rights.push_back(make_key<K>(scramble(i, 0x7654321u)));
+  }
+  res.range_from = make_key<K>(0x40000000u);
+  res.range_to = make_key<K>(0x40000000u + 0x1999999Au);
+  return res;
+}
+
+enum class pattern { uniform, sequential, zipfian, working_set };
+
+char const *pattern_name(pattern p) {
+  switch (p) {
+  case pattern::uniform:
+    return "uniform";
+  case pattern::sequential:
+    return "sequential";
+  case pattern::zipfian:
+    return "zipfian";
+  case pattern::working_set:
+    return "working_set";
+  }
+  return "";
+}
+
+// zipfian generator from "Quickly Generating Billion-Record Synthetic
+// Databases", Gray et al.
+class zipf_distribution {
+  static constexpr double theta = 0.99;
+  std::size_t n;
+  double zetan, alpha, eta;
+
+  static double zeta(std::size_t n) {
+    double res = 0;
+    for (std::size_t i = 1; i <= n; i++)
+      res += 1 / std::pow(double(i), theta);
+    return res;
+  }
+
+public:
+  explicit zipf_distribution(std::size_t n) : n(n), zetan(zeta(n)) {
+    alpha = 1 / (1 - theta);
+    eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2) / zetan);
+  }
+
+  template <typename G> std::size_t operator()(G &g) {
+    double u = std::uniform_real_distribution<double>()(g);
+    double uz = u * zetan;
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + std::pow(0.5, theta))
+      return 1;
+    auto rank = n * std::pow(eta * u - eta + 1, alpha);
+    return std::min<std::size_t>(n - 1, static_cast<std::size_t>(rank));
+  }
+};
+
+/**
+ * indices of elements to access, every element is accessed once for
+ * sequential and uniform patterns when `count == n`
+ */
+template <typename K>
+std::vector<std::size_t> make_accesses(pattern p, std::size_t n,
+                                       std::size_t count, bool right = false) {
+  std::mt19937_64 gen(n * 31 + static_cast<int>(p));
+  std::vector<std::size_t> res(count);
+  switch (p) {
+  case pattern::uniform:
+    if (count == n) {
+      for (std::size_t i = 0; i < n; i++)
+        res[i] = i;
+      std::shuffle(res.begin(), res.end(), gen);
+    } else {
+      std::uniform_int_distribution<std::size_t> d(0, n - 1);
+      for (auto &x : res)
+        x = d(gen);
+    }
+    break;
+  case pattern::sequential: {
+    // in key order, not in generation order
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; i++)
+      order[i] = i;
+    auto const &data = get_dataset<K>(n);
+    auto const &keys = right ? data.rights : data.lefts;
+    std::sort(order.begin(), order.end(),
+              [&](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+    for (std::size_t i = 0; i < count; i++)
+      res[i] = order[i % n];
+    break;
+  }
+  case pattern::zipfian: {
+    static std::unordered_map<std::size_t, zipf_distribution> cache;
+    auto &d = cache.try_emplace(n, n).first->second;
+    // hot elements are spread over key space
+    for (auto &x : res)
+      x = (d(gen) * 0x9E3779B97F4A7C15ull) % n;
+    break;
+  }
+  case pattern::working_set: {
+    // 1% of elements receive all accesses
+    std::size_t ws = std::max<std::size_t>(n / 100, 1);
+    std::uniform_int_distribution<std::size_t> d(0, ws - 1);
+    std::size_t offset = gen() % n;
+    for (auto &x : res)
+      x = (offset + d(gen) * 100) % n;
+    break;
+  }
+  }
+  return res;
+}
+
+template <typename K, typename Policy> struct bimap_adapter {
+  using map_t =
+      bimap<K, K, std::less<K>, std::less<K>, std::allocator<std::pair<K, K>>,
+            Policy>;
+  map_t m;
+
+  void insert(K const &l, K const &r) { m.insert(l, r); }
+  void insert_batch(std::pair<K, K> const *first, std::pair<K, K> const *last) {
+    m.insert_batch(first, last);
+  }
+  bool find_left(K const &k) const { return m.find_left(k) != m.end_left(); }
+  bool find_right(K const &k) const {
+    return m.find_right(k) != m.end_right();
+  }
+  bool lower_bound_left(K const &k) const {
+    return m.lower_bound_left(k) != m.end_left();
+  }
+  bool upper_bound_left(K const &k) const {
+    return m.upper_bound_left(k) != m.end_left();
+  }
+  bool erase_left(K const &k) { return m.erase_left(k); }
+  void erase_all_by_iterator() {
+    for (auto it = m.begin_left(); it != m.end_left();)
+      it = m.erase_left(it);
+  }
+  void erase_range(K const &from, K const &to) {
+    m.erase_left(m.lower_bound_left(from), m.lower_bound_left(to));
+  }
+  std::size_t iterate() const {
+    std::size_t res = 0;
+    for (auto it = m.begin_left(); it != m.end_left(); ++it)
+      res++;
+    for (auto it = m.begin_right(); it != m.end_right(); ++it)
+      res++;
+    return res;
+  }
+  void clear() { m.clear(); }
+  std::size_t size() const { return m.size(); }
+};
+
+template <typename K> struct two_maps_adapter {
+  std::map<K, K> left, right;
+
+  void insert(K const &l, K const &r) {
+    if (left.count(l) != 0 || right.count(r) != 0)
+      return;
+    left.emplace(l, r);
+    right.emplace(r, l);
+  }
+  void insert_batch(std::pair<K, K> const *first, std::pair<K, K> const *last) {
+    for (; first != last; ++first)
+      insert(first->first, first->second);
+  }
+  bool find_left(K const &k) const { return left.find(k) != left.end(); }
+  bool find_right(K const &k) const { return right.find(k) != right.end(); }
+  bool lower_bound_left(K const &k) const {
+    return left.lower_bound(k) != left.end();
+  }
+  bool upper_bound_left(K const &k) const {
+    return left.upper_bound(k) != left.end();
+  }
+  bool erase_left(K const &k) {
+    auto it = left.find(k);
+    if (it == left.end())
+      return false;
+    right.erase(it->second);
+    left.erase(it);
+    return true;
+  }
+  void erase_all_by_iterator() {
+    for (auto it = left.begin(); it != left.end();) {
+      right.erase(it->second);
+      it = left.erase(it);
+    }
+  }
+  void erase_range(K const &from, K const &to) {
+    auto f = left.lower_bound(from), t = left.lower_bound(to);
+    for (auto it = f; it != t; ++it)
+      right.erase(it->second);
+    left.erase(f, t);
+  }
+  std::size_t iterate() const {
+    std::size_t res = 0;
+    for (auto it = left.begin(); it != left.end(); ++it)
+      res++;
+    for (auto it = right.begin(); it != right.end(); ++it)
+      res++;
+    return res;
+  }
+  void clear() {
+    left.clear();
+    right.clear();
+  }
+  std::size_t size() const { return left.size(); }
+};
+
+#ifdef BIMAP_BENCH_BOOST
+template <typename K> struct boost_adapter {
+  using map_t =
+      boost::bimaps::bimap<boost::bimaps::set_of<K>, boost::bimaps::set_of<K>>;
+  map_t m;
+
+  void insert(K const &l, K const &r) {
+    m.insert(typename map_t::value_type(l, r));
+  }
+  void insert_batch(std::pair<K, K> const *first, std::pair<K, K> const *last) {
+    for (; first != last; ++first)
+      insert(first->first, first->second);
+  }
+  bool find_left(K const &k) const { return m.left.find(k) != m.left.end(); }
+  bool find_right(K const &k) const {
+    return m.right.find(k) != m.right.end();
+  }
+  bool lower_bound_left(K const &k) const {
+    return m.left.lower_bound(k) != m.left.end();
+  }
+  bool upper_bound_left(K const &k) const {
+    return m.left.upper_bound(k) != m.left.end();
+  }
+  bool erase_left(K const &k) { return m.left.erase(k) != 0; }
+  void erase_all_by_iterator() {
+    for (auto it = m.left.begin(); it != m.left.end();)
+      it = m.left.erase(it);
+  }
+  void erase_range(K const &from, K const &to) {
+    m.left.erase(m.left.lower_bound(from), m.left.lower_bound(to));
+  }
+  std::size_t iterate() const {
+    std::size_t res = 0;
+    for (auto it = m.left.begin(); it != m.left.end(); ++it)
+      res++;
+    for (auto it = m.right.begin(); it != m.right.end(); ++it)
+      res++;
+    return res;
+  }
+  void clear() { m.clear(); }
+  std::size_t size() const { return m.size(); }
+};
+#endif
+
+template <typename A, typename K> void fill(A &a, dataset<K> const &data) {
+  for (std::size_t i = 0; i < data.lefts.size(); i++)
+    a.insert(data.lefts[i], data.rights[i]);
+}
+
+template <typename A, typename K>
+void bm_insert(benchmark::State &state, pattern p) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  auto order = make_accesses<K>(p, n, n);
+  for (auto _ : state) {
+    A a;
+    for (auto i : order)
+      a.insert(data.lefts[i], data.rights[i]);
+    benchmark::DoNotOptimize(a.size());
+    state.PauseTiming();
+    a.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// pairs arrive in batches of fixed size
+template <typename A, typename K>
+void bm_insert_batch(benchmark::State &state, std::size_t batch) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  auto order = make_accesses<K>(pattern::uniform, n, n);
+  std::vector<std::pair<K, K>> pairs;
+  pairs.reserve(n);
+  for (auto i : order)
+    pairs.emplace_back(data.lefts[i], data.rights[i]);
+  for (auto _ : state) {
+    A a;
+    for (std::size_t i = 0; i < n; i += batch)
+      a.insert_batch(pairs.data() + i, pairs.data() + std::min(i + batch, n));
+    benchmark::DoNotOptimize(a.size());
+    state.PauseTiming();
+    a.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename A, typename K, typename F>
+void bm_lookup(benchmark::State &state, pattern p, bool right, F f) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  auto const &keys = right ? data.rights : data.lefts;
+  auto accesses = make_accesses<K>(p, n, queries_per_iteration, right);
+  A a;
+  fill(a, data);
+  for (auto _ : state)
+    for (auto i : accesses)
+      benchmark::DoNotOptimize(f(a, keys[i]));
+  state.SetItemsProcessed(state.iterations() * accesses.size());
+}
+
+template <typename A, typename K>
+void bm_erase_value(benchmark::State &state, pattern p) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  auto order = make_accesses<K>(p, n, n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    A a;
+    fill(a, data);
+    state.ResumeTiming();
+    for (auto i : order)
+      benchmark::DoNotOptimize(a.erase_left(data.lefts[i]));
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename A, typename K>
+void bm_erase_iterator(benchmark::State &state) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    A a;
+    fill(a, data);
+    state.ResumeTiming();
+    a.erase_all_by_iterator();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename A, typename K>
+void bm_erase_range(benchmark::State &state) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  std::size_t erased = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    A a;
+    fill(a, data);
+    auto before = a.size();
+    state.ResumeTiming();
+    a.erase_range(data.range_from, data.range_to);
+    state.PauseTiming();
+    erased += before - a.size();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(erased);
+}
+
+template <typename A, typename K> void bm_iterate(benchmark::State &state) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  A a;
+  fill(a, get_dataset<K>(n));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(a.iterate());
+  state.SetItemsProcessed(state.iterations() * 2 * n);
+}
+
+template <typename A, typename K> void bm_copy(benchmark::State &state) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  A a;
+  fill(a, get_dataset<K>(n));
+  for (auto _ : state) {
+    A copy(a);
+    benchmark::DoNotOptimize(copy.size());
+    state.PauseTiming();
+    copy.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename A, typename K> void bm_clear(benchmark::State &state) {
+  auto n = static_cast<std::size_t>(state.range(0));
+  auto const &data = get_dataset<K>(n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    A a;
+    fill(a, data);
+    state.ResumeTiming();
+    a.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+constexpr std::size_t concurrent_size = 1000000;
+
+// built once on first use, then only read, so threads may share it
+template <typename K> struct concurrent_dataset {
+  concurrent_bimap<K, K> map;
+  std::vector<K> const &lefts, &rights;
+  std::vector<std::size_t> accesses;
+
+  concurrent_dataset()
+      : lefts(get_dataset<K>(concurrent_size).lefts),
+        rights(get_dataset<K>(concurrent_size).rights),
+        accesses(make_accesses<K>(pattern::uniform, concurrent_size,
+                                  queries_per_iteration)) {
+    fill(map, get_dataset<K>(concurrent_size));
+  }
+
+  static concurrent_dataset const &get() {
+    static concurrent_dataset const res;
+    return res;
+  }
+};
+
+// every benchmark thread looks up in one map, throughput should grow with
+// count of threads
+template <typename K>
+void bm_concurrent_lookup(benchmark::State &state, bool right) {
+  auto const &data = concurrent_dataset<K>::get();
+  auto const &keys = right ? data.rights : data.lefts;
+  for (auto _ : state)
+    for (auto i : data.accesses) {
+      if (right)
+        benchmark::DoNotOptimize(data.map.find_right(keys[i]));
+      else
+        benchmark::DoNotOptimize(data.map.find_left(keys[i]));
+    }
+  state.SetItemsProcessed(state.iterations() * data.accesses.size());
+}
+
+void apply_sizes(benchmark::internal::Benchmark *b) {
+  for (std::int64_t n = 1000; n <= 10000000; n *= 10)
+    b->Arg(n);
+  b->Unit(benchmark::kMicrosecond);
+}
+
+template <typename A, typename K>
+void register_container(std::string const &name) {
+  pattern const all_patterns[] = {pattern::uniform, pattern::sequential,
+                                  pattern::zipfian, pattern::working_set};
+  pattern const order_patterns[] = {pattern::uniform, pattern::sequential};
+
+  auto reg = [&](std::string const &op, std::string const &suffix, auto f) {
+    apply_sizes(benchmark::RegisterBenchmark(
+        (op + "/" + name + suffix).c_str(), f));
+  };
+
+  for (auto p : order_patterns) {
+    auto suffix = std::string("/") + pattern_name(p);
+    reg("insert", suffix,
+        [p](benchmark::State &s) { bm_insert<A, K>(s, p); });
+    reg("erase_value", suffix,
+        [p](benchmark::State &s) { bm_erase_value<A, K>(s, p); });
+  }
+  for (auto p : all_patterns) {
+    auto suffix = std::string("/") + pattern_name(p);
+    reg("find_left", suffix, [p](benchmark::State &s) {
+      bm_lookup<A, K>(s, p, false,
+                      [](A const &a, K const &k) { return a.find_left(k); });
+    });
+    reg("find_right", suffix, [p](benchmark::State &s) {
+      bm_lookup<A, K>(s, p, true,
+                      [](A const &a, K const &k) { return a.find_right(k); });
+    });
+    reg("lower_bound", suffix, [p](benchmark::State &s) {
+      bm_lookup<A, K>(s, p, false, [](A const &a, K const &k) {
+        return a.lower_bound_left(k);
+      });
+    });
+    reg("upper_bound", suffix, [p](benchmark::State &s) {
+      bm_lookup<A, K>(s, p, false, [](A const &a, K const &k) {
+        return a.upper_bound_left(k);
+      });
+    });
+  }
+  for (std::size_t batch : {100, 10000})
+    reg("insert_batch", "/" + std::to_string(batch),
+        [batch](benchmark::State &s) { bm_insert_batch<A, K>(s, batch); });
+  reg("erase_iterator", "", bm_erase_iterator<A, K>);
+  reg("erase_range", "", bm_erase_range<A, K>);
+  reg("iterate", "", bm_iterate<A, K>);
+  reg("copy", "", bm_copy<A, K>);
+  reg("clear", "", bm_clear<A, K>);
+}
+
+template <typename K> void register_key(std::string const &key) {
+  register_container<bimap_adapter<K, splay::policy>, K>("bimap<" + key +
+                                                         ">");
+  register_container<bimap_adapter<K, avl::policy>, K>("bimap_avl<" + key +
+                                                       ">");
+  register_container<two_maps_adapter<K>, K>("std_map_pair<" + key + ">");
+  auto threads = static_cast<int>(bimap_helper::hardware_threads());
+  for (bool right : {false, true}) {
+    auto name = std::string(right ? "find_right" : "find_left") +
+                "/concurrent_bimap<" + key + ">/uniform/" +
+                std::to_string(concurrent_size);
+    benchmark::RegisterBenchmark(name.c_str(),
+                                 [right](benchmark::State &s) {
+                                   bm_concurrent_lookup<K>(s, right);
+                                 })
+        ->ThreadRange(1, threads)
+        ->UseRealTime()
+        ->Unit(benchmark::kMicrosecond);
+  }
+#ifdef BIMAP_BENCH_BOOST
+  register_container<boost_adapter<K>, K>("boost_bimap<" + key + ">");
+#endif
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  register_key<int>("int");
+  register_key<std::string>("string");
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+}
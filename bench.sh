@@ -0,0 +1,8 @@
+#!/bin/bash
+# usage: ./bench.sh [extra benchmark flags], results go to bench_output.json
+
+mkdir -p cmake-build-Release
+cmake -DCMAKE_BUILD_TYPE=Release -DBIMAP_BUILD_BENCH=ON -S . -B cmake-build-Release
+cmake --build cmake-build-Release --target bimap_bench
+cmake-build-Release/bimap_bench --benchmark_out=bench_output.json \
+  --benchmark_out_format=json "$@"
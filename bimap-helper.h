@@ -1,12 +1,20 @@
 #pragma once
 
 #include "splay.h"
+#include <algorithm>
 #include <cstddef>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 template <typename Left, typename Right, typename CompareLeft,
-          typename CompareRight>
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
 struct bimap;
 
 namespace bimap_helper {
@@ -27,11 +35,18 @@ using second_tag = std::conditional_t<std::is_same_v<Left, Right>,
                                       splay::default_tag2_t<Right>,
                                       splay::default_tag_t<Right>>;
 
-template <typename Left, typename Right>
-struct node_t : splay::splay_holder<Left>,
-                splay::splay_holder<Right, second_tag<Left, Right>> {
-  using left_holder = splay::splay_holder<Left>;
-  using right_holder = splay::splay_holder<Right, second_tag<Left, Right>>;
+/**
+ * `Policy::holder` is tree node which holds value,
+ * see splay::policy and avl::policy
+ */
+template <typename Left, typename Right, typename Policy = splay::policy>
+struct node_t
+    : Policy::template holder<Left, splay::default_tag_t<Left>>,
+      Policy::template holder<Right, second_tag<Left, Right>> {
+  using left_holder =
+      typename Policy::template holder<Left, splay::default_tag_t<Left>>;
+  using right_holder =
+      typename Policy::template holder<Right, second_tag<Left, Right>>;
 
   using left_t = Left;
   using right_t = Right;
@@ -46,6 +61,10 @@ struct node_t : splay::splay_holder<Left>,
   template <typename T1, typename T2>
   node_t(T1 &&l, T2 &&r)
       : left_holder(std::forward<T1>(l)), right_holder(std::forward<T2>(r)) {}
+  template <typename... A1, typename... A2>
+  node_t(std::piecewise_construct_t, std::tuple<A1...> l, std::tuple<A2...> r)
+      : left_holder(std::piecewise_construct, std::move(l)),
+        right_holder(std::piecewise_construct, std::move(r)) {}
 
   template <typename T, typename = std::enable_if_t<
                             is_one_of_v<T, left_holder, right_holder>>>
@@ -66,31 +85,61 @@ using coholder_t = std::conditional_t<
     std::is_same_v<storage_type, typename node_t::left_holder>,
     typename node_t::right_holder, typename node_t::left_holder>;
 
-template <typename Node, typename StorageType> struct bimap_iterator {
+/**
+ * `Frozen` iterators never restructure the tree, see bimap::frozen_view
+ */
+template <typename Node, typename StorageType, bool Frozen = false>
+struct bimap_iterator {
 private:
   using node_t = Node;
   using storage_type = StorageType;
 
-  node_t const *const *root;
+  static constexpr std::size_t side =
+      std::is_same_v<storage_type, typename node_t::left_holder> ? 0 : 1;
+
+  // tops of left and right trees of bimap
+  node_t const **tops;
   node_t const *node;
 
+  /**
+   * step either moves found node to top of its tree or does not restructure
+   * the tree, so tops of bimap stay exact
+   */
+  void track_top() noexcept {
+    auto holder = static_cast<storage_type const *>(node);
+    if (holder != nullptr && holder->up == nullptr)
+      tops[side] = node;
+  }
+
 public:
   using value_type = typename storage_type::value_type;
   using pointer_type = value_type const *;
   using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
   using iterator_category = std::bidirectional_iterator_tag;
 
-  template <typename, typename, typename, typename> friend struct ::bimap;
+  template <typename, typename, typename, typename, typename, typename,
+            typename>
+  friend struct ::bimap;
 
   bimap_iterator() = default;
-  bimap_iterator(decltype(root) root, node_t const *node) noexcept
-      : root(root), node(node) {}
+  bimap_iterator(node_t const **tops, node_t const *node) noexcept
+      : tops(tops), node(node) {}
 
   pointer_type operator->() const { return &node->storage_type::data; }
   reference_type operator*() const noexcept { return *operator->(); }
 
   bimap_iterator &operator++() noexcept {
-    node = node_t::cast(node->storage_type::call(&storage_type::node_t::next));
+    if constexpr (Frozen)
+      node = node_t::cast(
+          node->storage_type::call(&storage_type::node_t::next_frozen));
+    else {
+      node =
+          node_t::cast(node->storage_type::call(&storage_type::node_t::next));
+      track_top();
+    }
 
     return *this;
   }
@@ -101,12 +150,22 @@ public:
   }
 
   bimap_iterator &operator--() noexcept {
-    if (node == nullptr) {
-      auto rt = static_cast<storage_type const *>(*root);
-      rt->splay();
-      return rt->call(&storage_type::node_t::right_most);
+    auto rt = static_cast<storage_type const *>(tops[side]);
+    if constexpr (Frozen) {
+      if (node == nullptr)
+        node = node_t::cast(
+            rt->call(&storage_type::node_t::right_most_frozen));
+      else
+        node = node_t::cast(
+            node->storage_type::call(&storage_type::node_t::prev_frozen));
+      return *this;
     }
-    node = node_t::cast(node->storage_type::call(&storage_type::node_t::prev));
+    if (node == nullptr)
+      node = node_t::cast(rt->call(&storage_type::node_t::back));
+    else
+      node =
+          node_t::cast(node->storage_type::call(&storage_type::node_t::prev));
+    track_top();
 
     return *this;
   }
@@ -117,7 +176,8 @@ public:
   }
 
   auto flip() const noexcept {
-    return bimap_iterator<node_t, coholder_t<node_t, storage_type>>(root, node);
+    return bimap_iterator<node_t, coholder_t<node_t, storage_type>, Frozen>(
+        tops, node);
   }
 
   bool operator==(bimap_iterator const &r) const noexcept {
@@ -146,6 +206,81 @@ struct tagged_comparator : public T {
   }
 };
 
+// same as above, but allocator must be mutable
+template <typename T> struct allocator_holder : public T {
+  allocator_holder() = default;
+
+  explicit allocator_holder(T const &t) noexcept(
+      std::is_nothrow_constructible_v<T, T const &>)
+      : T(t) {}
+
+  explicit allocator_holder(T &&t) noexcept(
+      std::is_nothrow_constructible_v<T, T &&>)
+      : T(std::move(t)) {}
+
+  T &allocator() noexcept { return static_cast<T &>(*this); }
+  T const &allocator() const noexcept { return static_cast<T const &>(*this); }
+};
+
+/**
+ * tags for bulk construction: caller promises that input range is sorted by
+ * left (right) value, so this side is not sorted again
+ */
+struct ordered_left_t {
+  explicit ordered_left_t() = default;
+};
+struct ordered_right_t {
+  explicit ordered_right_t() = default;
+};
+static constexpr ordered_left_t ordered_left{};
+static constexpr ordered_right_t ordered_right{};
+
+template <typename C, typename = void>
+struct is_transparent : std::false_type {};
+template <typename C>
+struct is_transparent<C, std::void_t<typename C::is_transparent>>
+    : std::true_type {};
+template <typename C>
+static constexpr bool is_transparent_v = is_transparent<C>::value;
+
+/**
+ * enables lookup by key `K` of other type, like in std::map, if comparator
+ * declares `is_transparent`
+ */
+template <typename C, typename K>
+using if_transparent_t = std::enable_if_t<is_transparent_v<C>, K>;
+
+/**
+ * for every pair of `map` in order of right values, rank of its left value.
+ * pairs are matched by addresses of left values, so `flip` of right iterator
+ * must refer to the same object as left iterator does
+ */
+template <typename Index, typename Map>
+std::vector<Index> left_ranks(Map const &map) {
+  using left_t = typename Map::left_t;
+  std::vector<left_t const *> addr;
+  for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+    if (addr.size() == std::numeric_limits<Index>::max())
+      throw std::length_error("too many pairs");
+    addr.push_back(&*it);
+  }
+  auto n = addr.size();
+  // ranks ordered by address
+  std::vector<Index> by_addr(n);
+  for (std::size_t i = 0; i < n; i++)
+    by_addr[i] = static_cast<Index>(i);
+  std::less<left_t const *> less;
+  std::sort(by_addr.begin(), by_addr.end(),
+            [&](Index a, Index b) { return less(addr[a], addr[b]); });
+  std::vector<Index> res;
+  res.reserve(n);
+  for (auto it = map.begin_right(); it != map.end_right(); ++it)
+    res.push_back(*std::lower_bound(
+        by_addr.begin(), by_addr.end(), &*it.flip(),
+        [&](Index a, left_t const *b) { return less(addr[a], b); }));
+  return res;
+}
+
 template <typename C, typename T>
 bool NotEqual(C const &c, T const &l, T const &r) {
   return c(l, r) || c(r, l);
@@ -1,46 +1,112 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <exception>
 #include <functional>
+#include <iterator>
 #include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <type_traits>
 #include <utility>
 
+#include "avl.h"
 #include "bimap-helper.h"
+#include "hash-index.h"
+#include "node-pool.h"
 #include "splay.h"
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Policy = splay::policy,
+          typename Index = bimap_helper::no_index>
 struct bimap
     : private bimap_helper::tagged_comparator<CompareLeft>,
       private bimap_helper::tagged_comparator<
-          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>> {
+          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>,
+      private bimap_helper::allocator_holder<
+          typename std::allocator_traits<Allocator>::template rebind_alloc<
+              bimap_helper::node_t<Left, Right, Policy>>>,
+      private bimap_helper::node_index<
+          bimap_helper::node_t<Left, Right, Policy>, Index> {
   using left_t = Left;
   using right_t = Right;
+  using allocator_type = Allocator;
 
 private:
-  using node_t = bimap_helper::node_t<Left, Right>;
+  using node_t = bimap_helper::node_t<Left, Right, Policy>;
   using left_comparator_holder = bimap_helper::tagged_comparator<CompareLeft>;
   using right_comparator_holder = bimap_helper::tagged_comparator<
       CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>;
+  using node_allocator_t = typename std::allocator_traits<
+      Allocator>::template rebind_alloc<node_t>;
+  using node_allocator_traits = std::allocator_traits<node_allocator_t>;
+  using allocator_holder = bimap_helper::allocator_holder<node_allocator_t>;
+  using index_t = bimap_helper::node_index<node_t, Index>;
 
-  template <typename T>
-  using iterator_from_node_type = bimap_helper::bimap_iterator<node_t, T>;
+  template <typename T, bool Frozen = false>
+  using iterator_from_node_type =
+      bimap_helper::bimap_iterator<node_t, T, Frozen>;
 
 public:
   using left_iterator = iterator_from_node_type<typename node_t::left_holder>;
   using right_iterator = iterator_from_node_type<typename node_t::right_holder>;
 
+  class node_type;
+
 private:
   template <typename T>
   using co_iterator = std::conditional_t<std::is_same_v<left_iterator, T>,
                                          right_iterator, left_iterator>;
 
-  node_t const *root;
+  /**
+   * top nodes of left and right trees, both are nullptr if bimap is empty.
+   * lookups descend from them without looking at parent links, so every
+   * operation which restructures a tree (iterators too) records its new top
+   */
+  mutable node_t const *tops[2] = {nullptr, nullptr};
   std::size_t sz;
 
+  template <typename T>
+  static constexpr std::size_t side_v =
+      std::is_same_v<T, typename node_t::left_holder> ? 0 : 1;
+
+  template <typename T> T const *top() const noexcept {
+    auto res = tops[side_v<T>]->template get_node<T>();
+    assert(res->up == nullptr);
+    return res;
+  }
+  template <typename T> void set_top(T const *n) const noexcept {
+    tops[side_v<T>] = node_t::cast(n);
+  }
+  // `n` is any node of `T` tree, walk up is short if it was just splayed
+  template <typename T> void find_top(T const *n) const noexcept {
+    set_top(n == nullptr ? nullptr : n->call(&T::node_t::top));
+  }
+  // after operation which either moves `n` to top or keeps tree as is
+  template <typename T> void track_top(T const *n) const noexcept {
+    if (n != nullptr && n->up == nullptr)
+      set_top(n);
+  }
+  // first and last elements of nonempty `T` tree
+  template <typename T> T const *front() const noexcept {
+    auto res = top<T>()->call(&T::node_t::front);
+    track_top(res);
+    return res;
+  }
+  template <typename T> T const *back() const noexcept {
+    auto res = top<T>()->call(&T::node_t::back);
+    track_top(res);
+    return res;
+  }
+
   CompareLeft const &left_comparator() const noexcept {
     return static_cast<CompareLeft const &>(
         static_cast<left_comparator_holder const &>(*this));
@@ -64,69 +130,218 @@ private:
       return ""; // generate error
   }
 
+  node_allocator_t &node_allocator() noexcept {
+    return static_cast<allocator_holder &>(*this).allocator();
+  }
+  node_allocator_t const &node_allocator() const noexcept {
+    return static_cast<allocator_holder const &>(*this).allocator();
+  }
+
+  index_t &index() noexcept { return static_cast<index_t &>(*this); }
+  index_t const &index() const noexcept {
+    return static_cast<index_t const &>(*this);
+  }
+
+  template <typename... A> node_t *create_node(A &&... a) {
+    auto &alloc = node_allocator();
+    auto node = node_allocator_traits::allocate(alloc, 1);
+    try {
+      node_allocator_traits::construct(alloc, node, std::forward<A>(a)...);
+    } catch (...) {
+      node_allocator_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+  void destroy_node(node_t const *node) noexcept {
+    auto &alloc = node_allocator();
+    auto unconst = const_cast<node_t *>(node);
+    node_allocator_traits::destroy(alloc, unconst);
+    node_allocator_traits::deallocate(alloc, unconst, 1);
+  }
+  // node is destroyed if it can not be indexed
+  void index_node(node_t const *node) {
+    try {
+      index().insert(node);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+  }
+
+  /**
+   * post order walk over `T` tree, children are unlinked on the way down,
+   * so `f` may destroy node
+   */
+  template <typename T, typename F>
+  static void walk_post_order(typename T::node_t const *cur,
+                              F const &f) noexcept {
+    while (cur != nullptr) {
+      if (auto l = cur->left; l != nullptr) {
+        cur->left = nullptr;
+        cur = l;
+      } else if (auto r = cur->right; r != nullptr) {
+        cur->right = nullptr;
+        cur = r;
+      } else {
+        auto up = cur->up;
+        f(node_t::cast(T::cast(cur)));
+        cur = up;
+      }
+    }
+  }
+
   void copy_elements(bimap const &other);
 
+  static std::size_t log2_ceil(std::size_t n) noexcept {
+    std::size_t res = 1;
+    while ((std::size_t(1) << res) < n)
+      res++;
+    return res;
+  }
+
+  /**
+   * inserts pairs as if by sequential `insert`. batch is sorted by both
+   * sides, merged against trees in one sweep (or looked up, if it is small)
+   * and then linked node by node or by rebuilding trees, whichever is
+   * cheaper. `SortLeft` (`SortRight`) is false if batch is already sorted
+   */
+  template <bool SortLeft, bool SortRight, typename InputIt>
+  void insert_batch_impl(InputIt first, InputIt last,
+                         std::vector<bool> *inserted);
+
 public:
   // it is not me! it is clang format!
-  bimap(CompareLeft cl = CompareLeft(),
-        CompareRight cr =
-            CompareRight()) noexcept(std::
-                                         is_nothrow_constructible_v<
-                                             left_comparator_holder,
-                                             CompareLeft &&>
-                                             &&std::is_nothrow_constructible_v<
-                                                 right_comparator_holder,
-                                                 CompareRight &&>)
+  bimap(CompareLeft cl = CompareLeft(), CompareRight cr = CompareRight(),
+        Allocator const &alloc =
+            Allocator()) noexcept(std::
+                                      is_nothrow_constructible_v<
+                                          left_comparator_holder,
+                                          CompareLeft &&>
+                                          &&std::is_nothrow_constructible_v<
+                                              right_comparator_holder,
+                                              CompareRight &&>
+                                              &&std::is_nothrow_constructible_v<
+                                                  node_allocator_t,
+                                                  Allocator const &>)
       : left_comparator_holder(std::move(cl)),
-        right_comparator_holder(std::move(cr)), root(nullptr), sz(0) {}
+        right_comparator_holder(std::move(cr)),
+        allocator_holder(node_allocator_t(alloc)), sz(0) {}
 
   bimap(bimap const &other)
-      : bimap(other.left_comparator(), other.right_comparator()) {
+      : left_comparator_holder(other.left_comparator()),
+        right_comparator_holder(other.right_comparator()),
+        allocator_holder(
+            node_allocator_traits::select_on_container_copy_construction(
+                other.node_allocator())),
+        sz(0) {
     copy_elements(other);
   }
-  bimap(bimap &&other) noexcept : root(other.root), sz(other.sz) {
-    other.root = nullptr;
+  bimap(bimap &&other) noexcept
+      : left_comparator_holder(other.left_comparator()),
+        right_comparator_holder(other.right_comparator()),
+        allocator_holder(std::move(other.node_allocator())),
+        index_t(std::move(other.index())), tops{other.tops[0], other.tops[1]},
+        sz(other.sz) {
+    other.tops[0] = other.tops[1] = nullptr;
     other.sz = 0;
   }
 
+  /**
+   * bulk construction, O(n log n) for sorting and O(n) for linking
+   * pairs which clash with previous ones are skipped, as with `insert`
+   */
+  template <typename InputIt>
+  bimap(InputIt first, InputIt last, CompareLeft cl = CompareLeft(),
+        CompareRight cr = CompareRight(), Allocator const &alloc = Allocator())
+      : bimap(std::move(cl), std::move(cr), alloc) {
+    insert_batch_impl<true, true>(first, last, nullptr);
+  }
+  template <typename InputIt>
+  bimap(bimap_helper::ordered_left_t, InputIt first, InputIt last,
+        CompareLeft cl = CompareLeft(), CompareRight cr = CompareRight(),
+        Allocator const &alloc = Allocator())
+      : bimap(std::move(cl), std::move(cr), alloc) {
+    insert_batch_impl<false, true>(first, last, nullptr);
+  }
+  template <typename InputIt>
+  bimap(bimap_helper::ordered_right_t, InputIt first, InputIt last,
+        CompareLeft cl = CompareLeft(), CompareRight cr = CompareRight(),
+        Allocator const &alloc = Allocator())
+      : bimap(std::move(cl), std::move(cr), alloc) {
+    insert_batch_impl<true, false>(first, last, nullptr);
+  }
+
   bimap &operator=(bimap const &other) {
     copy_elements(other);
     return *this;
   }
   bimap &operator=(bimap &&other) noexcept {
-    std::swap(root, other.root);
-    std::swap(sz, other.sz);
+    using std::swap;
+    swap(node_allocator(), other.node_allocator());
+    swap(index(), other.index());
+    swap(tops, other.tops);
+    swap(sz, other.sz);
     return *this;
   }
 
+  template <typename InputIt> void assign(InputIt first, InputIt last) {
+    clear();
+    insert_batch_impl<true, true>(first, last, nullptr);
+  }
+  template <typename InputIt>
+  void assign(bimap_helper::ordered_left_t, InputIt first, InputIt last) {
+    clear();
+    insert_batch_impl<false, true>(first, last, nullptr);
+  }
+  template <typename InputIt>
+  void assign(bimap_helper::ordered_right_t, InputIt first, InputIt last) {
+    clear();
+    insert_batch_impl<true, false>(first, last, nullptr);
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(node_allocator());
+  }
+
   void clear() noexcept {
     if (size() == 0)
       return;
-    // iterating over splay tree in increasing order is O(n)
-    // Static Finger Theorem
-    auto iter = begin_left();
-    while (true) {
-      auto del = iter;
-      ++iter;
-      delete del.node;
-      if (iter == end_left())
-        break;
-      assert(iter.node->left_node()->up == nullptr);
-      iter.node->left_node()->left = nullptr;
-    }
-    root = nullptr;
+    index().clear();
+    if constexpr (bimap_helper::has_release_v<node_allocator_t> &&
+                  std::is_trivially_destructible_v<node_t>) {
+      // pool owns every node, nothing to destroy, unless other bimaps or
+      // node handles still hold blocks of it. chunks stay for refilling
+      if (node_allocator().reset(sz)) {
+        tops[0] = tops[1] = nullptr;
+        sz = 0;
+        return;
+      }
+    }
+    walk_post_order<typename node_t::left_holder>(
+        top<typename node_t::left_holder>()->as_node(),
+        [this](node_t const *node) { destroy_node(node); });
+    tops[0] = tops[1] = nullptr;
     sz = 0;
   }
-  ~bimap() noexcept { clear(); }
+  ~bimap() noexcept {
+    clear();
+    // chunks are freed here, unless pool is still used by someone else
+    if constexpr (bimap_helper::has_release_v<node_allocator_t>)
+      node_allocator().release();
+  }
 
 private:
-  template <typename T> iterator_from_node_type<T> begin_impl() const noexcept {
-    using ret_t = iterator_from_node_type<T>;
-    if (root == nullptr)
-      return ret_t(&root, nullptr);
-    auto rt = root->template get_node<T>();
-    rt->splay();
-    return ret_t(&root, node_t::cast(rt->call(&T::node_t::left_most)));
+  template <typename T, bool Frozen = false>
+  iterator_from_node_type<T, Frozen> begin_impl() const noexcept {
+    using ret_t = iterator_from_node_type<T, Frozen>;
+    if (sz == 0)
+      return ret_t(tops, nullptr);
+    if constexpr (Frozen)
+      return ret_t(tops, node_t::cast(top<T>()->call(
+                             &T::node_t::left_most_frozen)));
+    else
+      return ret_t(tops, node_t::cast(front<T>()));
   }
 
 public:
@@ -134,41 +349,53 @@ public:
     return begin_impl<typename node_t::left_holder>();
   }
   left_iterator end_left() const noexcept {
-    return left_iterator(&root, nullptr);
+    return left_iterator(tops, nullptr);
   }
 
   right_iterator begin_right() const noexcept {
     return begin_impl<typename node_t::right_holder>();
   }
   right_iterator end_right() const noexcept {
-    return right_iterator(&root, nullptr);
+    return right_iterator(tops, nullptr);
   }
 
 private:
-  template <typename T1, typename T2>
-  left_iterator insert_impl(T1 &&l, T2 &&r) {
-    if (root == nullptr) {
-      root = new node_t(std::forward<T1>(l), std::forward<T2>(r));
-      sz = 1;
-      return left_iterator(&root, root);
-    }
+  using left_holder_t = typename node_t::left_holder;
+  using right_holder_t = typename node_t::right_holder;
 
-    auto fl = root->left_node()->find_ge(l, left_comparator());
-    if (fl != nullptr && !left_comparator()(l, fl->data))
-      return end_left();
-    auto fr = root->right_node()->find_ge(r, right_comparator());
-    if (fr != nullptr && !right_comparator()(r, fr->data))
-      return end_left();
-
-    auto node = new node_t(std::forward<T1>(l), std::forward<T2>(r));
-    // noexcept opertions:
+  /**
+   * finds place of value in `T` tree: `f` is least element greater than it,
+   * returns false if value is present
+   */
+  template <typename T>
+  bool find_side(typename T::value_type const &v, T const *&f) const {
+    f = nullptr;
+    if (sz == 0)
+      return true;
+    f = find_ge_impl<T>(v);
+    return f == nullptr || get_comparator<T>()(v, f->data);
+  }
+  // places of pair in both trees, false if it clashes with existing one
+  bool find_place(left_t const &l, right_t const &r, left_holder_t const *&fl,
+                  right_holder_t const *&fr) const {
+    fr = nullptr;
+    return find_side(l, fl) && find_side(r, fr);
+  }
 
+  // links detached node to places found by `find_place`
+  void link_node(node_t const *node, left_holder_t const *fl,
+                 right_holder_t const *fr) noexcept {
+    if (sz == 0) {
+      tops[0] = tops[1] = node;
+      sz = 1;
+      return;
+    }
     sz++;
 
     // My [Left/Right] of Left subtree
-    const typename node_t::left_holder::node_t *mll, *mrl;
+    const typename left_holder_t::node_t *mll, *mrl;
     if (fl == nullptr) {
-      mll = root->left_node()->as_node();
+      mll = top<left_holder_t>()->as_node();
       mrl = nullptr;
     } else {
       auto res = fl->cut();
@@ -177,9 +404,9 @@ private:
     }
 
     // My [Left/Right] of Right subtree
-    const typename node_t::right_holder::node_t *mlr, *mrr;
+    const typename right_holder_t::node_t *mlr, *mrr;
     if (fr == nullptr) {
-      mlr = root->right_node()->as_node();
+      mlr = top<right_holder_t>()->as_node();
       mrr = nullptr;
     } else {
       auto res = fr->cut();
@@ -188,10 +415,98 @@ private:
     }
     node->right_node()->merge(mlr, mrr);
     node->left_node()->merge(mll, mrl);
+    find_top(node->left_node());
+    find_top(node->right_node());
+  }
 
-    root = node;
+  // detaches node from both trees and index
+  template <typename T = left_holder_t>
+  void unlink_node(node_t const *node) noexcept {
+    using C = bimap_helper::coholder_t<node_t, T>;
+    set_top(node->template get_node<C>()->call(&C::node_t::cutcutmerge));
+    set_top(node->template get_node<T>()->call(&T::node_t::cutcutmerge));
+    sz--;
+    index().erase(node);
+  }
 
-    return left_iterator(&root, node);
+  template <typename T1, typename T2>
+  left_iterator insert_impl(T1 &&l, T2 &&r) {
+    left_holder_t const *fl;
+    right_holder_t const *fr;
+    if (!find_place(l, r, fl, fr))
+      return end_left();
+    auto node = create_node(std::forward<T1>(l), std::forward<T2>(r));
+    index_node(node);
+    // noexcept opertions:
+    link_node(node, fl, fr);
+    return left_iterator(tops, node);
+  }
+
+  // links constructed node, destroys it if it clashes with existing pair
+  left_iterator insert_node(node_t const *node) {
+    left_holder_t const *fl;
+    right_holder_t const *fr;
+    bool free;
+    try {
+      free = find_place(node->left_node()->data, node->right_node()->data, fl,
+                        fr);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    if (!free) {
+      destroy_node(node);
+      return end_left();
+    }
+    index_node(node);
+    // noexcept opertions:
+    link_node(node, fl, fr);
+    return left_iterator(tops, node);
+  }
+
+  /**
+   * key is looked up once, its place is reused for linking, since `T` tree
+   * does not change until then. only the constructed value is looked up
+   */
+  template <typename T, typename K, typename... A>
+  left_iterator try_emplace_impl(K &&key, A &&... args) {
+    using C = bimap_helper::coholder_t<node_t, T>;
+    if constexpr (index_t::template indexed_v<T>) {
+      // present key does not touch the tree
+      if (index().template get<T>().find(key, get_comparator<T>()) != nullptr)
+        return end_left();
+    }
+    T const *ft;
+    if (!find_side(key, ft))
+      return end_left();
+    auto key_args = std::forward_as_tuple(std::forward<K>(key));
+    auto value_args = std::forward_as_tuple(std::forward<A>(args)...);
+    node_t const *node;
+    if constexpr (std::is_same_v<T, left_holder_t>)
+      node = create_node(std::piecewise_construct, std::move(key_args),
+                         std::move(value_args));
+    else
+      node = create_node(std::piecewise_construct, std::move(value_args),
+                         std::move(key_args));
+    C const *fc;
+    bool free;
+    try {
+      free = find_side(node->template get_node<C>()->data, fc);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    if (!free) {
+      destroy_node(node);
+      return end_left();
+    }
+    index_node(node);
+    // noexcept opertions:
+    if constexpr (std::is_same_v<T, left_holder_t>)
+      link_node(node, ft, fc);
+    else
+      link_node(node, fc, ft);
+    return left_iterator(tops, node);
   }
 
 public:
@@ -208,6 +523,78 @@ public:
     return insert_impl(std::move(a), std::move(b));
   }
 
+  /**
+   * constructs both values in place from tuples of arguments, pair is
+   * destroyed if it clashes with existing one. returns end_left() then
+   */
+  template <typename... A1, typename... A2>
+  left_iterator emplace(std::piecewise_construct_t, std::tuple<A1...> l,
+                        std::tuple<A2...> r) {
+    return insert_node(
+        create_node(std::piecewise_construct, std::move(l), std::move(r)));
+  }
+
+  /**
+   * links node of handle back without allocation, handle becomes empty.
+   * if pair clashes with existing one (or handle is empty), handle keeps
+   * node and end_left() is returned. throws std::invalid_argument if
+   * handle comes from bimap with allocator not equal to this one
+   */
+  left_iterator insert(node_type &&handle) {
+    if (handle.empty())
+      return end_left();
+    if (!(*handle.alloc == node_allocator()))
+      throw std::invalid_argument("node handle of other allocator");
+    left_holder_t const *fl;
+    right_holder_t const *fr;
+    if (!find_place(handle.left(), handle.right(), fl, fr))
+      return end_left();
+    index().insert(handle.node);
+    // noexcept opertions:
+    auto node = handle.release();
+    link_node(node, fl, fr);
+    return left_iterator(tops, node);
+  }
+
+  /**
+   * nothing is constructed if key is present on its side, otherwise other
+   * value is constructed in place from `args`
+   */
+  template <typename... A>
+  left_iterator try_emplace_left(left_t const &key, A &&... args) {
+    return try_emplace_impl<left_holder_t>(key, std::forward<A>(args)...);
+  }
+  template <typename... A>
+  left_iterator try_emplace_left(left_t &&key, A &&... args) {
+    return try_emplace_impl<left_holder_t>(std::move(key),
+                                           std::forward<A>(args)...);
+  }
+  template <typename... A>
+  left_iterator try_emplace_right(right_t const &key, A &&... args) {
+    return try_emplace_impl<right_holder_t>(key, std::forward<A>(args)...);
+  }
+  template <typename... A>
+  left_iterator try_emplace_right(right_t &&key, A &&... args) {
+    return try_emplace_impl<right_holder_t>(std::move(key),
+                                            std::forward<A>(args)...);
+  }
+
+  /**
+   * same as `insert` of every pair in order, returns flags of inserted ones.
+   * O(k log k + min(n, k log n)) for batch of k pairs
+   */
+  template <typename InputIt>
+  std::vector<bool> insert_batch(InputIt first, InputIt last) {
+    std::vector<bool> res;
+    insert_batch_impl<true, true>(first, last, &res);
+    return res;
+  }
+  template <typename Range> std::vector<bool> insert_batch(Range const &r) {
+    using std::begin;
+    using std::end;
+    return insert_batch(begin(r), end(r));
+  }
+
 private:
   template <typename holder_t>
   auto erase_impl(bimap_helper::bimap_iterator<node_t, holder_t> it) noexcept
@@ -215,12 +602,8 @@ private:
     auto ret = it;
     ++ret;
 
-    static_cast<bimap_helper::coholder_t<node_t, holder_t> const *>(it.node)
-        ->cutcutmerge();
-    root = node_t::cast(static_cast<holder_t const *>(it.node)->call(
-        &holder_t::node_t::cutcutmerge));
-    sz--;
-    delete it.node;
+    unlink_node<holder_t>(it.node);
+    destroy_node(it.node);
     return ret;
   }
 
@@ -230,20 +613,156 @@ public:
     return erase_impl(it);
   }
 
+private:
+  /**
+   * changes value of `T` side of node, relinking it only in `T` tree if its
+   * position changes. values which may throw on move assignment give basic
+   * guarantee: pair is erased if assignment throws
+   */
+  template <typename T, typename V>
+  bool replace_impl(node_t const *node, V &&value) {
+    using C = bimap_helper::coholder_t<node_t, T>;
+    auto holder = node->template get_node<T>();
+    auto found = find_ge_impl<T>(value);
+    if (found != nullptr && !get_comparator<T>()(value, found->data))
+      return found == holder;
+    // value goes right before `found`, which is where node is now
+    auto next = holder->call(&T::node_t::next);
+    track_top(next);
+    bool same_place = found == holder || found == next;
+    typename T::value_type tmp(std::forward<V>(value));
+    // user hash may throw, so it runs while pair is still intact
+    auto h = index().template hash_side<T>(tmp);
+
+    auto &data = const_cast<typename T::value_type &>(holder->data);
+    index().template erase_side<T>(node);
+    T const *rest = nullptr;
+    if (!same_place)
+      rest = holder->call(&T::node_t::cutcutmerge);
+    try {
+      data = std::move(tmp);
+    } catch (...) {
+      if (same_place)
+        rest = holder->call(&T::node_t::cutcutmerge);
+      auto co_rest =
+          node->template get_node<C>()->call(&C::node_t::cutcutmerge);
+      index().template erase_side<C>(node);
+      set_top(rest);
+      set_top(co_rest);
+      sz--;
+      destroy_node(node);
+      throw;
+    }
+    if (!same_place) {
+      if (found == nullptr) {
+        holder->merge(rest->as_node(), nullptr);
+      } else {
+        auto [l, r] = found->cut();
+        holder->merge(l, r);
+      }
+      find_top(holder);
+    }
+    index().template insert_side<T>(node, h);
+    return true;
+  }
+
+public:
+  /**
+   * sets other value of pair, node and `it` stay valid. returns false if
+   * value belongs to another pair
+   */
+  bool replace_right(left_iterator it, right_t const &value) {
+    return replace_impl<typename node_t::right_holder>(it.node, value);
+  }
+  bool replace_right(left_iterator it, right_t &&value) {
+    return replace_impl<typename node_t::right_holder>(it.node,
+                                                       std::move(value));
+  }
+  bool replace_left(right_iterator it, left_t const &value) {
+    return replace_impl<typename node_t::left_holder>(it.node, value);
+  }
+  bool replace_left(right_iterator it, left_t &&value) {
+    return replace_impl<typename node_t::left_holder>(it.node,
+                                                      std::move(value));
+  }
+
 private:
   template <typename T>
-  iterator_from_node_type<T> find_impl(typename T::value_type const &wht) const
-      noexcept(
-          is_nothrow_comparable_v<typename T::value_type, comparator_t<T>>) {
-    using ret_t = iterator_from_node_type<T>;
-    if (root == nullptr)
-      return ret_t(&root, nullptr);
-    auto found =
-        root->template get_node<T>()->find_ge(wht, get_comparator<T>());
+  node_type extract_impl(iterator_from_node_type<T> it) noexcept {
+    unlink_node<T>(it.node);
+    return node_type(const_cast<node_t *>(it.node), node_allocator());
+  }
+
+public:
+  /**
+   * detaches pair from bimap without deallocation, its values may be
+   * changed through handle before it is inserted back
+   */
+  node_type extract_left(left_iterator it) noexcept {
+    return extract_impl<typename node_t::left_holder>(it);
+  }
+  node_type extract_right(right_iterator it) noexcept {
+    return extract_impl<typename node_t::right_holder>(it);
+  }
+
+private:
+  // `K` differs from key type only for transparent comparators
+  template <typename T, bool Frozen = false, typename K>
+  T const *find_ge_impl(K const &key) const noexcept(
+      is_nothrow_comparable_v<typename T::value_type, comparator_t<T>, K>) {
+    if constexpr (Frozen)
+      return top<T>()->find_ge_frozen(key, get_comparator<T>());
+    else {
+      typename T::node_t const *t = top<T>()->as_node();
+      T const *res;
+      if constexpr (is_nothrow_comparable_v<typename T::value_type,
+                                            comparator_t<T>, K>) {
+        res = T::find_ge(key, get_comparator<T>(), t);
+      } else {
+        try {
+          res = T::find_ge(key, get_comparator<T>(), t);
+        } catch (...) {
+          // tree is reassembled under other top
+          set_top(T::cast(t));
+          throw;
+        }
+      }
+      set_top(T::cast(t));
+      return res;
+    }
+  }
+
+  template <typename T, typename K>
+  static constexpr bool hashed_lookup_v =
+      index_t::template indexed_v<T> &&
+      std::is_same_v<K, typename T::value_type>;
+
+  template <typename T, typename K>
+  static constexpr bool nothrow_hashed_find_v = [] {
+    if constexpr (hashed_lookup_v<T, K>)
+      return noexcept(std::declval<index_t const &>().template get<T>().find(
+          std::declval<K const &>(), std::declval<comparator_t<T> const &>()));
+    else
+      return true;
+  }();
+
+  template <typename T, bool Frozen = false, typename K>
+  iterator_from_node_type<T, Frozen> find_impl(K const &wht) const
+      noexcept(noexcept(find_ge_impl<T, Frozen>(wht)) &&
+               nothrow_hashed_find_v<T, K>) {
+    using ret_t = iterator_from_node_type<T, Frozen>;
+    if (sz == 0)
+      return ret_t(tops, nullptr);
+    // hashed side does not touch the tree at all, other key types can not be
+    // hashed, so they go to the tree
+    if constexpr (hashed_lookup_v<T, K>)
+      return ret_t(tops,
+                   index().template get<T>().find(wht, get_comparator<T>()));
+    auto found = find_ge_impl<T, Frozen>(wht);
     // found >= wht
     if (found != nullptr && get_comparator<T>()(wht, found->data))
-      return ret_t(&root, nullptr);
-    return ret_t(&root, node_t::cast(found));
+      return ret_t(tops, nullptr);
+    return ret_t(tops, node_t::cast(found));
   }
 
 public:
@@ -255,10 +774,23 @@ public:
       noexcept(noexcept(find_impl<typename node_t::right_holder>(right))) {
     return find_impl<typename node_t::right_holder>(right);
   }
+  // lookups by other key types, if comparator is transparent
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator find_left(K const &left) const
+      noexcept(noexcept(find_impl<typename node_t::left_holder>(left))) {
+    return find_impl<typename node_t::left_holder>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator find_right(K const &right) const
+      noexcept(noexcept(find_impl<typename node_t::right_holder>(right))) {
+    return find_impl<typename node_t::right_holder>(right);
+  }
 
 private:
-  template <typename T>
-  bool erase_impl(typename T::value_type const &wht) noexcept(
+  template <typename T, typename K>
+  bool erase_impl(K const &wht) noexcept(
       noexcept(find_impl<T>(wht))) {
     auto found = find_impl<T>(wht);
     // end check
@@ -277,28 +809,103 @@ public:
       noexcept(erase_impl<typename node_t::right_holder>(right))) {
     return erase_impl<typename node_t::right_holder>(right);
   }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  bool erase_left(K const &left) noexcept(
+      noexcept(erase_impl<typename node_t::left_holder>(left))) {
+    return erase_impl<typename node_t::left_holder>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  bool erase_right(K const &right) noexcept(
+      noexcept(erase_impl<typename node_t::right_holder>(right))) {
+    return erase_impl<typename node_t::right_holder>(right);
+  }
 
 private:
-  template <typename T> T erase_range(T f, T l) noexcept {
-    // optimize?
-    // because of dynamic finger theroem it is not so bad as it is
-    while (f != l)
-      f = erase_impl(f);
-    return f;
+  /**
+   * cuts [f, l) out of its tree with two splits, then detaches it from
+   * co-tree: either node by node or, for long ranges, by rebuilding co-tree
+   * from remaining nodes in one pass
+   */
+  template <typename T>
+  iterator_from_node_type<T>
+  erase_range(iterator_from_node_type<T> f,
+              iterator_from_node_type<T> l) noexcept {
+    using C = bimap_helper::coholder_t<node_t, T>;
+    if (f == l)
+      return l;
+    auto k = rank_impl<T>(l) - rank_impl<T>(f);
+    if (k == sz) {
+      clear();
+      return l;
+    }
+    if (k < 4) {
+      // splitting does not pay off
+      while (f != l)
+        f = erase_impl(f);
+      return f;
+    }
+
+    auto [lower, rest] = f.node->template get_node<T>()->cut();
+    auto range = rest;
+    decltype(rest) upper = nullptr;
+    if (l.node != nullptr)
+      std::tie(range, upper) = l.node->template get_node<T>()->cut();
+    auto remaining = node_t::cast(T::cast(join_trees(lower, upper)));
+
+    auto depth = log2_ceil(sz);
+    std::vector<node_t const *> order;
+    // walk over whole co-tree misses cache on every node, so it pays off
+    // only for ranges much longer than n / log n
+    bool rebuild = k * depth >= 4 * sz;
+    if (rebuild) {
+      try {
+        order.reserve(sz - k);
+      } catch (...) {
+        rebuild = false;
+      }
+    }
+    if (rebuild) {
+      // subtree size is never zero, so it marks erased nodes
+      for (auto cur = f.node; cur != nullptr; cur = node_t::cast(
+               cur->template get_node<T>()->call(&T::node_t::next_frozen)))
+        cur->template get_node<T>()->size = 0;
+      for (auto cur = top<C>()->left_most_frozen(); cur != nullptr;
+           cur = cur->next_frozen()) {
+        auto node = node_t::cast(C::cast(cur));
+        if (node->template get_node<T>()->size != 0)
+          order.push_back(node);
+      }
+      set_top(C::cast(C::node_t::build(
+          order.begin(), order.size(), [](node_t const *n) {
+            return n->template get_node<C>()->as_node();
+          })));
+    }
+    walk_post_order<T>(range, [&](node_t const *node) {
+      if (!rebuild)
+        set_top(
+            node->template get_node<C>()->call(&C::node_t::cutcutmerge));
+      index().erase(node);
+      destroy_node(node);
+    });
+    find_top(remaining->template get_node<T>());
+    sz -= k;
+    return l;
   }
 
 public:
   left_iterator erase_left(left_iterator f, left_iterator l) noexcept {
-    return erase_range(f, l);
+    return erase_range<typename node_t::left_holder>(f, l);
   }
   right_iterator erase_right(right_iterator f, right_iterator l) noexcept {
-    return erase_range(f, l);
+    return erase_range<typename node_t::right_holder>(f, l);
   }
 
 private:
-  template <typename T>
-  auto const &at_impl(typename T::value_type const &key) const {
-    auto iter = find_impl<T>(key);
+  template <typename T, bool Frozen = false, typename K>
+  auto const &at_impl(K const &key) const {
+    auto iter = find_impl<T, Frozen>(key);
     // end check
     if (iter.node == nullptr)
       throw std::out_of_range("at_left bad");
@@ -312,6 +919,16 @@ public:
   left_t const &at_right(right_t const &key) const {
     return at_impl<typename node_t::right_holder>(key);
   }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  right_t const &at_left(K const &key) const {
+    return at_impl<typename node_t::left_holder>(key);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  left_t const &at_right(K const &key) const {
+    return at_impl<typename node_t::right_holder>(key);
+  }
 
   // this two functions are unmergable b/c of oreder of arguments of insert
   template <typename T, typename = std::enable_if_t<
@@ -344,15 +961,13 @@ public:
   }
 
 private:
-  template <typename T>
-  iterator_from_node_type<T>
-  lower_bound_impl(typename T::value_type const &key) const noexcept(noexcept(
-      root->template get_node<T>()->find_ge(key, get_comparator<T>()))) {
-    using ret_t = iterator_from_node_type<T>;
-    if (root == nullptr)
-      return ret_t(&root, nullptr);
-    return ret_t(&root, node_t::cast(root->template get_node<T>()->find_ge(
-                            key, get_comparator<T>())));
+  template <typename T, bool Frozen = false, typename K>
+  iterator_from_node_type<T, Frozen> lower_bound_impl(K const &key) const
+      noexcept(noexcept(find_ge_impl<T, Frozen>(key))) {
+    using ret_t = iterator_from_node_type<T, Frozen>;
+    if (sz == 0)
+      return ret_t(tops, nullptr);
+    return ret_t(tops, node_t::cast(find_ge_impl<T, Frozen>(key)));
   }
 
 public:
@@ -364,13 +979,24 @@ public:
       noexcept(lower_bound_impl<typename node_t::right_holder>(right))) {
     return lower_bound_impl<typename node_t::right_holder>(right);
   }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator lower_bound_left(K const &left) const
+      noexcept(noexcept(lower_bound_impl<typename node_t::left_holder>(left))) {
+    return lower_bound_impl<typename node_t::left_holder>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator lower_bound_right(K const &right) const noexcept(
+      noexcept(lower_bound_impl<typename node_t::right_holder>(right))) {
+    return lower_bound_impl<typename node_t::right_holder>(right);
+  }
 
 private:
-  template <typename T>
-  iterator_from_node_type<T>
-  upper_bound_impl(typename T::value_type const &key) const
-      noexcept(noexcept(lower_bound_impl<T>(key))) {
-    auto it = lower_bound_impl<T>(key);
+  template <typename T, bool Frozen = false, typename K>
+  iterator_from_node_type<T, Frozen> upper_bound_impl(K const &key) const
+      noexcept(noexcept(lower_bound_impl<T, Frozen>(key))) {
+    auto it = lower_bound_impl<T, Frozen>(key);
     // end check
     if (it.node == nullptr)
       return it;
@@ -389,10 +1015,168 @@ public:
       noexcept(noexcept(lower_bound_right(right))) {
     return upper_bound_impl<typename node_t::right_holder>(right);
   }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator upper_bound_left(K const &left) const
+      noexcept(noexcept(lower_bound_left(left))) {
+    return upper_bound_impl<typename node_t::left_holder>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator upper_bound_right(K const &right) const
+      noexcept(noexcept(lower_bound_right(right))) {
+    return upper_bound_impl<typename node_t::right_holder>(right);
+  }
+
+private:
+  template <typename T, bool Frozen = false>
+  std::size_t rank_impl(iterator_from_node_type<T, Frozen> it) const noexcept {
+    // end check
+    if (it.node == nullptr)
+      return sz;
+    auto holder = it.node->template get_node<T>();
+    if constexpr (Frozen) {
+      return holder->as_node()->rank_frozen();
+    } else {
+      auto res = holder->as_node()->rank();
+      track_top(holder);
+      return res;
+    }
+  }
+
+  template <typename T, bool Frozen = false>
+  iterator_from_node_type<T, Frozen> nth_impl(std::size_t k) const noexcept {
+    using ret_t = iterator_from_node_type<T, Frozen>;
+    if (k >= sz)
+      return ret_t(tops, nullptr);
+    auto rt = top<T>();
+    if constexpr (Frozen) {
+      return ret_t(tops, node_t::cast(rt->call(&T::node_t::select_frozen, k)));
+    } else {
+      auto res = rt->call(&T::node_t::select, k);
+      track_top(res);
+      return ret_t(tops, node_t::cast(res));
+    }
+  }
+
+  template <typename T, bool Frozen = false>
+  std::size_t count_range_impl(typename T::value_type const &l,
+                               typename T::value_type const &r) const
+      noexcept(noexcept(lower_bound_impl<T, Frozen>(l))) {
+    if (!get_comparator<T>()(l, r))
+      return 0;
+    auto from = rank_impl<T, Frozen>(lower_bound_impl<T, Frozen>(l));
+    return rank_impl<T, Frozen>(lower_bound_impl<T, Frozen>(r)) - from;
+  }
+
+public:
+  /**
+   * position of element in order of its side, O(log n). size for end
+   * distance between iterators is difference of their ranks
+   */
+  std::size_t rank_left(left_iterator it) const noexcept {
+    return rank_impl<typename node_t::left_holder>(it);
+  }
+  std::size_t rank_right(right_iterator it) const noexcept {
+    return rank_impl<typename node_t::right_holder>(it);
+  }
+
+  // `k`-th element of side or end, O(log n)
+  left_iterator nth_left(std::size_t k) const noexcept {
+    return nth_impl<typename node_t::left_holder>(k);
+  }
+  right_iterator nth_right(std::size_t k) const noexcept {
+    return nth_impl<typename node_t::right_holder>(k);
+  }
+
+  // count of elements in [l, r), O(log n)
+  std::size_t count_range_left(left_t const &l, left_t const &r) const
+      noexcept(noexcept(lower_bound_left(l))) {
+    return count_range_impl<typename node_t::left_holder>(l, r);
+  }
+  std::size_t count_range_right(right_t const &l, right_t const &r) const
+      noexcept(noexcept(lower_bound_right(l))) {
+    return count_range_impl<typename node_t::right_holder>(l, r);
+  }
 
   bool empty() const noexcept { return size() == 0; }
   std::size_t size() const noexcept { return sz; }
 
+private:
+  template <typename T> void rebalance_impl() {
+    std::vector<typename T::node_t const *> order;
+    order.reserve(sz);
+    for (auto cur = top<T>()->left_most_frozen(); cur != nullptr;
+         cur = cur->next_frozen())
+      order.push_back(cur);
+    set_top(
+        T::cast(T::node_t::build(order.begin(), sz, [](auto n) { return n; })));
+  }
+
+public:
+  /**
+   * reshapes both trees into perfectly balanced form, O(n), no comparisons
+   */
+  void rebalance() {
+    if (sz == 0)
+      return;
+    rebalance_impl<typename node_t::left_holder>();
+    rebalance_impl<typename node_t::right_holder>();
+  }
+
+private:
+  // joins trees, every element of `lower` is less than every one of `upper`
+  template <typename N>
+  static N const *join_trees(N const *lower, N const *upper) noexcept {
+    if (lower == nullptr)
+      return upper;
+    if (upper == nullptr)
+      return lower;
+    auto pivot = upper->front();
+    auto rest = pivot->cutcutmerge();
+    pivot->merge(lower->top(), rest);
+    return pivot;
+  }
+
+  template <typename T>
+  std::pair<bimap, bimap> split_impl(typename T::value_type const &key);
+
+  bool merge_disjoint(bimap &other);
+
+public:
+  /**
+   * splits bimap into elements with left value less than `key` and the rest,
+   * this bimap is left empty. split side is cut in O(log n), then all m
+   * elements of smaller part are walked to see if they are a prefix or suffix
+   * of other side too, so split is O(log n + m) even then (and allocates
+   * nothing). otherwise other side is rebuilt in O(m log n)
+   */
+  std::pair<bimap, bimap> split_left(left_t const &key) {
+    return split_impl<typename node_t::left_holder>(key);
+  }
+  std::pair<bimap, bimap> split_right(right_t const &key) {
+    return split_impl<typename node_t::right_holder>(key);
+  }
+
+  /**
+   * moves elements of `other` into this bimap. pairs which clash with
+   * existing ones stay in `other`, as with `insert`. if value ranges of
+   * bimaps do not overlap on both sides, trees are joined in O(log n)
+   * without allocation, otherwise every element is moved separately
+   */
+  void merge(bimap &&other);
+
+  class frozen_view;
+
+  /**
+   * rebalances trees and returns view for lookups that never restructure
+   * them. view stays valid until bimap is modified
+   */
+  frozen_view freeze() {
+    rebalance();
+    return frozen_view(this);
+  }
+
   bool operator==(bimap const &b) const {
     auto it1 = begin_left();
     auto it2 = b.begin_left();
@@ -413,15 +1197,683 @@ public:
   bool operator!=(bimap const &b) const { return !operator==(b); }
 };
 
+/**
+ * read only view over bimap, which does not splay on lookups and iteration,
+ * so it may be shared between threads as long as bimap is not modified.
+ * lookups are plain descents, so call `bimap::freeze` first
+ */
 template <typename Left, typename Right, typename CompareLeft,
-          typename CompareRight>
-void bimap<Left, Right, CompareLeft, CompareRight>::copy_elements(
-    bimap const &other) {
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+class bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+            Index>::frozen_view {
+  using left_holder = typename node_t::left_holder;
+  using right_holder = typename node_t::right_holder;
+
+  bimap const *map;
+
+  friend struct bimap;
+  explicit frozen_view(bimap const *map) noexcept : map(map) {}
+
+public:
+  using left_iterator = iterator_from_node_type<left_holder, true>;
+  using right_iterator = iterator_from_node_type<right_holder, true>;
+
+  left_iterator begin_left() const noexcept {
+    return map->template begin_impl<left_holder, true>();
+  }
+  left_iterator end_left() const noexcept {
+    return left_iterator(map->tops, nullptr);
+  }
+  right_iterator begin_right() const noexcept {
+    return map->template begin_impl<right_holder, true>();
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(map->tops, nullptr);
+  }
+
+  left_iterator find_left(left_t const &left) const
+      noexcept(noexcept(map->template find_impl<left_holder, true>(left))) {
+    return map->template find_impl<left_holder, true>(left);
+  }
+  right_iterator find_right(right_t const &right) const
+      noexcept(noexcept(map->template find_impl<right_holder, true>(right))) {
+    return map->template find_impl<right_holder, true>(right);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator find_left(K const &left) const
+      noexcept(noexcept(map->template find_impl<left_holder, true>(left))) {
+    return map->template find_impl<left_holder, true>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator find_right(K const &right) const
+      noexcept(noexcept(map->template find_impl<right_holder, true>(right))) {
+    return map->template find_impl<right_holder, true>(right);
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return map->template at_impl<left_holder, true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return map->template at_impl<right_holder, true>(key);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  right_t const &at_left(K const &key) const {
+    return map->template at_impl<left_holder, true>(key);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  left_t const &at_right(K const &key) const {
+    return map->template at_impl<right_holder, true>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const noexcept(
+      noexcept(map->template lower_bound_impl<left_holder, true>(left))) {
+    return map->template lower_bound_impl<left_holder, true>(left);
+  }
+  right_iterator lower_bound_right(right_t const &right) const noexcept(
+      noexcept(map->template lower_bound_impl<right_holder, true>(right))) {
+    return map->template lower_bound_impl<right_holder, true>(right);
+  }
+  left_iterator upper_bound_left(left_t const &left) const
+      noexcept(noexcept(lower_bound_left(left))) {
+    return map->template upper_bound_impl<left_holder, true>(left);
+  }
+  right_iterator upper_bound_right(right_t const &right) const
+      noexcept(noexcept(lower_bound_right(right))) {
+    return map->template upper_bound_impl<right_holder, true>(right);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator lower_bound_left(K const &left) const noexcept(
+      noexcept(map->template lower_bound_impl<left_holder, true>(left))) {
+    return map->template lower_bound_impl<left_holder, true>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator lower_bound_right(K const &right) const noexcept(
+      noexcept(map->template lower_bound_impl<right_holder, true>(right))) {
+    return map->template lower_bound_impl<right_holder, true>(right);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareLeft, K>>
+  left_iterator upper_bound_left(K const &left) const noexcept(
+      noexcept(map->template lower_bound_impl<left_holder, true>(left))) {
+    return map->template upper_bound_impl<left_holder, true>(left);
+  }
+  template <typename K,
+            typename = bimap_helper::if_transparent_t<CompareRight, K>>
+  right_iterator upper_bound_right(K const &right) const noexcept(
+      noexcept(map->template lower_bound_impl<right_holder, true>(right))) {
+    return map->template upper_bound_impl<right_holder, true>(right);
+  }
+
+  std::size_t rank_left(left_iterator it) const noexcept {
+    return map->template rank_impl<left_holder, true>(it);
+  }
+  std::size_t rank_right(right_iterator it) const noexcept {
+    return map->template rank_impl<right_holder, true>(it);
+  }
+  left_iterator nth_left(std::size_t k) const noexcept {
+    return map->template nth_impl<left_holder, true>(k);
+  }
+  right_iterator nth_right(std::size_t k) const noexcept {
+    return map->template nth_impl<right_holder, true>(k);
+  }
+  std::size_t count_range_left(left_t const &l, left_t const &r) const
+      noexcept(noexcept(lower_bound_left(l))) {
+    return map->template count_range_impl<left_holder, true>(l, r);
+  }
+  std::size_t count_range_right(right_t const &l, right_t const &r) const
+      noexcept(noexcept(lower_bound_right(l))) {
+    return map->template count_range_impl<right_holder, true>(l, r);
+  }
+
+  bool empty() const noexcept { return map->empty(); }
+  std::size_t size() const noexcept { return map->size(); }
+};
+
+/**
+ * owns pair extracted from bimap, like std::map::node_type
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+class bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+            Index>::node_type {
+  using left_holder = typename node_t::left_holder;
+  using right_holder = typename node_t::right_holder;
+
+  node_t *node = nullptr;
+  // copy of allocator of source bimap, it compares equal to the source, so
+  // node outlives the bimap and is freed to the same pool
+  std::optional<node_allocator_t> alloc;
+
+  friend struct bimap;
+  node_type(node_t *node, node_allocator_t const &alloc) noexcept
+      : node(node), alloc(alloc) {}
+
+  node_t *release() noexcept {
+    alloc.reset();
+    return std::exchange(node, nullptr);
+  }
+  void reset() noexcept {
+    if (node != nullptr) {
+      node_allocator_traits::destroy(*alloc, node);
+      node_allocator_traits::deallocate(*alloc, node, 1);
+    }
+    node = nullptr;
+    alloc.reset();
+  }
+
+public:
+  node_type() noexcept = default;
+  node_type(node_type &&other) noexcept
+      : node(other.node), alloc(std::move(other.alloc)) {
+    other.release();
+  }
+  node_type &operator=(node_type &&other) noexcept {
+    if (this != &other) {
+      reset();
+      node = other.node;
+      alloc = std::move(other.alloc);
+      other.release();
+    }
+    return *this;
+  }
+  ~node_type() { reset(); }
+
+  bool empty() const noexcept { return node == nullptr; }
+  explicit operator bool() const noexcept { return !empty(); }
+
+  left_t &left() const noexcept {
+    return static_cast<left_holder *>(node)->data;
+  }
+  right_t &right() const noexcept {
+    return static_cast<right_holder *>(node)->data;
+  }
+  allocator_type get_allocator() const { return allocator_type(*alloc); }
+};
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+void bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+           Index>::copy_elements(bimap const &other) {
   if (this == &other)
     return;
   clear();
-  // iterating over all elements of splay tree is O(n), insert biggest would
-  // be O(1) here + rebalance in fututre
-  for (auto iter = other.begin_left(); iter != other.end_left(); ++iter)
-    insert(*iter, *iter.flip());
+  if (other.sz == 0)
+    return;
+  // clone nodes in any order, then restore shape of both trees from the
+  // mapping: O(n) and no comparisons
+  using left_holder = typename node_t::left_holder;
+  using tree_node = typename left_holder::node_t;
+  std::unordered_map<node_t const *, node_t *> clones;
+  clones.reserve(other.sz);
+  try {
+    // walk without splay, tree may be deep
+    std::vector<tree_node const *> stack = {
+        other.template top<left_holder>()->as_node()};
+    while (!stack.empty()) {
+      auto cur = stack.back();
+      stack.pop_back();
+      auto old = node_t::cast(left_holder::cast(cur));
+      auto &copy = clones.emplace(old, nullptr).first->second;
+      copy = create_node(old->left_node()->data, old->right_node()->data);
+      if (cur->left != nullptr)
+        stack.push_back(cur->left);
+      if (cur->right != nullptr)
+        stack.push_back(cur->right);
+    }
+    if constexpr (index_t::any_indexed_v) {
+      // hashes are not recomputed
+      index_t copy(other.index());
+      copy.remap([&clones](node_t const *n) -> node_t const * {
+        return clones.find(n)->second;
+      });
+      using std::swap;
+      swap(index(), copy);
+    }
+  } catch (...) {
+    for (auto const &p : clones)
+      if (p.second != nullptr)
+        destroy_node(p.second);
+    throw;
+  }
+
+  auto link = [&clones](auto const *old, auto const *copy) {
+    using holder = std::remove_cv_t<std::remove_pointer_t<decltype(old)>>;
+    auto map = [&clones](tree_node const *n) -> tree_node * {
+      if (n == nullptr)
+        return nullptr;
+      auto got = clones.find(node_t::cast(holder::cast(n)))->second;
+      return const_cast<tree_node *>(
+          got->template get_node<holder>()->as_node());
+    };
+    copy->left = map(old->left);
+    copy->right = map(old->right);
+    copy->up = map(old->up);
+    copy->copy_metadata(old);
+  };
+  for (auto const &p : clones) {
+    link(p.first->left_node(), p.second->left_node());
+    link(p.first->right_node(), p.second->right_node());
+  }
+  // shapes are the same, so tops are too
+  for (std::size_t i = 0; i < 2; i++)
+    tops[i] = clones.find(other.tops[i])->second;
+  sz = other.sz;
+}
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+template <bool SortLeft, bool SortRight, typename InputIt>
+void bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+           Index>::insert_batch_impl(InputIt first, InputIt last,
+                                     std::vector<bool> *inserted) {
+  std::vector<node_t *> nodes;
+  if constexpr (std::is_base_of_v<
+                    std::forward_iterator_tag,
+                    typename std::iterator_traits<InputIt>::iterator_category>)
+    nodes.reserve(std::distance(first, last));
+  try {
+    for (; first != last; ++first) {
+      auto &&p = *first;
+      nodes.push_back(create_node(std::get<0>(std::forward<decltype(p)>(p)),
+                                  std::get<1>(std::forward<decltype(p)>(p))));
+    }
+  } catch (...) {
+    for (auto node : nodes)
+      destroy_node(node);
+    throw;
+  }
+  auto n = nodes.size();
+  if (inserted != nullptr)
+    inserted->clear();
+  if (n == 0)
+    return;
+
+  // indices of nodes in left (right) order and ids of equal groups
+  std::vector<std::size_t> left_order(n), right_order(n);
+  std::vector<std::size_t> left_group(n), right_group(n);
+  // per group: least element of tree which is not less and if it is equal
+  std::vector<left_holder_t const *> left_succ(n);
+  std::vector<right_holder_t const *> right_succ(n);
+  std::vector<bool> left_taken(n), right_taken(n), accepted(n);
+  // nodes of tree and batch merged in order, if tree is rebuilt
+  std::vector<typename left_holder_t::node_t const *> left_merged;
+  std::vector<typename right_holder_t::node_t const *> right_merged;
+  auto depth = log2_ceil(sz);
+
+  auto group = [&](auto const *holder, std::vector<std::size_t> &order,
+                   std::vector<std::size_t> &groups, auto sort) {
+    using T = std::remove_cv_t<std::remove_pointer_t<decltype(holder)>>;
+    auto const &c = get_comparator<T>();
+    for (std::size_t i = 0; i < n; i++)
+      order[i] = i;
+    auto less = [&](std::size_t a, std::size_t b) {
+      return c(nodes[a]->template get_node<T>()->data,
+               nodes[b]->template get_node<T>()->data);
+    };
+    // stable, so first element of every group is the earliest one
+    if constexpr (decltype(sort)::value)
+      std::stable_sort(order.begin(), order.end(), less);
+    else
+      assert(std::is_sorted(order.begin(), order.end(), less));
+    std::size_t id = 0;
+    groups[order[0]] = id;
+    for (std::size_t i = 1; i < n; i++) {
+      if (less(order[i - 1], order[i]))
+        id++;
+      groups[order[i]] = id;
+    }
+  };
+  auto locate = [&](auto const *holder, std::vector<std::size_t> &order,
+                    std::vector<std::size_t> &groups, auto &succ,
+                    std::vector<bool> &taken) {
+    using T = std::remove_cv_t<std::remove_pointer_t<decltype(holder)>>;
+    if (sz == 0)
+      return;
+    auto const &c = get_comparator<T>();
+    // one in-order sweep of tree for big batches, lookups for small ones
+    bool sweep = n * depth >= sz;
+    T const *cur =
+        sweep ? top<T>()->call(&T::node_t::left_most_frozen) : nullptr;
+    for (std::size_t i = 0; i < n; i++) {
+      auto g = groups[order[i]];
+      if (i != 0 && g == groups[order[i - 1]])
+        continue;
+      auto const &key = nodes[order[i]]->template get_node<T>()->data;
+      if (sweep) {
+        while (cur != nullptr && c(cur->data, key))
+          cur = cur->call(&T::node_t::next_frozen);
+      } else {
+        cur = find_ge_impl<T>(key);
+      }
+      succ[g] = cur;
+      taken[g] = cur != nullptr && !c(key, cur->data);
+    }
+  };
+  try {
+    group(static_cast<left_holder_t const *>(nullptr), left_order, left_group,
+          std::bool_constant<SortLeft>());
+    group(static_cast<right_holder_t const *>(nullptr), right_order,
+          right_group, std::bool_constant<SortRight>());
+    locate(static_cast<left_holder_t const *>(nullptr), left_order,
+           left_group, left_succ, left_taken);
+    locate(static_cast<right_holder_t const *>(nullptr), right_order,
+           right_group, right_succ, right_taken);
+  } catch (...) {
+    for (auto node : nodes)
+      destroy_node(node);
+    throw;
+  }
+
+  // same semantics as sequential insert: pair is taken if neither of its
+  // values was taken by existing or previous pair
+  std::size_t m = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    if (left_taken[left_group[i]] || right_taken[right_group[i]])
+      continue;
+    left_taken[left_group[i]] = right_taken[right_group[i]] = true;
+    accepted[i] = true;
+    m++;
+  }
+  // linking many nodes one by one costs more than rebuilding, but rebuild
+  // misses cache on every node of tree
+  bool rebuild = m * depth >= 4 * sz;
+  std::size_t indexed = 0;
+  try {
+    if (inserted != nullptr)
+      inserted->assign(accepted.begin(), accepted.end());
+    if (rebuild) {
+      left_merged.reserve(sz + m);
+      right_merged.reserve(sz + m);
+    }
+    if constexpr (index_t::any_indexed_v) {
+      index().reserve(sz + m);
+      for (; indexed < n; indexed++)
+        if (accepted[indexed])
+          index().insert(nodes[indexed]);
+    }
+  } catch (...) {
+    for (std::size_t i = 0; i < indexed; i++)
+      if (accepted[i])
+        index().erase(nodes[i]);
+    for (auto node : nodes)
+      destroy_node(node);
+    throw;
+  }
+
+  // noexcept operations:
+  for (std::size_t i = 0; i < n; i++)
+    if (!accepted[i])
+      destroy_node(nodes[i]);
+  auto link = [&](auto const *holder, std::vector<std::size_t> const &order,
+                  std::vector<std::size_t> const &groups, auto const &succ,
+                  auto &merged) {
+    using T = std::remove_cv_t<std::remove_pointer_t<decltype(holder)>>;
+    auto get = [&](std::size_t i) { return nodes[i]->template get_node<T>(); };
+    if (rebuild) {
+      // batch nodes go right before their successors
+      std::size_t j = 0;
+      auto flush = [&](T const *until) {
+        for (; j < n && succ[groups[order[j]]] == until; j++)
+          if (accepted[order[j]])
+            merged.push_back(get(order[j])->as_node());
+      };
+      if (sz != 0)
+        for (auto cur = top<T>()->call(&T::node_t::left_most_frozen);
+             cur != nullptr; cur = cur->call(&T::node_t::next_frozen)) {
+          flush(cur);
+          merged.push_back(cur->as_node());
+        }
+      flush(nullptr);
+      set_top(T::cast(T::node_t::build(merged.begin(), merged.size(),
+                                       [](auto n) { return n; })));
+      return;
+    }
+    // increasing order, so previous batch nodes are in left part of cut
+    auto any = top<T>();
+    for (auto i : order) {
+      if (!accepted[i])
+        continue;
+      auto node = get(i);
+      if (auto s = succ[groups[i]]; s != nullptr) {
+        auto [l, r] = s->cut();
+        node->merge(l, r);
+      } else {
+        node->merge(any->call(&T::node_t::back), nullptr);
+      }
+      any = node;
+    }
+    find_top(any);
+  };
+  link(static_cast<left_holder_t const *>(nullptr), left_order, left_group,
+       left_succ, left_merged);
+  link(static_cast<right_holder_t const *>(nullptr), right_order, right_group,
+       right_succ, right_merged);
+  sz += m;
+}
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+template <typename T>
+auto bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+           Index>::split_impl(typename T::value_type const &key)
+    -> std::pair<bimap, bimap> {
+  using C = bimap_helper::coholder_t<node_t, T>;
+  bimap part(left_comparator(), right_comparator(), get_allocator());
+  if (sz == 0)
+    return {std::move(part), std::move(*this)};
+  auto fl = find_ge_impl<T>(key);
+  std::size_t k = fl == nullptr ? sz : fl->rank();
+  if (k == sz)
+    return {std::move(*this), std::move(part)};
+  if (k == 0)
+    return {std::move(part), std::move(*this)};
+
+  // smaller part is moved to `part`, bigger one stays
+  bool lower_moved = k <= sz - k;
+  std::size_t m = lower_moved ? k : sz - k;
+  auto first = node_t::cast(lower_moved ? front<T>() : fl);
+  // walks moved nodes in `T` order while `f` returns true, does not splay
+  auto for_each_moved = [&](auto const &f) {
+    auto cur = first;
+    for (std::size_t i = 0; i < m && f(cur); i++)
+      cur = node_t::cast(
+          cur->template get_node<T>()->call(&T::node_t::next_frozen));
+  };
+  auto finish = [&]() {
+    if (lower_moved)
+      return std::pair<bimap, bimap>(std::move(part), std::move(*this));
+    return std::pair<bimap, bimap>(std::move(*this), std::move(part));
+  };
+
+  std::vector<node_t const *> moved;
+  if (!(part.node_allocator() == node_allocator())) {
+    // nodes can not change owner, copy them
+    moved.reserve(m);
+    for_each_moved([&](node_t const *n) {
+      moved.push_back(n);
+      return true;
+    });
+    for (auto n : moved)
+      part.insert(n->left_node()->data, n->right_node()->data);
+    for (auto n : moved) {
+      unlink_node(n);
+      destroy_node(n);
+    }
+    return finish();
+  }
+
+  // lower part takes first (last) k positions of `C` tree, if the check
+  // below succeeds
+  auto const &cc = get_comparator<C>();
+  auto asc = top<C>()->call(&C::node_t::select, k);
+  track_top(asc);
+  auto desc = top<C>()->call(&C::node_t::select, sz - k);
+  track_top(desc);
+  bool is_asc = true, is_desc = true;
+  for_each_moved([&](node_t const *n) {
+    auto const &d = n->template get_node<C>()->data;
+    is_asc = is_asc && lower_moved == cc(d, asc->data);
+    is_desc = is_desc && lower_moved != cc(d, desc->data);
+    return is_asc || is_desc;
+  });
+  if (!is_asc && !is_desc) {
+    moved.reserve(m);
+    for_each_moved([&](node_t const *n) {
+      moved.push_back(n);
+      return true;
+    });
+    std::sort(moved.begin(), moved.end(),
+              [&cc](node_t const *a, node_t const *b) {
+                return cc(a->template get_node<C>()->data,
+                          b->template get_node<C>()->data);
+              });
+  }
+  if constexpr (index_t::any_indexed_v) {
+    part.index().reserve(m);
+    for_each_moved([&](node_t const *n) {
+      part.index().insert(n);
+      return true;
+    });
+  }
+
+  // noexcept operations:
+  if constexpr (index_t::any_indexed_v)
+    for_each_moved([&](node_t const *n) {
+      index().erase(n);
+      return true;
+    });
+  auto [t_lower, t_upper] = fl->cut();
+  // tops of `C` trees of lower and upper parts
+  typename C::node_t const *c_lower, *c_upper;
+  if (is_asc) {
+    std::tie(c_lower, c_upper) = asc->cut();
+  } else if (is_desc) {
+    std::tie(c_upper, c_lower) = desc->cut();
+  } else {
+    typename C::node_t const *rest = nullptr;
+    for (auto n : moved)
+      rest = n->template get_node<C>()->cutcutmerge();
+    auto built = C::node_t::build(moved.begin(), m, [](node_t const *n) {
+      return n->template get_node<C>()->as_node();
+    });
+    c_lower = lower_moved ? built : rest;
+    c_upper = lower_moved ? rest : built;
+  }
+  auto &lower = lower_moved ? part : *this;
+  auto &upper = lower_moved ? *this : part;
+  part.sz = m;
+  sz -= m;
+  lower.set_top(T::cast(t_lower));
+  lower.set_top(C::cast(c_lower));
+  upper.set_top(T::cast(t_upper));
+  upper.set_top(C::cast(c_upper));
+  return finish();
+}
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+bool bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+           Index>::merge_disjoint(bimap &other) {
+  using left_holder = typename node_t::left_holder;
+  using right_holder = typename node_t::right_holder;
+  // -1 if this bimap is below `other` on side `T`, 1 if above, 0 otherwise
+  auto order = [&](auto const *holder) {
+    using T = std::remove_cv_t<std::remove_pointer_t<decltype(holder)>>;
+    auto const &c = get_comparator<T>();
+    if (c(back<T>()->data, other.template front<T>()->data))
+      return -1;
+    if (c(other.template back<T>()->data, front<T>()->data))
+      return 1;
+    return 0;
+  };
+  auto left_order = order(static_cast<left_holder const *>(nullptr));
+  if (left_order == 0)
+    return false;
+  auto right_order = order(static_cast<right_holder const *>(nullptr));
+  if (right_order == 0)
+    return false;
+
+  if constexpr (index_t::any_indexed_v) {
+    std::size_t inserted = 0;
+    try {
+      for (auto it = other.begin_left(); it != other.end_left(); ++it) {
+        index().insert(it.node);
+        inserted++;
+      }
+    } catch (...) {
+      for (auto it = other.begin_left(); inserted-- > 0; ++it)
+        index().erase(it.node);
+      throw;
+    }
+    other.index().clear();
+  }
+
+  // noexcept operations:
+  auto join = [&](auto const *holder, int side_order) {
+    using T = std::remove_cv_t<std::remove_pointer_t<decltype(holder)>>;
+    auto mine = top<T>()->as_node();
+    auto others = other.template top<T>()->as_node();
+    auto res = side_order < 0 ? join_trees(mine, others)
+                              : join_trees(others, mine);
+    find_top(T::cast(res));
+  };
+  join(static_cast<right_holder const *>(nullptr), right_order);
+  join(static_cast<left_holder const *>(nullptr), left_order);
+  sz += other.sz;
+  other.tops[0] = other.tops[1] = nullptr;
+  other.sz = 0;
+  return true;
+}
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Allocator, typename Policy,
+          typename Index>
+void bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy,
+           Index>::merge(bimap &&other) {
+  if (this == &other || other.sz == 0)
+    return;
+  bool same_allocator = node_allocator() == other.node_allocator();
+  if (same_allocator && sz == 0) {
+    using std::swap;
+    swap(index(), other.index());
+    swap(tops, other.tops);
+    swap(sz, other.sz);
+    return;
+  }
+  if (same_allocator && merge_disjoint(other))
+    return;
+
+  std::vector<node_t const *> nodes;
+  nodes.reserve(other.sz);
+  for (auto it = other.begin_left(); it != other.end_left(); ++it)
+    nodes.push_back(it.node);
+  for (auto n : nodes) {
+    left_holder_t const *fl;
+    right_holder_t const *fr;
+    if (!find_place(n->left_node()->data, n->right_node()->data, fl, fr))
+      continue;
+    if (same_allocator) {
+      index().insert(n);
+      other.unlink_node(n);
+      link_node(n, fl, fr);
+    } else {
+      auto copy = create_node(n->left_node()->data, n->right_node()->data);
+      index_node(copy);
+      link_node(copy, fl, fr);
+      other.unlink_node(n);
+      other.destroy_node(n);
+    }
+  }
 }
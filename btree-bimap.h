@@ -0,0 +1,834 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bimap-helper.h"
+
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct btree_bimap;
+
+namespace bimap_helper {
+/**
+ * pair of btree_bimap, allocated once and shared by leaves of both sides,
+ * so its address is stable and iterators may point to it
+ */
+template <typename Left, typename Right> struct btree_record {
+  Left left;
+  Right right;
+  // leaf of each side which holds the record and its slot there
+  void *leaf[2] = {nullptr, nullptr};
+  std::uint32_t slot[2] = {0, 0};
+
+  template <bool IsLeft> auto const &key() const noexcept {
+    if constexpr (IsLeft)
+      return left;
+    else
+      return right;
+  }
+};
+
+/**
+ * b+-tree of one side of btree_bimap. node holds `order` keys, so it
+ * spans few cache lines and tree is several times lower than binary one.
+ * inner nodes hold copies of keys, leaves hold copies of keys together
+ * with pointers to records and are linked into list. node which becomes
+ * less than quarter full is merged with sibling, or takes entries from it
+ * if they do not fit into one node, so every node but root stays at least
+ * quarter full
+ */
+template <typename Key, typename Record, bool IsLeft> class btree_side {
+  static_assert(std::is_default_constructible_v<Key> &&
+                    std::is_copy_constructible_v<Key>,
+                "btree_bimap stores copies of keys in nodes");
+
+public:
+  static constexpr std::size_t order = std::clamp<std::size_t>(
+      512 / (sizeof(Key) + sizeof(void *)), 16, 64);
+
+private:
+  static constexpr std::size_t side = IsLeft ? 0 : 1;
+  static constexpr std::size_t min_fill = order / 4;
+  using count_t = std::uint32_t;
+
+  struct inner_node;
+  struct node {
+    inner_node *parent = nullptr;
+    // keys in leaf, children in inner node
+    count_t count = 0;
+    bool is_leaf;
+
+    explicit node(bool is_leaf) noexcept : is_leaf(is_leaf) {}
+  };
+  struct leaf_node : node {
+    leaf_node *prev = nullptr, *next = nullptr;
+    Key keys[order];
+    Record *records[order];
+
+    leaf_node() : node(true) {}
+  };
+  struct inner_node : node {
+    // keys[i] is greater than keys under children[i] and not greater than
+    // ones under children[i + 1]
+    Key keys[order - 1];
+    node *children[order];
+
+    inner_node() : node(false) {}
+  };
+  using spare_t = std::vector<std::unique_ptr<inner_node>>;
+
+  node *root = nullptr;
+  leaf_node *first = nullptr, *last = nullptr;
+  std::size_t leaves = 0, inners = 0;
+
+  static leaf_node *leaf_of(Record const *rec) noexcept {
+    return static_cast<leaf_node *>(rec->leaf[side]);
+  }
+  static count_t slot_of(Record const *rec) noexcept {
+    return rec->slot[side];
+  }
+  // stores positions of records `[b, e)` of `leaf` in them
+  static void renumber(leaf_node *leaf, count_t b, count_t e) noexcept {
+    for (count_t i = b; i < e; i++) {
+      leaf->records[i]->leaf[side] = leaf;
+      leaf->records[i]->slot[side] = i;
+    }
+  }
+  static count_t index_of(inner_node const *in, node const *n) noexcept {
+    return static_cast<count_t>(
+        std::find(in->children, in->children + in->count, n) - in->children);
+  }
+
+  void destroy_node(node *n) noexcept {
+    if (n->is_leaf) {
+      delete static_cast<leaf_node *>(n);
+      leaves--;
+    } else {
+      delete static_cast<inner_node *>(n);
+      inners--;
+    }
+  }
+  void destroy(node *n) noexcept {
+    if (n == nullptr)
+      return;
+    if (!n->is_leaf) {
+      auto in = static_cast<inner_node *>(n);
+      for (count_t i = 0; i < in->count; i++)
+        destroy(in->children[i]);
+    }
+    destroy_node(n);
+  }
+
+  void put(leaf_node *leaf, count_t s, Key &&key, Record *rec) {
+    std::move_backward(leaf->keys + s, leaf->keys + leaf->count,
+                       leaf->keys + leaf->count + 1);
+    std::copy_backward(leaf->records + s, leaf->records + leaf->count,
+                       leaf->records + leaf->count + 1);
+    leaf->keys[s] = std::move(key);
+    leaf->records[s] = rec;
+    leaf->count++;
+    renumber(leaf, s, leaf->count);
+  }
+  // moves entries `[b, e)` of `from` to `to` starting at `at`
+  void move_entries(leaf_node *from, count_t b, count_t e, leaf_node *to,
+                    count_t at) {
+    std::move(from->keys + b, from->keys + e, to->keys + at);
+    std::copy(from->records + b, from->records + e, to->records + at);
+    renumber(to, at, at + (e - b));
+  }
+
+  inner_node *take(spare_t &spare) noexcept {
+    auto in = spare.back().release();
+    spare.pop_back();
+    inners++;
+    return in;
+  }
+  // inserts `child` at `j`, `key` separates it from previous one
+  void insert_at(inner_node *in, count_t j, Key &&key, node *child) {
+    std::move_backward(in->keys + (j - 1), in->keys + (in->count - 1),
+                       in->keys + in->count);
+    std::copy_backward(in->children + j, in->children + in->count,
+                       in->children + in->count + 1);
+    in->keys[j - 1] = std::move(key);
+    in->children[j] = child;
+    child->parent = in;
+    in->count++;
+  }
+  /**
+   * links `right`, which was split from `left`, into parent of `left`.
+   * full parents are split up to root, their nodes are taken from `spare`
+   */
+  void add_child(node *left, Key key, node *right, spare_t &spare) {
+    for (;;) {
+      auto in = left->parent;
+      if (in == nullptr) {
+        auto r = take(spare);
+        r->children[0] = left;
+        r->children[1] = right;
+        r->keys[0] = std::move(key);
+        r->count = 2;
+        left->parent = right->parent = r;
+        root = r;
+        return;
+      }
+      auto j = index_of(in, left) + 1;
+      if (in->count < order) {
+        insert_at(in, j, std::move(key), right);
+        return;
+      }
+      auto sibling = take(spare);
+      constexpr count_t mid = order / 2;
+      Key up = std::move(in->keys[mid - 1]);
+      std::move(in->keys + mid, in->keys + (order - 1), sibling->keys);
+      std::copy(in->children + mid, in->children + order, sibling->children);
+      sibling->count = order - mid;
+      in->count = mid;
+      for (count_t i = 0; i < sibling->count; i++)
+        sibling->children[i]->parent = sibling;
+      if (j <= mid)
+        insert_at(in, j, std::move(key), right);
+      else
+        insert_at(sibling, j - mid, std::move(key), right);
+      left = in;
+      key = std::move(up);
+      right = sibling;
+    }
+  }
+
+  void unlink(leaf_node *leaf) noexcept {
+    (leaf->prev == nullptr ? first : leaf->prev->next) = leaf->next;
+    (leaf->next == nullptr ? last : leaf->next->prev) = leaf->prev;
+  }
+  // detaches node without children or keys and deletes it
+  void remove(node *n) {
+    auto in = n->parent;
+    if (in == nullptr) {
+      root = nullptr;
+      destroy_node(n);
+      return;
+    }
+    auto i = index_of(in, n);
+    destroy_node(n);
+    remove_child(in, i);
+  }
+  void remove_child(inner_node *in, count_t i) {
+    count_t k = i == 0 ? 0 : i - 1;
+    if (in->count > 1)
+      std::move(in->keys + k + 1, in->keys + (in->count - 1), in->keys + k);
+    std::copy(in->children + i + 1, in->children + in->count,
+              in->children + i);
+    in->count--;
+    if (in == root) {
+      // inner nodes which failed to merge may have single child too
+      while (!root->is_leaf && root->count == 1) {
+        auto old = static_cast<inner_node *>(root);
+        root = old->children[0];
+        root->parent = nullptr;
+        destroy_node(old);
+      }
+    } else if (in->count == 0) {
+      remove(in);
+    } else if (in->count < min_fill) {
+      merge_with_sibling(in);
+    }
+  }
+  /**
+   * evens out entries of children `l` and `l + 1` of `in`, which do not fit
+   * into one node, so both become more than half full. separator between
+   * them is copied before anything moves
+   */
+  void redistribute(inner_node *in, count_t l) {
+    auto a = in->children[l], b = in->children[l + 1];
+    count_t ca = a->count, cb = b->count;
+    count_t half = (ca + cb) / 2;
+    if (a->is_leaf) {
+      auto la = static_cast<leaf_node *>(a), lb = static_cast<leaf_node *>(b);
+      if (ca < cb) {
+        count_t k = half - ca;
+        Key sep(lb->keys[k]);
+        move_entries(lb, 0, k, la, ca);
+        move_entries(lb, k, cb, lb, 0);
+        la->count += k;
+        lb->count -= k;
+        in->keys[l] = std::move(sep);
+      } else {
+        count_t k = ca - half;
+        Key sep(la->keys[ca - k]);
+        std::move_backward(lb->keys, lb->keys + cb, lb->keys + (cb + k));
+        std::copy_backward(lb->records, lb->records + cb,
+                           lb->records + (cb + k));
+        move_entries(la, ca - k, ca, lb, 0);
+        la->count -= k;
+        lb->count += k;
+        renumber(lb, k, lb->count);
+        in->keys[l] = std::move(sep);
+      }
+      return;
+    }
+    // separator goes down into node which takes children, key next to
+    // moved children goes up
+    auto ia = static_cast<inner_node *>(a), ib = static_cast<inner_node *>(b);
+    if (ca < cb) {
+      count_t k = half - ca;
+      ia->keys[ca - 1] = std::move(in->keys[l]);
+      std::move(ib->keys, ib->keys + (k - 1), ia->keys + ca);
+      for (count_t j = 0; j < k; j++) {
+        ia->children[ca + j] = ib->children[j];
+        ib->children[j]->parent = ia;
+      }
+      in->keys[l] = std::move(ib->keys[k - 1]);
+      std::move(ib->keys + k, ib->keys + (cb - 1), ib->keys);
+      std::copy(ib->children + k, ib->children + cb, ib->children);
+      ia->count += k;
+      ib->count -= k;
+    } else {
+      count_t k = ca - half;
+      std::move_backward(ib->keys, ib->keys + (cb - 1),
+                         ib->keys + (cb - 1 + k));
+      std::copy_backward(ib->children, ib->children + cb,
+                         ib->children + (cb + k));
+      ib->keys[k - 1] = std::move(in->keys[l]);
+      std::move(ia->keys + (ca - k), ia->keys + (ca - 1), ib->keys);
+      for (count_t j = 0; j < k; j++) {
+        ib->children[j] = ia->children[ca - k + j];
+        ib->children[j]->parent = ib;
+      }
+      in->keys[l] = std::move(ia->keys[ca - k - 1]);
+      ia->count -= k;
+      ib->count += k;
+    }
+  }
+  /**
+   * merges `n` with neighbour under the same parent if they fit into one,
+   * otherwise moves entries from neighbour. only root may have single
+   * child, and it is removed then, so non-root `n` always has neighbour
+   */
+  void merge_with_sibling(node *n) {
+    auto in = n->parent;
+    if (in == nullptr || in->count < 2)
+      return;
+    auto i = index_of(in, n);
+    count_t l = i + 1 < in->count ? i : i - 1;
+    auto a = in->children[l], b = in->children[l + 1];
+    if (a->count + b->count > order) {
+      redistribute(in, l);
+      return;
+    }
+    if (n->is_leaf) {
+      auto la = static_cast<leaf_node *>(a), lb = static_cast<leaf_node *>(b);
+      move_entries(lb, 0, lb->count, la, la->count);
+      la->count += lb->count;
+      unlink(lb);
+    } else {
+      auto ia = static_cast<inner_node *>(a), ib = static_cast<inner_node *>(b);
+      ia->keys[ia->count - 1] = std::move(in->keys[l]);
+      std::move(ib->keys, ib->keys + (ib->count - 1), ia->keys + ia->count);
+      for (count_t j = 0; j < ib->count; j++) {
+        ia->children[ia->count + j] = ib->children[j];
+        ib->children[j]->parent = ia;
+      }
+      ia->count += ib->count;
+    }
+    destroy_node(b);
+    remove_child(in, l + 1);
+  }
+
+public:
+  // leaf and slot where key is or would be inserted
+  struct position {
+    leaf_node *leaf;
+    count_t slot;
+  };
+
+  btree_side() = default;
+  btree_side(btree_side const &) = delete;
+  btree_side &operator=(btree_side const &) = delete;
+  ~btree_side() { destroy(root); }
+
+  void swap(btree_side &other) noexcept {
+    std::swap(root, other.root);
+    std::swap(first, other.first);
+    std::swap(last, other.last);
+    std::swap(leaves, other.leaves);
+    std::swap(inners, other.inners);
+  }
+
+  // deletes nodes, records are owned by map
+  void clear() noexcept {
+    destroy(root);
+    root = nullptr;
+    first = last = nullptr;
+  }
+
+  template <typename C> position locate(Key const &x, C const &c) const {
+    if (root == nullptr)
+      return {nullptr, 0};
+    node *n = root;
+    while (!n->is_leaf) {
+      auto in = static_cast<inner_node *>(n);
+      n = in->children[std::upper_bound(in->keys, in->keys + (in->count - 1),
+                                        x, c) -
+                       in->keys];
+    }
+    auto leaf = static_cast<leaf_node *>(n);
+    return {leaf, static_cast<count_t>(
+                      std::lower_bound(leaf->keys, leaf->keys + leaf->count,
+                                       x, c) -
+                      leaf->keys)};
+  }
+  template <typename C>
+  static bool found(position p, Key const &x, C const &c) {
+    return p.leaf != nullptr && p.slot < p.leaf->count &&
+           !c(x, p.leaf->keys[p.slot]);
+  }
+
+  template <typename C> Record *find(Key const &x, C const &c) const {
+    auto p = locate(x, c);
+    return found(p, x, c) ? p.leaf->records[p.slot] : nullptr;
+  }
+  // first record with key not less than `x` (greater, if `Upper`)
+  template <bool Upper, typename C>
+  Record *bound(Key const &x, C const &c) const {
+    auto p = locate(x, c);
+    if (p.leaf == nullptr)
+      return nullptr;
+    if (Upper && found(p, x, c))
+      p.slot++;
+    if (p.slot == p.leaf->count)
+      return p.leaf->next == nullptr ? nullptr : p.leaf->next->records[0];
+    return p.leaf->records[p.slot];
+  }
+
+  Record *front() const noexcept {
+    return first == nullptr ? nullptr : first->records[0];
+  }
+  static Record *next(Record const *rec) noexcept {
+    auto leaf = leaf_of(rec);
+    auto s = slot_of(rec) + 1;
+    if (s < leaf->count)
+      return leaf->records[s];
+    return leaf->next == nullptr ? nullptr : leaf->next->records[0];
+  }
+  // `nullptr` is end
+  Record *prev(Record const *rec) const noexcept {
+    auto leaf = rec == nullptr ? last : leaf_of(rec);
+    if (leaf == nullptr)
+      return nullptr;
+    auto s = rec == nullptr ? leaf->count : slot_of(rec);
+    if (s > 0)
+      return leaf->records[s - 1];
+    leaf = leaf->prev;
+    return leaf == nullptr ? nullptr : leaf->records[leaf->count - 1];
+  }
+
+  /**
+   * inserts `rec` at position returned by locate. key is copied and nodes
+   * for splits are allocated before tree changes, so it stays intact if
+   * they throw
+   */
+  void insert(Record *rec, position p) {
+    Key key(rec->template key<IsLeft>());
+    if (root == nullptr) {
+      auto leaf = new leaf_node();
+      leaves++;
+      root = first = last = leaf;
+      p = {leaf, 0};
+    }
+    auto leaf = p.leaf;
+    if (leaf->count < order) {
+      put(leaf, p.slot, std::move(key), rec);
+      return;
+    }
+
+    auto right = std::make_unique<leaf_node>();
+    spare_t spare;
+    auto in = leaf->parent;
+    for (; in != nullptr && in->count == order; in = in->parent)
+      spare.push_back(std::make_unique<inner_node>());
+    if (in == nullptr)
+      spare.push_back(std::make_unique<inner_node>());
+    constexpr count_t mid = order / 2;
+    // the first key of right half whichever half gets new one
+    Key separator(leaf->keys[mid]);
+
+    auto r = right.release();
+    leaves++;
+    move_entries(leaf, mid, order, r, 0);
+    r->count = order - mid;
+    leaf->count = mid;
+    r->prev = leaf;
+    r->next = leaf->next;
+    (leaf->next == nullptr ? last : leaf->next->prev) = r;
+    leaf->next = r;
+    if (p.slot <= mid)
+      put(leaf, p.slot, std::move(key), rec);
+    else
+      put(r, p.slot - mid, std::move(key), rec);
+    add_child(leaf, std::move(separator), r, spare);
+  }
+
+  void erase(Record const *rec) {
+    auto leaf = leaf_of(rec);
+    auto s = slot_of(rec);
+    std::move(leaf->keys + s + 1, leaf->keys + leaf->count, leaf->keys + s);
+    std::copy(leaf->records + s + 1, leaf->records + leaf->count,
+              leaf->records + s);
+    leaf->count--;
+    renumber(leaf, s, leaf->count);
+    if (leaf->count == 0) {
+      unlink(leaf);
+      remove(leaf);
+    } else if (leaf->count < min_fill) {
+      merge_with_sibling(leaf);
+    }
+  }
+
+  // calls `f` for records in order
+  template <typename F> void for_each(F const &f) const {
+    for (auto leaf = first; leaf != nullptr; leaf = leaf->next)
+      for (count_t i = 0; i < leaf->count; i++)
+        f(leaf->records[i]);
+  }
+
+  std::size_t memory_usage() const noexcept {
+    return leaves * sizeof(leaf_node) + inners * sizeof(inner_node);
+  }
+  std::size_t height() const noexcept {
+    std::size_t res = 0;
+    for (auto n = root; n != nullptr; res++)
+      n = n->is_leaf ? nullptr : static_cast<inner_node *>(n)->children[0];
+    return res;
+  }
+};
+
+/**
+ * iterator of btree_bimap, holds pointer to record, so it stays valid
+ * until the pair is erased. flip does not search
+ */
+template <typename Map, bool IsLeft> struct btree_bimap_iterator {
+private:
+  using record_t = typename Map::record;
+
+  Map const *map;
+  record_t const *rec;
+
+public:
+  using value_type =
+      std::conditional_t<IsLeft, typename Map::left_t, typename Map::right_t>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  friend Map;
+
+  btree_bimap_iterator() = default;
+  btree_bimap_iterator(Map const *map, record_t const *rec) noexcept
+      : map(map), rec(rec) {}
+
+  pointer_type operator->() const noexcept {
+    return &rec->template key<IsLeft>();
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  btree_bimap_iterator &operator++() noexcept {
+    rec = map->template side<IsLeft>().next(rec);
+    return *this;
+  }
+  btree_bimap_iterator operator++(int) noexcept {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+  btree_bimap_iterator &operator--() noexcept {
+    rec = map->template side<IsLeft>().prev(rec);
+    return *this;
+  }
+  btree_bimap_iterator operator--(int) noexcept {
+    auto copy = *this;
+    operator--();
+    return copy;
+  }
+
+  auto flip() const noexcept {
+    return btree_bimap_iterator<Map, !IsLeft>(map, rec);
+  }
+
+  bool operator==(btree_bimap_iterator const &r) const noexcept {
+    return rec == r.rec;
+  }
+  bool operator!=(btree_bimap_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap for large maps: each side is b+-tree with 16 to 64 keys per node
+ * (about 512 bytes), so lookup touches few nodes instead of one node per
+ * level of binary tree. pairs are records shared by leaves of both sides
+ * and iterators point to them, so flip is O(1) and iterators stay valid
+ * until their pair is erased. keys are copied into nodes, so they should
+ * be cheap to copy
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+struct btree_bimap
+    : private bimap_helper::tagged_comparator<CompareLeft>,
+      private bimap_helper::tagged_comparator<
+          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>> {
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_iterator = bimap_helper::btree_bimap_iterator<btree_bimap, true>;
+  using right_iterator =
+      bimap_helper::btree_bimap_iterator<btree_bimap, false>;
+
+private:
+  template <typename, bool> friend struct bimap_helper::btree_bimap_iterator;
+
+  using left_comparator_holder = bimap_helper::tagged_comparator<CompareLeft>;
+  using right_comparator_holder = bimap_helper::tagged_comparator<
+      CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>;
+
+  using record = bimap_helper::btree_record<Left, Right>;
+
+  template <bool IsLeft> using key_t = std::conditional_t<IsLeft, Left, Right>;
+  template <bool IsLeft>
+  using iterator_t = std::conditional_t<IsLeft, left_iterator, right_iterator>;
+  template <bool IsLeft>
+  using side_t = bimap_helper::btree_side<key_t<IsLeft>, record, IsLeft>;
+
+  side_t<true> left_side;
+  side_t<false> right_side;
+  std::size_t count = 0;
+
+  template <bool IsLeft> auto &side() noexcept {
+    if constexpr (IsLeft)
+      return left_side;
+    else
+      return right_side;
+  }
+  template <bool IsLeft> auto const &side() const noexcept {
+    if constexpr (IsLeft)
+      return left_side;
+    else
+      return right_side;
+  }
+  template <bool IsLeft> auto const &comparator() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<CompareLeft const &>(
+          static_cast<left_comparator_holder const &>(*this));
+    else
+      return static_cast<CompareRight const &>(
+          static_cast<right_comparator_holder const &>(*this));
+  }
+
+  template <bool IsLeft>
+  record const *find_record(key_t<IsLeft> const &k) const {
+    return side<IsLeft>().find(k, comparator<IsLeft>());
+  }
+  template <bool IsLeft, bool Upper>
+  iterator_t<IsLeft> bound(key_t<IsLeft> const &k) const {
+    return iterator_t<IsLeft>(
+        this, side<IsLeft>().template bound<Upper>(k, comparator<IsLeft>()));
+  }
+
+  template <typename T1, typename T2>
+  left_iterator insert_impl(T1 &&l, T2 &&r) {
+    auto left_pos = left_side.locate(l, comparator<true>());
+    auto right_pos = right_side.locate(r, comparator<false>());
+    if (left_side.found(left_pos, l, comparator<true>()) ||
+        right_side.found(right_pos, r, comparator<false>()))
+      return end_left();
+    std::unique_ptr<record> rec(
+        new record{std::forward<T1>(l), std::forward<T2>(r)});
+    left_side.insert(rec.get(), left_pos);
+    try {
+      right_side.insert(rec.get(), right_pos);
+    } catch (...) {
+      left_side.erase(rec.get());
+      throw;
+    }
+    count++;
+    return left_iterator(this, rec.release());
+  }
+
+  void erase_record(record const *rec) {
+    left_side.erase(rec);
+    right_side.erase(rec);
+    delete rec;
+    count--;
+  }
+  template <bool IsLeft> iterator_t<IsLeft> erase_impl(iterator_t<IsLeft> it) {
+    auto next = side<IsLeft>().next(it.rec);
+    erase_record(it.rec);
+    return iterator_t<IsLeft>(this, next);
+  }
+  template <bool IsLeft>
+  iterator_t<IsLeft> erase_range(iterator_t<IsLeft> f, iterator_t<IsLeft> l) {
+    while (f != l)
+      f = erase_impl<IsLeft>(f);
+    return f;
+  }
+  template <bool IsLeft> bool erase_key(key_t<IsLeft> const &k) {
+    auto rec = find_record<IsLeft>(k);
+    if (rec == nullptr)
+      return false;
+    erase_record(rec);
+    return true;
+  }
+
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &k) const {
+    auto rec = find_record<IsLeft>(k);
+    if (rec == nullptr)
+      throw std::out_of_range("at_left bad");
+    return rec->template key<!IsLeft>();
+  }
+
+public:
+  btree_bimap(CompareLeft cl = CompareLeft(), CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)) {}
+
+  template <typename InputIt>
+  btree_bimap(InputIt first, InputIt last, CompareLeft cl = CompareLeft(),
+              CompareRight cr = CompareRight())
+      : btree_bimap(std::move(cl), std::move(cr)) {
+    for (; first != last; ++first)
+      insert(std::get<0>(*first), std::get<1>(*first));
+  }
+
+  btree_bimap(btree_bimap const &other)
+      : btree_bimap(other.comparator<true>(), other.comparator<false>()) {
+    for (auto it = other.begin_left(); it != other.end_left(); ++it)
+      insert(*it, *it.flip());
+  }
+  btree_bimap(btree_bimap &&other) noexcept
+      : btree_bimap(other.comparator<true>(), other.comparator<false>()) {
+    swap(other);
+  }
+  btree_bimap &operator=(btree_bimap other) noexcept {
+    swap(other);
+    return *this;
+  }
+  ~btree_bimap() { clear(); }
+
+  // comparators are kept, as with move assignment of bimap
+  void swap(btree_bimap &other) noexcept {
+    left_side.swap(other.left_side);
+    right_side.swap(other.right_side);
+    std::swap(count, other.count);
+  }
+
+  void clear() noexcept {
+    left_side.for_each([](record *rec) { delete rec; });
+    left_side.clear();
+    right_side.clear();
+    count = 0;
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, left_side.front());
+  }
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, nullptr);
+  }
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, right_side.front());
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, nullptr);
+  }
+
+  left_iterator insert(left_t const &a, right_t const &b) {
+    return insert_impl(a, b);
+  }
+  left_iterator insert(left_t const &a, right_t &&b) {
+    return insert_impl(a, std::move(b));
+  }
+  left_iterator insert(left_t &&a, right_t const &b) {
+    return insert_impl(std::move(a), b);
+  }
+  left_iterator insert(left_t &&a, right_t &&b) {
+    return insert_impl(std::move(a), std::move(b));
+  }
+
+  left_iterator erase_left(left_iterator it) { return erase_impl<true>(it); }
+  right_iterator erase_right(right_iterator it) {
+    return erase_impl<false>(it);
+  }
+  bool erase_left(left_t const &left) { return erase_key<true>(left); }
+  bool erase_right(right_t const &right) { return erase_key<false>(right); }
+  left_iterator erase_left(left_iterator f, left_iterator l) {
+    return erase_range<true>(f, l);
+  }
+  right_iterator erase_right(right_iterator f, right_iterator l) {
+    return erase_range<false>(f, l);
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(this, find_record<true>(left));
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(this, find_record<false>(right));
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const {
+    return bound<true, false>(left);
+  }
+  right_iterator lower_bound_right(right_t const &right) const {
+    return bound<false, false>(right);
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return bound<true, true>(left);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return bound<false, true>(right);
+  }
+
+  bool empty() const noexcept { return count == 0; }
+  std::size_t size() const noexcept { return count; }
+
+  // bytes used by records and nodes of both sides
+  std::size_t memory_usage() const noexcept {
+    return count * sizeof(record) + left_side.memory_usage() +
+           right_side.memory_usage();
+  }
+  // levels of nodes in the higher side, 0 if empty
+  std::size_t height() const noexcept {
+    return std::max(left_side.height(), right_side.height());
+  }
+
+  bool operator==(btree_bimap const &b) const {
+    if (size() != b.size())
+      return false;
+    auto const &l = comparator<true>();
+    auto const &r = comparator<false>();
+    for (auto it1 = begin_left(), it2 = b.begin_left(); it1 != end_left();
+         ++it1, ++it2)
+      if (bimap_helper::NotEqual(l, *it1, *it2) ||
+          bimap_helper::NotEqual(r, *it1.flip(), *it2.flip()))
+        return false;
+    return true;
+  }
+  bool operator!=(btree_bimap const &b) const { return !operator==(b); }
+};
@@ -0,0 +1,553 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bimap-helper.h"
+
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct compact_bimap;
+
+namespace bimap_helper {
+/**
+ * iterator of compact_bimap, holds index of pair, so it survives growth of
+ * storage
+ */
+template <typename Map, bool IsLeft> struct compact_bimap_iterator {
+private:
+  using index_t = typename Map::index_t;
+
+  Map const *map;
+  index_t pos;
+
+public:
+  using value_type =
+      std::conditional_t<IsLeft, typename Map::left_t, typename Map::right_t>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  friend Map;
+
+  compact_bimap_iterator() = default;
+  compact_bimap_iterator(Map const *map, index_t pos) noexcept
+      : map(map), pos(pos) {}
+
+  pointer_type operator->() const noexcept {
+    return &map->template key<IsLeft>(pos);
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  compact_bimap_iterator &operator++() noexcept {
+    pos = map->template next<IsLeft>(pos);
+    return *this;
+  }
+  compact_bimap_iterator operator++(int) noexcept {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+  compact_bimap_iterator &operator--() noexcept {
+    if (pos == Map::nil)
+      pos = map->template extreme<IsLeft, false>();
+    else
+      pos = map->template prev<IsLeft>(pos);
+    return *this;
+  }
+  compact_bimap_iterator operator--(int) noexcept {
+    auto copy = *this;
+    operator--();
+    return copy;
+  }
+
+  auto flip() const noexcept {
+    return compact_bimap_iterator<Map, !IsLeft>(map, pos);
+  }
+
+  bool operator==(compact_bimap_iterator const &r) const noexcept {
+    return pos == r.pos;
+  }
+  bool operator!=(compact_bimap_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap for many small pairs: pairs live in one vector and both trees are
+ * avl trees linked by 32 bit indices, so links take 32 bytes per pair
+ * instead of 64 with pointers and there are no per pair allocations.
+ * erase moves last pair into the hole, which invalidates iterators to it.
+ * other iterators stay valid on insert
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+struct compact_bimap
+    : private bimap_helper::tagged_comparator<CompareLeft>,
+      private bimap_helper::tagged_comparator<
+          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>> {
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_iterator =
+      bimap_helper::compact_bimap_iterator<compact_bimap, true>;
+  using right_iterator =
+      bimap_helper::compact_bimap_iterator<compact_bimap, false>;
+
+private:
+  template <typename, bool> friend struct bimap_helper::compact_bimap_iterator;
+
+  using left_comparator_holder = bimap_helper::tagged_comparator<CompareLeft>;
+  using right_comparator_holder = bimap_helper::tagged_comparator<
+      CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>;
+
+  using index_t = std::uint32_t;
+  static constexpr index_t nil = std::numeric_limits<index_t>::max();
+
+  struct links {
+    index_t left = nil, right = nil, up = nil;
+    // avl height never exceeds 1.44 * 32
+    std::uint8_t height = 1;
+  };
+  struct node {
+    Left left_value;
+    Right right_value;
+    links side[2];
+
+    template <typename T1, typename T2>
+    node(T1 &&l, T2 &&r)
+        : left_value(std::forward<T1>(l)), right_value(std::forward<T2>(r)) {}
+  };
+
+  // erase moves the last pair into the hole and can not be undone
+  static_assert(std::is_nothrow_move_assignable_v<Left> &&
+                    std::is_nothrow_move_assignable_v<Right>,
+                "compact_bimap needs values with noexcept move assignment");
+
+  std::vector<node> nodes;
+  index_t roots[2] = {nil, nil};
+
+  template <bool IsLeft> links &link(index_t i) noexcept {
+    return nodes[i].side[IsLeft ? 0 : 1];
+  }
+  template <bool IsLeft> links const &link(index_t i) const noexcept {
+    return nodes[i].side[IsLeft ? 0 : 1];
+  }
+  template <bool IsLeft> index_t &root() noexcept {
+    return roots[IsLeft ? 0 : 1];
+  }
+  template <bool IsLeft> index_t root() const noexcept {
+    return roots[IsLeft ? 0 : 1];
+  }
+
+  template <bool IsLeft> auto const &key(index_t i) const noexcept {
+    if constexpr (IsLeft)
+      return nodes[i].left_value;
+    else
+      return nodes[i].right_value;
+  }
+  template <bool IsLeft> auto const &comparator() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<CompareLeft const &>(
+          static_cast<left_comparator_holder const &>(*this));
+    else
+      return static_cast<CompareRight const &>(
+          static_cast<right_comparator_holder const &>(*this));
+  }
+
+  template <bool IsLeft> using key_t = std::conditional_t<IsLeft, Left, Right>;
+  template <bool IsLeft>
+  using iterator_t =
+      bimap_helper::compact_bimap_iterator<compact_bimap, IsLeft>;
+
+  template <bool IsLeft> int height(index_t i) const noexcept {
+    return i == nil ? 0 : link<IsLeft>(i).height;
+  }
+  template <bool IsLeft> void update(index_t i) noexcept {
+    auto &l = link<IsLeft>(i);
+    l.height = static_cast<std::uint8_t>(
+        1 + std::max(height<IsLeft>(l.left), height<IsLeft>(l.right)));
+  }
+
+  // replaces `from` with `to` in `parent` (or root)
+  template <bool IsLeft>
+  void replace_child(index_t parent, index_t from, index_t to) noexcept {
+    if (parent == nil)
+      root<IsLeft>() = to;
+    else if (link<IsLeft>(parent).left == from)
+      link<IsLeft>(parent).left = to;
+    else
+      link<IsLeft>(parent).right = to;
+    if (to != nil)
+      link<IsLeft>(to).up = parent;
+  }
+
+  /**
+   * lifts child `Dir` of `i`, returns it
+   */
+  template <bool IsLeft, index_t links::*Dir>
+  index_t rotate(index_t i) noexcept {
+    constexpr auto co = Dir == &links::left ? &links::right : &links::left;
+    auto c = link<IsLeft>(i).*Dir;
+    replace_child<IsLeft>(link<IsLeft>(i).up, i, c);
+    auto moved = link<IsLeft>(c).*co;
+    link<IsLeft>(i).*Dir = moved;
+    if (moved != nil)
+      link<IsLeft>(moved).up = i;
+    link<IsLeft>(c).*co = i;
+    link<IsLeft>(i).up = c;
+    update<IsLeft>(i);
+    update<IsLeft>(c);
+    return c;
+  }
+
+  // restores balance of subtree, returns its new root
+  template <bool IsLeft> index_t rebalance(index_t i) noexcept {
+    update<IsLeft>(i);
+    auto const &l = link<IsLeft>(i);
+    auto balance = height<IsLeft>(l.left) - height<IsLeft>(l.right);
+    if (balance > 1) {
+      auto const &c = link<IsLeft>(l.left);
+      if (height<IsLeft>(c.left) < height<IsLeft>(c.right))
+        rotate<IsLeft, &links::right>(l.left);
+      return rotate<IsLeft, &links::left>(i);
+    }
+    if (balance < -1) {
+      auto const &c = link<IsLeft>(l.right);
+      if (height<IsLeft>(c.right) < height<IsLeft>(c.left))
+        rotate<IsLeft, &links::left>(l.right);
+      return rotate<IsLeft, &links::right>(i);
+    }
+    return i;
+  }
+
+  template <bool IsLeft> void fix_up(index_t i) noexcept {
+    while (i != nil)
+      i = link<IsLeft>(rebalance<IsLeft>(i)).up;
+  }
+
+  /**
+   * finds parent for new key, returns false if key is present
+   */
+  template <bool IsLeft>
+  bool find_parent(key_t<IsLeft> const &k, index_t &parent,
+                   bool &go_left) const {
+    auto const &c = comparator<IsLeft>();
+    parent = nil;
+    go_left = true;
+    for (auto cur = root<IsLeft>(); cur != nil;) {
+      parent = cur;
+      if (c(k, key<IsLeft>(cur))) {
+        go_left = true;
+        cur = link<IsLeft>(cur).left;
+      } else if (c(key<IsLeft>(cur), k)) {
+        go_left = false;
+        cur = link<IsLeft>(cur).right;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <bool IsLeft>
+  void attach(index_t i, index_t parent, bool go_left) noexcept {
+    link<IsLeft>(i).up = parent;
+    if (parent == nil)
+      root<IsLeft>() = i;
+    else if (go_left)
+      link<IsLeft>(parent).left = i;
+    else
+      link<IsLeft>(parent).right = i;
+    fix_up<IsLeft>(parent);
+  }
+
+  template <bool IsLeft> void detach(index_t i) noexcept {
+    auto const &l = link<IsLeft>(i);
+    index_t fix;
+    if (l.left != nil && l.right != nil) {
+      // successor takes place of this node
+      auto s = l.right;
+      while (link<IsLeft>(s).left != nil)
+        s = link<IsLeft>(s).left;
+      if (auto s_parent = link<IsLeft>(s).up; s_parent == i) {
+        fix = s;
+      } else {
+        replace_child<IsLeft>(s_parent, s, link<IsLeft>(s).right);
+        link<IsLeft>(s).right = l.right;
+        link<IsLeft>(l.right).up = s;
+        fix = s_parent;
+      }
+      link<IsLeft>(s).left = l.left;
+      link<IsLeft>(l.left).up = s;
+      link<IsLeft>(s).height = l.height;
+      replace_child<IsLeft>(l.up, i, s);
+    } else {
+      fix = l.up;
+      replace_child<IsLeft>(l.up, i, l.left != nil ? l.left : l.right);
+    }
+    fix_up<IsLeft>(fix);
+  }
+
+  // neighbours of `from` start to point to `to`
+  template <bool IsLeft> void relocate(index_t from, index_t to) noexcept {
+    auto const l = link<IsLeft>(from);
+    replace_child<IsLeft>(l.up, from, to);
+    if (l.left != nil)
+      link<IsLeft>(l.left).up = to;
+    if (l.right != nil)
+      link<IsLeft>(l.right).up = to;
+  }
+
+  // returns index that took place of `next`
+  index_t erase_at(index_t i, index_t next) noexcept {
+    detach<true>(i);
+    detach<false>(i);
+    auto last = static_cast<index_t>(nodes.size() - 1);
+    if (i != last) {
+      relocate<true>(last, i);
+      relocate<false>(last, i);
+      nodes[i] = std::move(nodes[last]);
+    }
+    nodes.pop_back();
+    return next == last ? i : next;
+  }
+
+  template <bool IsLeft, bool Min> index_t extreme() const noexcept {
+    auto cur = root<IsLeft>();
+    if (cur == nil)
+      return nil;
+    while (true) {
+      auto child = Min ? link<IsLeft>(cur).left : link<IsLeft>(cur).right;
+      if (child == nil)
+        return cur;
+      cur = child;
+    }
+  }
+
+  template <bool IsLeft, bool Next> index_t step(index_t i) const noexcept {
+    auto const &l = link<IsLeft>(i);
+    if (auto c = Next ? l.right : l.left; c != nil) {
+      while (true) {
+        auto child = Next ? link<IsLeft>(c).left : link<IsLeft>(c).right;
+        if (child == nil)
+          return c;
+        c = child;
+      }
+    }
+    auto prev = i;
+    auto cur = l.up;
+    while (cur != nil &&
+           (Next ? link<IsLeft>(cur).right : link<IsLeft>(cur).left) == prev) {
+      prev = cur;
+      cur = link<IsLeft>(cur).up;
+    }
+    return cur;
+  }
+  template <bool IsLeft> index_t next(index_t i) const noexcept {
+    return step<IsLeft, true>(i);
+  }
+  template <bool IsLeft> index_t prev(index_t i) const noexcept {
+    return step<IsLeft, false>(i);
+  }
+
+  // least element which is not less than `k`
+  template <bool IsLeft> index_t find_ge(key_t<IsLeft> const &k) const {
+    auto const &c = comparator<IsLeft>();
+    index_t best = nil;
+    for (auto cur = root<IsLeft>(); cur != nil;) {
+      if (c(key<IsLeft>(cur), k)) {
+        cur = link<IsLeft>(cur).right;
+      } else {
+        best = cur;
+        cur = link<IsLeft>(cur).left;
+      }
+    }
+    return best;
+  }
+
+  template <bool IsLeft> index_t find_index(key_t<IsLeft> const &k) const {
+    auto res = find_ge<IsLeft>(k);
+    if (res != nil && comparator<IsLeft>()(k, key<IsLeft>(res)))
+      return nil;
+    return res;
+  }
+
+  template <typename T1, typename T2>
+  left_iterator insert_impl(T1 &&l, T2 &&r) {
+    index_t left_parent, right_parent;
+    bool left_go, right_go;
+    if (!find_parent<true>(l, left_parent, left_go) ||
+        !find_parent<false>(r, right_parent, right_go))
+      return end_left();
+    if (nodes.size() >= nil)
+      throw std::length_error("compact_bimap is too large");
+    nodes.emplace_back(std::forward<T1>(l), std::forward<T2>(r));
+    // noexcept operations:
+    auto i = static_cast<index_t>(nodes.size() - 1);
+    attach<true>(i, left_parent, left_go);
+    attach<false>(i, right_parent, right_go);
+    return left_iterator(this, i);
+  }
+
+  template <bool IsLeft> iterator_t<IsLeft> erase_impl(iterator_t<IsLeft> it) {
+    auto next = this->next<IsLeft>(it.pos);
+    return iterator_t<IsLeft>(this, erase_at(it.pos, next));
+  }
+  template <bool IsLeft>
+  iterator_t<IsLeft> erase_range(iterator_t<IsLeft> f, iterator_t<IsLeft> l) {
+    while (f != l) {
+      // last pair may move to place of erased one
+      if (l.pos == nodes.size() - 1)
+        l.pos = f.pos;
+      f = erase_impl(f);
+    }
+    return f;
+  }
+  template <bool IsLeft> bool erase_key(key_t<IsLeft> const &k) {
+    auto i = find_index<IsLeft>(k);
+    if (i == nil)
+      return false;
+    erase_at(i, nil);
+    return true;
+  }
+
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &k) const {
+    auto i = find_index<IsLeft>(k);
+    if (i == nil)
+      throw std::out_of_range("at_left bad");
+    return key<!IsLeft>(i);
+  }
+
+  template <bool IsLeft>
+  iterator_t<IsLeft> upper_bound_impl(key_t<IsLeft> const &k) const {
+    auto i = find_ge<IsLeft>(k);
+    if (i != nil && !comparator<IsLeft>()(k, key<IsLeft>(i)))
+      i = next<IsLeft>(i);
+    return iterator_t<IsLeft>(this, i);
+  }
+
+public:
+  compact_bimap(CompareLeft cl = CompareLeft(),
+                CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)) {}
+
+  template <typename InputIt>
+  compact_bimap(InputIt first, InputIt last, CompareLeft cl = CompareLeft(),
+                CompareRight cr = CompareRight())
+      : compact_bimap(std::move(cl), std::move(cr)) {
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                                    typename std::iterator_traits<
+                                        InputIt>::iterator_category>)
+      reserve(std::distance(first, last));
+    for (; first != last; ++first)
+      insert(std::get<0>(*first), std::get<1>(*first));
+  }
+
+  void reserve(std::size_t n) { nodes.reserve(n); }
+  void shrink_to_fit() { nodes.shrink_to_fit(); }
+
+  void clear() noexcept {
+    nodes.clear();
+    roots[0] = roots[1] = nil;
+  }
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, extreme<true, true>());
+  }
+  left_iterator end_left() const noexcept { return left_iterator(this, nil); }
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, extreme<false, true>());
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, nil);
+  }
+
+  left_iterator insert(left_t const &a, right_t const &b) {
+    return insert_impl(a, b);
+  }
+  left_iterator insert(left_t const &a, right_t &&b) {
+    return insert_impl(a, std::move(b));
+  }
+  left_iterator insert(left_t &&a, right_t const &b) {
+    return insert_impl(std::move(a), b);
+  }
+  left_iterator insert(left_t &&a, right_t &&b) {
+    return insert_impl(std::move(a), std::move(b));
+  }
+
+  left_iterator erase_left(left_iterator it) { return erase_impl<true>(it); }
+  right_iterator erase_right(right_iterator it) {
+    return erase_impl<false>(it);
+  }
+  bool erase_left(left_t const &left) { return erase_key<true>(left); }
+  bool erase_right(right_t const &right) { return erase_key<false>(right); }
+  left_iterator erase_left(left_iterator f, left_iterator l) {
+    return erase_range<true>(f, l);
+  }
+  right_iterator erase_right(right_iterator f, right_iterator l) {
+    return erase_range<false>(f, l);
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(this, find_index<true>(left));
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(this, find_index<false>(right));
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(this, find_ge<true>(left));
+  }
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(this, find_ge<false>(right));
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return upper_bound_impl<true>(left);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return upper_bound_impl<false>(right);
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+  std::size_t size() const noexcept { return nodes.size(); }
+
+  // bytes used by storage
+  std::size_t memory_usage() const noexcept {
+    return nodes.capacity() * sizeof(node);
+  }
+
+  bool operator==(compact_bimap const &b) const {
+    if (size() != b.size())
+      return false;
+    auto const &l = comparator<true>();
+    auto const &r = comparator<false>();
+    for (auto it1 = begin_left(), it2 = b.begin_left(); it1 != end_left();
+         ++it1, ++it2)
+      if (bimap_helper::NotEqual(l, *it1, *it2) ||
+          bimap_helper::NotEqual(r, *it1.flip(), *it2.flip()))
+        return false;
+    return true;
+  }
+  bool operator!=(compact_bimap const &b) const { return !operator==(b); }
+};
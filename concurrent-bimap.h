@@ -0,0 +1,428 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avl.h"
+#include "bimap.h"
+#include "hash-index.h"
+#include "sharded-bimap.h"
+
+namespace bimap_helper {
+inline std::size_t hardware_threads() noexcept {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * reader-writer lock split into slot per hardware thread, each on its own
+ * cache line: reader locks only slot of its thread, so readers on
+ * different cores do not write to shared line. writer locks all slots
+ */
+class striped_shared_mutex {
+  struct alignas(64) slot {
+    std::shared_mutex mutex;
+  };
+  std::size_t count;
+  std::unique_ptr<slot[]> slots;
+
+  // threads are numbered in order of first lock, so they spread over slots
+  std::shared_mutex &own() noexcept {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t const id =
+        next.fetch_add(1, std::memory_order_relaxed);
+    return slots[id % count].mutex;
+  }
+
+public:
+  striped_shared_mutex()
+      : count(hardware_threads()), slots(new slot[count]) {}
+
+  void lock_shared() { own().lock_shared(); }
+  void unlock_shared() noexcept { own().unlock_shared(); }
+
+  void lock() {
+    for (std::size_t i = 0; i < count; i++)
+      slots[i].mutex.lock();
+  }
+  void unlock() noexcept {
+    for (std::size_t i = 0; i < count; i++)
+      slots[i].mutex.unlock();
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap for many threads, split into `count` shards by hash of left value
+ * as sharded_bimap is, one per hardware thread by default. each shard has
+ * striped reader-writer lock: lookups run in parallel with each other and
+ * with modifications of other shards, and readers on different cores do
+ * not write to common cache line. trees are avl, so lookups never
+ * restructure them and take only reader lock. each modification of pair is
+ * atomic for both sides, it locks every slot of its shard and stripe.
+ * results are returned by value, since elements may be erased right after
+ * lock is released
+ *
+ * right values are tracked by directory of as many stripes as there are
+ * shards, which maps each of them to shard holding its pair. lock order is
+ * shard (by index, if there are two), then stripe. operations which start
+ * from right value read directory first, release it and retry if pair
+ * moved meanwhile
+ *
+ * every shard and stripe takes a cache line per hardware thread
+ *
+ * shards allocate through copies of `Allocator` in parallel, so it must be
+ * thread safe (pool_allocator is not)
+ */
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Index = bimap_helper::no_index,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+class concurrent_bimap {
+public:
+  using map_t = bimap<Left, Right, CompareLeft, CompareRight, Allocator,
+                      avl::policy, Index>;
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  using entry = bimap_helper::shard_entry<Right>;
+  using mutex_t = bimap_helper::striped_shared_mutex;
+  using read_lock = std::shared_lock<mutex_t>;
+  using write_lock = std::unique_lock<mutex_t>;
+
+  struct alignas(64) shard {
+    mutable mutex_t mutex;
+    map_t map;
+    // avl trees are always balanced, so view never needs refreezing
+    typename map_t::frozen_view view;
+
+    shard() : view(map.freeze()) {}
+  };
+  struct alignas(64) stripe {
+    mutable mutex_t mutex;
+    bimap_helper::hash_table<entry> table;
+  };
+
+  std::size_t shard_count;
+  std::unique_ptr<shard[]> shards;
+  std::unique_ptr<stripe[]> stripes;
+  CompareLeft compare_left;
+  CompareRight compare_right;
+  HashLeft hash_left;
+  HashRight hash_right;
+
+  std::size_t shard_of(std::size_t h) const noexcept {
+    return bimap_helper::shard_of(h, shard_count);
+  }
+  std::size_t shard_of_left(left_t const &left) const {
+    return shard_of(hash_left(left));
+  }
+  stripe &stripe_of(std::size_t h) noexcept { return stripes[shard_of(h)]; }
+  stripe const &stripe_of(std::size_t h) const noexcept {
+    return stripes[shard_of(h)];
+  }
+
+  entry find_entry(stripe const &st, right_t const &right,
+                   std::size_t h) const {
+    return st.table.find(h, [&](entry e) {
+      return !compare_right(right, *e.right) &&
+             !compare_right(*e.right, right);
+    });
+  }
+
+  // shard holding `right` at the moment of call, `shard_count` if there is
+  // none
+  std::size_t locate(right_t const &right, std::size_t h) const {
+    auto &st = stripe_of(h);
+    read_lock lock(st.mutex);
+    auto e = find_entry(st, right, h);
+    return e.right == nullptr ? shard_count : e.shard;
+  }
+
+  template <typename Lock>
+  using right_iterator_t = std::conditional_t<
+      std::is_same_v<Lock, read_lock>,
+      decltype(std::declval<typename map_t::frozen_view const &>().end_right()),
+      typename map_t::right_iterator>;
+
+  /**
+   * calls `f(s, it)` with lock `Lock` of shard `s` holding `right`, `it`
+   * points to it in view (for readers) or map (for writers). returns
+   * std::nullopt if there is no such value
+   */
+  template <typename Lock, typename F>
+  auto with_right(right_t const &right, F const &f) const
+      -> std::optional<decltype(f(std::size_t(),
+                                  std::declval<right_iterator_t<Lock>>()))> {
+    auto h = hash_right(right);
+    for (;;) {
+      auto s = locate(right, h);
+      if (s == shard_count)
+        return std::nullopt;
+      auto &sh = shards[s];
+      Lock lock(sh.mutex);
+      if constexpr (std::is_same_v<Lock, read_lock>) {
+        auto it = sh.view.find_right(right);
+        if (it != sh.view.end_right())
+          return f(s, it);
+      } else {
+        auto it = sh.map.find_right(right);
+        if (it != sh.map.end_right())
+          return f(s, it);
+      }
+      // pair was erased or moved to other shard after directory was read
+    }
+  }
+
+  template <typename F> auto read_left(left_t const &left, F const &f) const {
+    auto &sh = shards[shard_of_left(left)];
+    read_lock lock(sh.mutex);
+    return f(sh.view, sh.view.find_left(left));
+  }
+
+public:
+  concurrent_bimap(CompareLeft cl = CompareLeft(),
+                   CompareRight cr = CompareRight(),
+                   Allocator const &alloc = Allocator(),
+                   HashLeft hl = HashLeft(), HashRight hr = HashRight(),
+                   std::size_t count = bimap_helper::hardware_threads())
+      : shard_count(std::max<std::size_t>(count, 1)),
+        shards(new shard[shard_count]), stripes(new stripe[shard_count]),
+        compare_left(cl), compare_right(cr), hash_left(std::move(hl)),
+        hash_right(std::move(hr)) {
+    // maps are assigned in place, so views keep pointing to them
+    for (std::size_t i = 0; i < shard_count; i++)
+      shards[i].map = map_t(cl, cr, alloc);
+  }
+
+  concurrent_bimap(concurrent_bimap const &) = delete;
+  concurrent_bimap &operator=(concurrent_bimap const &) = delete;
+
+  // returns false if pair clashes with existing one
+  bool insert(left_t left, right_t right) {
+    auto s = shard_of_left(left);
+    auto h = hash_right(right);
+    auto &sh = shards[s];
+    auto &st = stripe_of(h);
+    write_lock shard_lock(sh.mutex);
+    write_lock stripe_lock(st.mutex);
+    if (find_entry(st, right, h).right != nullptr)
+      return false;
+    // after this directory insertion can not throw
+    st.table.reserve(st.table.size() + 1);
+    auto it = sh.map.insert(std::move(left), std::move(right));
+    if (it == sh.map.end_left())
+      return false;
+    st.table.insert(entry{&*it.flip(), s}, h);
+    return true;
+  }
+
+  bool erase_left(left_t const &left) {
+    auto s = shard_of_left(left);
+    auto &sh = shards[s];
+    write_lock shard_lock(sh.mutex);
+    auto it = sh.map.find_left(left);
+    if (it == sh.map.end_left())
+      return false;
+    auto const &right = *it.flip();
+    auto h = hash_right(right);
+    auto &st = stripe_of(h);
+    write_lock stripe_lock(st.mutex);
+    st.table.erase(entry{&right, s}, h);
+    sh.map.erase_left(it);
+    return true;
+  }
+
+  bool erase_right(right_t const &right) {
+    auto erased = with_right<write_lock>(right, [&](std::size_t s, auto it) {
+      auto h = hash_right(right);
+      auto &st = stripe_of(h);
+      write_lock stripe_lock(st.mutex);
+      st.table.erase(entry{&*it, s}, h);
+      shards[s].map.erase_right(it);
+      return true;
+    });
+    return erased.has_value();
+  }
+
+  /**
+   * sets value mapped to `left`, returns false if there is no such pair or
+   * value belongs to another one. pair is erased if assignment throws
+   */
+  bool replace_right(left_t const &left, right_t right) {
+    auto s = shard_of_left(left);
+    auto &sh = shards[s];
+    write_lock shard_lock(sh.mutex);
+    auto it = sh.map.find_left(left);
+    if (it == sh.map.end_left())
+      return false;
+    auto const &old = *it.flip();
+    if (!compare_right(old, right) && !compare_right(right, old))
+      return true;
+    auto old_h = hash_right(old), h = hash_right(right);
+    auto i = shard_of(old_h);
+    auto j = shard_of(h);
+    write_lock first(stripes[std::min(i, j)].mutex), second;
+    if (i != j)
+      second = write_lock(stripes[std::max(i, j)].mutex);
+    if (find_entry(stripes[j], right, h).right != nullptr)
+      return false;
+    stripes[j].table.reserve(stripes[j].table.size() + 1);
+    // node stays, so does address of its right value
+    entry e{&old, s};
+    auto n = sh.map.size();
+    try {
+      sh.map.replace_right(it, std::move(right));
+    } catch (...) {
+      // failed assignment erases pair
+      if (sh.map.size() != n)
+        stripes[i].table.erase(e, old_h);
+      throw;
+    }
+    stripes[i].table.erase(e, old_h);
+    stripes[j].table.insert(e, h);
+    return true;
+  }
+
+  /**
+   * sets value mapped to `right`, pair moves to shard of new value. returns
+   * false if there is no such pair or value belongs to another one. pair is
+   * erased if assignment throws
+   */
+  bool replace_left(right_t const &right, left_t left) {
+    auto h = hash_right(right);
+    auto t = shard_of_left(left);
+    for (;;) {
+      auto s = locate(right, h);
+      if (s == shard_count)
+        return false;
+      write_lock first(shards[std::min(s, t)].mutex), second;
+      if (s != t)
+        second = write_lock(shards[std::max(s, t)].mutex);
+      auto &from = shards[s].map;
+      auto it = from.find_right(right);
+      // pair was erased or moved to other shard after directory was read
+      if (it == from.end_right())
+        continue;
+      if (s == t) {
+        auto &st = stripe_of(h);
+        write_lock stripe_lock(st.mutex);
+        entry e{&*it, s};
+        auto n = from.size();
+        try {
+          return from.replace_left(it, std::move(left));
+        } catch (...) {
+          if (from.size() != n)
+            st.table.erase(e, h);
+          throw;
+        }
+      }
+      auto &to = shards[t].map;
+      if (to.find_left(left) != to.end_left())
+        return false;
+      auto &st = stripe_of(h);
+      write_lock stripe_lock(st.mutex);
+      entry e{&*it, s};
+      // pair is gone once extracted, unless it is inserted to `to`
+      try {
+        auto handle = from.extract_right(it);
+        handle.left() = std::move(left);
+        // left value is new to `to` and right one is unique globally
+        to.insert(std::move(handle));
+      } catch (...) {
+        st.table.erase(e, h);
+        throw;
+      }
+      st.table.relocate(e, entry{e.right, t}, h);
+      return true;
+    }
+  }
+
+  void clear() {
+    for (std::size_t i = 0; i < shard_count; i++)
+      shards[i].mutex.lock();
+    for (std::size_t i = 0; i < shard_count; i++)
+      stripes[i].mutex.lock();
+    for (std::size_t i = 0; i < shard_count; i++) {
+      stripes[i].table.clear();
+      stripes[i].mutex.unlock();
+    }
+    for (std::size_t i = 0; i < shard_count; i++) {
+      shards[i].map.clear();
+      shards[i].mutex.unlock();
+    }
+  }
+
+  std::optional<right_t> find_left(left_t const &left) const {
+    return read_left(left, [](auto const &v, auto it) {
+      return it == v.end_left() ? std::nullopt
+                                : std::optional<right_t>(*it.flip());
+    });
+  }
+  std::optional<left_t> find_right(right_t const &right) const {
+    return with_right<read_lock>(
+        right, [](std::size_t, auto it) { return *it.flip(); });
+  }
+
+  bool contains_left(left_t const &left) const {
+    return read_left(left,
+                     [](auto const &v, auto it) { return it != v.end_left(); });
+  }
+  // directory alone is enough, it changes together with shards
+  bool contains_right(right_t const &right) const {
+    return locate(right, hash_right(right)) != shard_count;
+  }
+
+  /**
+   * sum of shard sizes, each read under its own lock, so it is exact only
+   * when there are no concurrent modifications
+   */
+  std::size_t size() const {
+    std::size_t res = 0;
+    for (std::size_t i = 0; i < shard_count; i++) {
+      read_lock lock(shards[i].mutex);
+      res += shards[i].view.size();
+    }
+    return res;
+  }
+  bool empty() const { return size() == 0; }
+
+  /**
+   * calls `f(left, right)` for every pair in order of left values, shards
+   * are merged under reader locks of all of them, so `f` must not modify
+   * this bimap
+   */
+  template <typename F> void for_each(F f) const {
+    std::vector<read_lock> locks;
+    std::vector<decltype(shards[0].view.begin_left())> its;
+    locks.reserve(shard_count);
+    its.reserve(shard_count);
+    for (std::size_t i = 0; i < shard_count; i++) {
+      locks.emplace_back(shards[i].mutex);
+      its.push_back(shards[i].view.begin_left());
+    }
+    for (;;) {
+      std::size_t best = shard_count;
+      for (std::size_t i = 0; i < shard_count; i++)
+        if (its[i] != shards[i].view.end_left() &&
+            (best == shard_count || compare_left(*its[i], *its[best])))
+          best = i;
+      if (best == shard_count)
+        return;
+      f(*its[best], *its[best].flip());
+      ++its[best];
+    }
+  }
+};
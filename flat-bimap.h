@@ -0,0 +1,519 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bimap.h"
+#include "simd-search.h"
+
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct flat_bimap;
+
+namespace bimap_helper {
+template <typename T> inline void prefetch(T const *p) noexcept {
+#if defined(__GNUC__)
+  __builtin_prefetch(p);
+#else
+  (void)p;
+#endif
+}
+
+// allocates arrays starting at cache line
+template <typename T> struct cache_aligned_allocator {
+  using value_type = T;
+  static constexpr std::size_t alignment =
+      alignof(T) > 64 ? alignof(T) : std::size_t(64);
+
+  cache_aligned_allocator() = default;
+  template <typename U>
+  cache_aligned_allocator(cache_aligned_allocator<U> const &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignment)));
+  }
+  void deallocate(T *p, std::size_t) noexcept {
+    ::operator delete(p, std::align_val_t(alignment));
+  }
+
+  template <typename U>
+  bool operator==(cache_aligned_allocator<U> const &) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(cache_aligned_allocator<U> const &) const noexcept {
+    return false;
+  }
+};
+
+/**
+ * layouts of sorted array of `n` values for flat_bimap. position of value
+ * is what iterator holds, slot is its index in array. values occupy slots
+ * `[0, n)` in both layouts, btree one pads array up to whole block
+ *
+ * eytzinger (breadth first) layout: node `k` has children `2k` and
+ * `2k + 1`, root is 1 and end is 0. first levels share cache lines and
+ * descendants of node are adjacent, so they can be prefetched
+ */
+template <typename Key, typename Index> struct eytzinger_layout {
+  static constexpr bool padded = false;
+
+  static Index end(Index) noexcept { return 0; }
+  static std::size_t slot(Index k) noexcept { return k - 1; }
+  static std::size_t capacity(Index n) noexcept { return n; }
+
+  static Index first(Index n) noexcept {
+    if (n == 0)
+      return 0;
+    Index k = 1;
+    while (2 * k <= n)
+      k = 2 * k;
+    return k;
+  }
+  static Index next(Index k, Index n) noexcept {
+    if (2 * k + 1 <= n) {
+      k = 2 * k + 1;
+      while (2 * k <= n)
+        k = 2 * k;
+      return k;
+    }
+    // climb while `k` is right child
+    while (k & 1)
+      k >>= 1;
+    return k >> 1;
+  }
+  static Index prev(Index k, Index n) noexcept {
+    if (k == 0) {
+      if (n == 0)
+        return 0;
+      k = 1;
+      while (2 * k + 1 <= n)
+        k = 2 * k + 1;
+      return k;
+    }
+    if (2 * k <= n) {
+      k = 2 * k;
+      while (2 * k + 1 <= n)
+        k = 2 * k + 1;
+      return k;
+    }
+    while (k != 0 && !(k & 1))
+      k >>= 1;
+    return k >> 1;
+  }
+
+  /**
+   * first value which is not less than `x` (greater than `x`, if `Upper`).
+   * descent goes right while value is less, bits of final `k` after the
+   * last zero are right turns taken since the last left one, which is the
+   * answer
+   */
+  template <bool Upper, typename C>
+  static Index bound(Key const *keys, Index n, Key const &x, C const &c) {
+    // descendants of `k` four levels below start at `16k`, for small keys
+    // they share cache line
+    constexpr Index ahead = sizeof(Key) <= 4 ? 16 : sizeof(Key) <= 8 ? 8 : 0;
+    Index k = 1;
+    while (k <= n) {
+      if constexpr (ahead != 0)
+        if (ahead * k <= n)
+          prefetch(keys + (ahead * k - 1));
+      auto const &v = keys[k - 1];
+      k = 2 * k + static_cast<Index>(Upper ? !c(x, v) : c(v, x));
+    }
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while (k & 1)
+      k >>= 1;
+    return k >> 1;
+#endif
+  }
+};
+
+/**
+ * implicit b-tree layout: blocks of `B` values fill cache line, block `k`
+ * has children `k * (B + 1) + i + 1` for `i` in `[0, B]`, position is slot
+ * and end is `n`. block is searched by vector comparisons, see block_rank,
+ * so it is used only for arithmetic values ordered by `<`
+ */
+template <typename Key, typename Index> struct btree_layout {
+  static constexpr bool padded = true;
+  static constexpr std::size_t B = 64 / sizeof(Key);
+
+  // never less than any value, so padding does not change ranks in block
+  static Key padding() noexcept {
+    if constexpr (std::numeric_limits<Key>::has_infinity)
+      return std::numeric_limits<Key>::infinity();
+    else
+      return std::numeric_limits<Key>::max();
+  }
+
+  static Index end(Index n) noexcept { return n; }
+  static std::size_t slot(Index p) noexcept { return p; }
+  static std::size_t blocks(Index n) noexcept { return (n + B - 1) / B; }
+  static std::size_t capacity(Index n) noexcept { return blocks(n) * B; }
+
+  static std::size_t child(std::size_t k, std::size_t i) noexcept {
+    return k * (B + 1) + i + 1;
+  }
+  // the last value of block, block with children is full
+  static Index last_in(std::size_t k, Index n) noexcept {
+    auto last = (k + 1) * B - 1;
+    return static_cast<Index>(last < n ? last : n - 1);
+  }
+  static Index leftmost(std::size_t k, Index n) noexcept {
+    while (child(k, 0) < blocks(n))
+      k = child(k, 0);
+    return static_cast<Index>(k * B);
+  }
+  static Index rightmost(std::size_t k, Index n) noexcept {
+    while (child(k, B) < blocks(n))
+      k = child(k, B);
+    return last_in(k, n);
+  }
+
+  static Index first(Index n) noexcept {
+    return n == 0 ? 0 : leftmost(0, n);
+  }
+  static Index next(Index p, Index n) noexcept {
+    std::size_t k = p / B, i = p % B;
+    if (child(k, i + 1) < blocks(n))
+      return leftmost(child(k, i + 1), n);
+    if (i + 1 < B && p + 1 < n)
+      return p + 1;
+    // climb while block is the last child
+    while (k != 0) {
+      auto j = (k - 1) % (B + 1);
+      k = (k - 1) / (B + 1);
+      if (j < B)
+        return static_cast<Index>(k * B + j);
+    }
+    return n;
+  }
+  static Index prev(Index p, Index n) noexcept {
+    if (p == n)
+      return n == 0 ? 0 : rightmost(0, n);
+    std::size_t k = p / B, i = p % B;
+    if (child(k, i) < blocks(n))
+      return rightmost(child(k, i), n);
+    if (i > 0)
+      return p - 1;
+    // climb while block is the first child
+    while (k != 0) {
+      auto j = (k - 1) % (B + 1);
+      k = (k - 1) / (B + 1);
+      if (j > 0)
+        return static_cast<Index>(k * B + j - 1);
+    }
+    return n;
+  }
+
+  /**
+   * rank of `x` in block tells both the candidate answer in it and the
+   * child to descend into, deeper candidates are better
+   */
+  template <bool Upper, typename C>
+  static Index bound(Key const *keys, Index n, Key const &x, C const &) {
+    std::size_t res = n, total = blocks(n);
+    for (std::size_t k = 0; k < total;) {
+      std::size_t i = block_rank<Upper, B>(keys + k * B, x);
+      auto p = k * B + i;
+      res = i < B && p < n ? p : res;
+      k = child(k, i);
+    }
+    return static_cast<Index>(res);
+  }
+};
+
+/**
+ * iterator of flat_bimap, holds position of value in layout of its side
+ */
+template <typename Map, bool IsLeft> struct flat_bimap_iterator {
+private:
+  using index_t = typename Map::index_t;
+  using layout = typename Map::template layout_t<IsLeft>;
+
+  Map const *map;
+  index_t pos;
+
+public:
+  using value_type =
+      std::conditional_t<IsLeft, typename Map::left_t, typename Map::right_t>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  friend Map;
+
+  flat_bimap_iterator() = default;
+  flat_bimap_iterator(Map const *map, index_t pos) noexcept
+      : map(map), pos(pos) {}
+
+  pointer_type operator->() const noexcept {
+    return &map->template key<IsLeft>(pos);
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  flat_bimap_iterator &operator++() noexcept {
+    pos = layout::next(pos, map->count);
+    return *this;
+  }
+  flat_bimap_iterator operator++(int) noexcept {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+  flat_bimap_iterator &operator--() noexcept {
+    pos = layout::prev(pos, map->count);
+    return *this;
+  }
+  flat_bimap_iterator operator--(int) noexcept {
+    auto copy = *this;
+    operator--();
+    return copy;
+  }
+
+  auto flip() const noexcept {
+    return flat_bimap_iterator<Map, !IsLeft>(
+        map, map->template cross<IsLeft>(pos));
+  }
+
+  bool operator==(flat_bimap_iterator const &r) const noexcept {
+    return pos == r.pos;
+  }
+  bool operator!=(flat_bimap_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * immutable bimap for tables which are built once and then only queried.
+ * values of each side are stored in one cache aligned array, lookup is
+ * descent without branches on comparison results. arithmetic values
+ * ordered by std::less use implicit b-tree with blocks searched by simd
+ * instructions, other ones use eytzinger layout, which prefetches nodes
+ * few levels below while comparing. sides are linked by arrays of indices.
+ * holds less than 2^31 pairs, so children indices fit into 32 bits
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+struct flat_bimap
+    : private bimap_helper::tagged_comparator<CompareLeft>,
+      private bimap_helper::tagged_comparator<
+          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>> {
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_iterator = bimap_helper::flat_bimap_iterator<flat_bimap, true>;
+  using right_iterator = bimap_helper::flat_bimap_iterator<flat_bimap, false>;
+
+private:
+  template <typename, bool> friend struct bimap_helper::flat_bimap_iterator;
+
+  using left_comparator_holder = bimap_helper::tagged_comparator<CompareLeft>;
+  using right_comparator_holder = bimap_helper::tagged_comparator<
+      CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>;
+
+  using index_t = std::uint32_t;
+
+  template <bool IsLeft> using key_t = std::conditional_t<IsLeft, Left, Right>;
+  template <bool IsLeft>
+  using compare_t = std::conditional_t<IsLeft, CompareLeft, CompareRight>;
+  template <bool IsLeft>
+  using layout_t = std::conditional_t<
+      bimap_helper::plain_less_v<key_t<IsLeft>, compare_t<IsLeft>>,
+      bimap_helper::btree_layout<key_t<IsLeft>, index_t>,
+      bimap_helper::eytzinger_layout<key_t<IsLeft>, index_t>>;
+  template <typename T>
+  using storage_t = std::vector<T, bimap_helper::cache_aligned_allocator<T>>;
+
+  index_t count = 0;
+  storage_t<Left> lefts;
+  storage_t<Right> rights;
+  // position of pair in other side, by slot
+  std::vector<index_t> cross_index[2];
+
+  template <bool IsLeft> auto &keys() noexcept {
+    if constexpr (IsLeft)
+      return lefts;
+    else
+      return rights;
+  }
+  template <bool IsLeft> auto const &keys() const noexcept {
+    if constexpr (IsLeft)
+      return lefts;
+    else
+      return rights;
+  }
+  template <bool IsLeft> auto const &key(index_t p) const noexcept {
+    return keys<IsLeft>()[layout_t<IsLeft>::slot(p)];
+  }
+  template <bool IsLeft> index_t cross(index_t p) const noexcept {
+    if (p == layout_t<IsLeft>::end(count))
+      return layout_t<!IsLeft>::end(count);
+    return cross_index[IsLeft ? 0 : 1][layout_t<IsLeft>::slot(p)];
+  }
+  template <bool IsLeft> auto const &comparator() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<CompareLeft const &>(
+          static_cast<left_comparator_holder const &>(*this));
+    else
+      return static_cast<CompareRight const &>(
+          static_cast<right_comparator_holder const &>(*this));
+  }
+
+  template <bool IsLeft, bool Upper>
+  index_t bound(key_t<IsLeft> const &x) const {
+    return layout_t<IsLeft>::template bound<Upper>(
+        keys<IsLeft>().data(), count, x, comparator<IsLeft>());
+  }
+  template <bool IsLeft> index_t find_index(key_t<IsLeft> const &x) const {
+    auto p = bound<IsLeft, false>(x);
+    if (p != layout_t<IsLeft>::end(count) &&
+        comparator<IsLeft>()(x, key<IsLeft>(p)))
+      return layout_t<IsLeft>::end(count);
+    return p;
+  }
+
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &x) const {
+    auto p = find_index<IsLeft>(x);
+    if (p == layout_t<IsLeft>::end(count))
+      throw std::out_of_range("at_left bad");
+    return key<!IsLeft>(cross<IsLeft>(p));
+  }
+
+  /**
+   * fills array of side from values in sorted order, returns position of
+   * value by its rank
+   */
+  template <bool IsLeft>
+  std::vector<index_t> place(std::vector<key_t<IsLeft> const *> const &v) {
+    using layout = layout_t<IsLeft>;
+    std::vector<index_t> pos;
+    pos.reserve(count);
+    for (auto p = layout::first(count); p != layout::end(count);
+         p = layout::next(p, count))
+      pos.push_back(p);
+    std::vector<index_t> rank(count);
+    for (index_t i = 0; i < count; i++)
+      rank[layout::slot(pos[i])] = i;
+    auto &k = keys<IsLeft>();
+    k.reserve(layout::capacity(count));
+    for (index_t s = 0; s < count; s++)
+      k.push_back(*v[rank[s]]);
+    if constexpr (layout::padded)
+      k.resize(layout::capacity(count), layout::padding());
+    return pos;
+  }
+
+public:
+  /**
+   * builds from `map` (bimap or other container with the same ordering and
+   * iterators with `flip`, see bimap_helper::left_ranks)
+   */
+  template <typename Map, typename = decltype(std::declval<Map const &>()
+                                                  .begin_right()
+                                                  .flip())>
+  explicit flat_bimap(Map const &map, CompareLeft cl = CompareLeft(),
+                      CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)) {
+    auto left_of_right = bimap_helper::left_ranks<index_t>(map);
+    if (left_of_right.size() > std::numeric_limits<index_t>::max() / 2)
+      throw std::length_error("flat_bimap: too many pairs");
+    count = static_cast<index_t>(left_of_right.size());
+    std::vector<Left const *> left_values;
+    left_values.reserve(count);
+    for (auto it = map.begin_left(); it != map.end_left(); ++it)
+      left_values.push_back(&*it);
+    std::vector<Right const *> right_values;
+    right_values.reserve(count);
+    for (auto it = map.begin_right(); it != map.end_right(); ++it)
+      right_values.push_back(&*it);
+
+    auto left_pos = place<true>(left_values);
+    auto right_pos = place<false>(right_values);
+    cross_index[0].resize(count);
+    cross_index[1].resize(count);
+    for (index_t i = 0; i < count; i++) {
+      auto l = left_pos[left_of_right[i]], r = right_pos[i];
+      cross_index[0][layout_t<true>::slot(l)] = r;
+      cross_index[1][layout_t<false>::slot(r)] = l;
+    }
+  }
+
+  /**
+   * pairs which clash with previous ones are skipped, as with
+   * `bimap::insert`
+   */
+  template <typename InputIt>
+  flat_bimap(InputIt first, InputIt last, CompareLeft cl = CompareLeft(),
+             CompareRight cr = CompareRight())
+      : flat_bimap(bimap<Left, Right, CompareLeft, CompareRight>(first, last,
+                                                                 cl, cr),
+                   cl, cr) {}
+
+  left_iterator begin_left() const noexcept {
+    return left_iterator(this, layout_t<true>::first(count));
+  }
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, layout_t<true>::end(count));
+  }
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, layout_t<false>::first(count));
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, layout_t<false>::end(count));
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(this, find_index<true>(left));
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(this, find_index<false>(right));
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(this, bound<true, false>(left));
+  }
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(this, bound<false, false>(right));
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return left_iterator(this, bound<true, true>(left));
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return right_iterator(this, bound<false, true>(right));
+  }
+
+  std::size_t size() const noexcept { return count; }
+  bool empty() const noexcept { return count == 0; }
+
+  std::size_t memory_usage() const noexcept {
+    return lefts.capacity() * sizeof(Left) +
+           rights.capacity() * sizeof(Right) +
+           (cross_index[0].capacity() + cross_index[1].capacity()) *
+               sizeof(index_t);
+  }
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "splay.h"
+
+namespace bimap_helper {
+/**
+ * open addressing table of handles with linear probing and backward shift
+ * deletion. table knows nothing about keys: it stores handles with their
+ * hashes, equality is checked by callback. default constructed handle marks
+ * empty slot
+ */
+template <typename Handle, typename HashT = std::size_t> class hash_table {
+  struct slot {
+    Handle handle{};
+    HashT hash{};
+  };
+
+  std::vector<slot> slots;
+  std::size_t count = 0;
+  unsigned shift = 64;
+
+  // fibonacci hashing, weak hashes (like identity for ints) are fine
+  std::size_t home(HashT h) const noexcept {
+    return static_cast<std::size_t>(
+        (static_cast<std::uint64_t>(h) * 0x9E3779B97F4A7C15ull) >> shift);
+  }
+  std::size_t mask() const noexcept { return slots.size() - 1; }
+
+  void rehash(std::size_t capacity) {
+    std::vector<slot> old(capacity);
+    old.swap(slots);
+    shift = 64;
+    for (auto c = capacity; c > 1; c >>= 1)
+      shift--;
+    for (auto const &s : old)
+      if (s.handle != Handle{})
+        place(s);
+  }
+
+  void place(slot const &s) noexcept {
+    auto i = home(s.hash);
+    while (slots[i].handle != Handle{})
+      i = (i + 1) & mask();
+    slots[i] = s;
+  }
+
+  template <typename F> std::size_t find_slot(HashT h, F const &eq) const {
+    if (slots.empty())
+      return slots.size();
+    for (auto i = home(h);; i = (i + 1) & mask()) {
+      auto const &s = slots[i];
+      if (s.handle == Handle{})
+        return slots.size();
+      if (s.hash == h && eq(s.handle))
+        return i;
+    }
+  }
+
+public:
+  std::size_t size() const noexcept { return count; }
+
+  void reserve(std::size_t n) {
+    // load factor is kept below 3/4
+    std::size_t capacity = 8;
+    while (capacity * 3 < n * 4)
+      capacity *= 2;
+    if (capacity > slots.size())
+      rehash(capacity);
+  }
+
+  /**
+   * returns handle for which `eq` holds or empty one
+   */
+  template <typename F> Handle find(std::size_t h, F const &eq) const {
+    auto i = find_slot(static_cast<HashT>(h), eq);
+    return i == slots.size() ? Handle{} : slots[i].handle;
+  }
+
+  // handle must not be present
+  void insert(Handle handle, std::size_t h) {
+    if ((count + 1) * 4 > slots.size() * 3)
+      rehash(slots.empty() ? 8 : slots.size() * 2);
+    place(slot{handle, static_cast<HashT>(h)});
+    count++;
+  }
+
+  bool erase(Handle handle, std::size_t h) noexcept {
+    auto i = find_slot(static_cast<HashT>(h),
+                       [&](Handle got) { return got == handle; });
+    if (i == slots.size())
+      return false;
+    count--;
+    // backward shift, so no tombstones are needed
+    for (auto j = (i + 1) & mask(); slots[j].handle != Handle{};
+         j = (j + 1) & mask()) {
+      auto k = home(slots[j].hash);
+      if (((j - k) & mask()) >= ((j - i) & mask())) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = slot{};
+    return true;
+  }
+
+  // handle of element changed, but not its hash
+  void relocate(Handle from, Handle to, std::size_t h) noexcept {
+    auto i = find_slot(static_cast<HashT>(h),
+                       [&](Handle got) { return got == from; });
+    if (i != slots.size())
+      slots[i].handle = to;
+  }
+
+  // maps every handle, hashes are kept
+  template <typename F> void remap(F const &f) {
+    for (auto &s : slots)
+      if (s.handle != Handle{})
+        s.handle = f(s.handle);
+  }
+
+  void clear() noexcept {
+    slots.clear();
+    slots.shrink_to_fit();
+    count = 0;
+    shift = 64;
+  }
+
+  std::size_t memory_usage() const noexcept {
+    return slots.capacity() * sizeof(slot);
+  }
+
+  friend void swap(hash_table &a, hash_table &b) noexcept {
+    using std::swap;
+    swap(a.slots, b.slots);
+    swap(a.count, b.count);
+    swap(a.shift, b.shift);
+  }
+};
+
+/**
+ * bimap index policy: exact lookups on side with non void hash go through
+ * hash table of nodes instead of tree descent. ordered operations still use
+ * trees
+ */
+template <typename HashLeft, typename HashRight> struct hash_index {
+  using hash_left = HashLeft;
+  using hash_right = HashRight;
+};
+using no_index = hash_index<void, void>;
+
+// hash table of nodes for one side of bimap
+template <typename Node, typename Holder, typename Hash>
+struct side_index : private Hash {
+  using key_t = typename Holder::value_type;
+
+  hash_table<Node const *> table;
+
+  std::size_t hash(key_t const &key) const {
+    return static_cast<Hash const &>(*this)(key);
+  }
+  std::size_t hash(Node const *node) const {
+    return hash(node->template get_node<Holder>()->data);
+  }
+
+  template <typename C>
+  Node const *find(key_t const &key, C const &c) const
+      noexcept(std::is_nothrow_invocable_v<Hash const &, key_t const &>
+                   &&is_nothrow_comparable_v<key_t, C>) {
+    return table.find(hash(key), [&](Node const *node) {
+      auto const &data = node->template get_node<Holder>()->data;
+      return !c(key, data) && !c(data, key);
+    });
+  }
+  void insert(Node const *node) { table.insert(node, hash(node)); }
+  void insert(Node const *node, std::size_t h) { table.insert(node, h); }
+  void erase(Node const *node) noexcept { table.erase(node, hash(node)); }
+};
+template <typename Node, typename Holder>
+struct side_index<Node, Holder, void> {
+  template <typename C>
+  Node const *find(typename Holder::value_type const &, C const &) const
+      noexcept {
+    return nullptr;
+  }
+  void insert(Node const *) {}
+  void erase(Node const *) noexcept {}
+};
+
+template <typename Node, typename Index> struct node_index {
+  using left_index =
+      side_index<Node, typename Node::left_holder, typename Index::hash_left>;
+  using right_index =
+      side_index<Node, typename Node::right_holder, typename Index::hash_right>;
+
+  template <typename Holder>
+  static constexpr bool indexed_v = !std::is_void_v<std::conditional_t<
+      std::is_same_v<Holder, typename Node::left_holder>,
+      typename Index::hash_left, typename Index::hash_right>>;
+  static constexpr bool any_indexed_v =
+      indexed_v<typename Node::left_holder> ||
+      indexed_v<typename Node::right_holder>;
+
+  left_index left;
+  right_index right;
+
+  template <typename Holder> auto const &get() const noexcept {
+    if constexpr (std::is_same_v<Holder, typename Node::left_holder>)
+      return left;
+    else
+      return right;
+  }
+
+  void insert(Node const *node) {
+    left.insert(node);
+    try {
+      right.insert(node);
+    } catch (...) {
+      left.erase(node);
+      throw;
+    }
+  }
+  void erase(Node const *node) noexcept {
+    left.erase(node);
+    right.erase(node);
+  }
+  /**
+   * index of one side, for values that change in place. hash of new value is
+   * computed before the change, reinsertion after `erase_side` of the same
+   * node finds room in table, so it neither hashes nor allocates
+   */
+  template <typename Holder>
+  std::size_t hash_side(typename Holder::value_type const &value) const {
+    if constexpr (!indexed_v<Holder>)
+      return 0;
+    else if constexpr (std::is_same_v<Holder, typename Node::left_holder>)
+      return left.hash(value);
+    else
+      return right.hash(value);
+  }
+  template <typename Holder>
+  void insert_side(Node const *node, std::size_t h) noexcept {
+    if constexpr (!indexed_v<Holder>)
+      return;
+    else if constexpr (std::is_same_v<Holder, typename Node::left_holder>)
+      left.insert(node, h);
+    else
+      right.insert(node, h);
+  }
+  template <typename Holder> void erase_side(Node const *node) noexcept {
+    if constexpr (std::is_same_v<Holder, typename Node::left_holder>)
+      left.erase(node);
+    else
+      right.erase(node);
+  }
+  void clear() noexcept {
+    if constexpr (indexed_v<typename Node::left_holder>)
+      left.table.clear();
+    if constexpr (indexed_v<typename Node::right_holder>)
+      right.table.clear();
+  }
+  void reserve(std::size_t n) {
+    if constexpr (indexed_v<typename Node::left_holder>)
+      left.table.reserve(n);
+    if constexpr (indexed_v<typename Node::right_holder>)
+      right.table.reserve(n);
+  }
+  template <typename F> void remap(F const &f) {
+    if constexpr (indexed_v<typename Node::left_holder>)
+      left.table.remap(f);
+    if constexpr (indexed_v<typename Node::right_holder>)
+      right.table.remap(f);
+  }
+  friend void swap(node_index &a, node_index &b) noexcept {
+    using std::swap;
+    if constexpr (indexed_v<typename Node::left_holder>)
+      swap(a.left.table, b.left.table);
+    if constexpr (indexed_v<typename Node::right_holder>)
+      swap(a.right.table, b.right.table);
+  }
+};
+
+// empty, so bimap without index does not pay for it
+template <typename Node> struct node_index<Node, no_index> {
+  template <typename Holder> static constexpr bool indexed_v = false;
+  static constexpr bool any_indexed_v = false;
+
+  template <typename Holder>
+  side_index<Node, Holder, void> get() const noexcept {
+    return {};
+  }
+
+  void insert(Node const *) noexcept {}
+  void erase(Node const *) noexcept {}
+  template <typename Holder>
+  std::size_t hash_side(typename Holder::value_type const &) const noexcept {
+    return 0;
+  }
+  template <typename Holder>
+  void insert_side(Node const *, std::size_t) noexcept {}
+  template <typename Holder> void erase_side(Node const *) noexcept {}
+  void clear() noexcept {}
+  void reserve(std::size_t) noexcept {}
+  template <typename F> void remap(F const &) noexcept {}
+  friend void swap(node_index &, node_index &) noexcept {}
+};
+} // namespace bimap_helper
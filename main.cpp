@@ -1,7 +1,19 @@
 #include "bimap.h"
+#include "btree-bimap.h"
+#include "compact-bimap.h"
+#include "concurrent-bimap.h"
+#include "flat-bimap.h"
+#include "mapped-bimap.h"
+#include "persistent-bimap.h"
+#include "sharded-bimap.h"
+#include "unordered-bimap.h"
 
 #include "gtest/gtest.h"
+#include <atomic>
 #include <random>
+#include <sstream>
+#include <string_view>
+#include <thread>
 
 struct test_object {
   int a = 0;
@@ -103,6 +115,26 @@ TEST(bimap, copies) {
   EXPECT_NE(b.find_right(-10), b.end_right());
 }
 
+TEST(bimap, copy_keeps_structure) {
+  bimap<int, std::string> b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(i * 3 % 1000, std::to_string(i));
+  b.find_left(500);
+  b.find_right("7");
+  bimap<int, std::string> b1(b);
+  EXPECT_EQ(b, b1);
+  EXPECT_EQ(b1.at_left(21), "7");
+  EXPECT_EQ(*--b1.end_right(), "999");
+
+  bimap<int, std::string> b2;
+  b2.insert(1, "1");
+  b2 = b1;
+  b1.erase_left(21);
+  EXPECT_EQ(b2.at_right("7"), 21);
+  EXPECT_EQ(b2.size(), 1000);
+  EXPECT_EQ(b1.size(), 999);
+}
+
 TEST(bimap, insert) {
   bimap<int, int> b;
   b.insert(4, 10);
@@ -273,6 +305,187 @@ TEST(bimap, upper_bound) {
   EXPECT_EQ(b.upper_bound_left(400), b.end_left());
 }
 
+TEST(bimap, iterate_from_splayed_away) {
+  bimap<int, int> b;
+  for (int i = 0; i < 5; i++)
+    b.insert(i, -i);
+  auto it = b.find_left(4);
+  b.find_left(0);
+  EXPECT_EQ(++it, b.end_left());
+}
+
+TEST(bimap, frozen_view) {
+  bimap<int, int> b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(i, 1000 - i);
+  auto view = b.freeze();
+  EXPECT_EQ(view.size(), 1000);
+  EXPECT_EQ(view.at_left(10), 990);
+  EXPECT_EQ(view.at_right(10), 990);
+  EXPECT_THROW(view.at_left(1000), std::out_of_range);
+  EXPECT_EQ(view.find_right(-1), view.end_right());
+  EXPECT_EQ(*view.lower_bound_left(-5), 0);
+  EXPECT_EQ(*view.upper_bound_right(999), 1000);
+  EXPECT_EQ(*view.find_left(3).flip(), 997);
+  EXPECT_EQ(*--view.end_left(), 999);
+
+  int expected = 0;
+  for (auto it = view.begin_left(); it != view.end_left(); ++it)
+    EXPECT_EQ(*it, expected++);
+  EXPECT_EQ(expected, 1000);
+  expected = 1;
+  for (auto it = view.begin_right(); it != view.end_right(); ++it)
+    EXPECT_EQ(*it, expected++);
+
+  // still usable as usual
+  b.insert(-1, -1);
+  EXPECT_EQ(b.at_left(-1), -1);
+  EXPECT_EQ(b.size(), 1001);
+}
+
+TEST(bimap, frozen_view_threads) {
+  bimap<int, int> b;
+  for (int i = 0; i < 10000; i++)
+    b.insert(i, i * 2);
+  auto view = b.freeze();
+  std::vector<std::thread> readers;
+  std::atomic<int> errors{0};
+  for (int t = 0; t < 4; t++)
+    readers.emplace_back([&, t] {
+      for (int i = t; i < 10000; i += 4)
+        if (view.at_left(i) != i * 2 || view.at_right(i * 2) != i)
+          errors++;
+    });
+  for (auto &t : readers)
+    t.join();
+  EXPECT_EQ(errors, 0);
+}
+
+template <typename L, typename R>
+using pool_bimap =
+    bimap<L, R, std::less<L>, std::less<R>,
+          bimap_helper::pool_allocator<std::pair<L, R>, 16>>;
+
+TEST(bimap, pool_allocator) {
+  pool_bimap<int, int> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, 100 - i);
+  for (int i = 0; i < 100; i += 2)
+    EXPECT_TRUE(b.erase_left(i));
+  for (int i = 100; i < 150; i++)
+    b.insert(i, -i);
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.at_left(51), 49);
+  EXPECT_EQ(b.at_right(-120), 120);
+
+  pool_bimap<int, int> b1(b);
+  EXPECT_EQ(b, b1);
+  // copy gets its own pool, so it may be handed to other thread
+  EXPECT_NE(b.get_allocator(), b1.get_allocator());
+  b.clear();
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b1.size(), 100);
+  b.insert(1, 1);
+  b = std::move(b1);
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.at_left(149), -149);
+
+  // bimaps given the same allocator share the pool, so nodes change owner
+  // without copying
+  b1 = pool_bimap<int, int>({}, {}, b.get_allocator());
+  EXPECT_EQ(b.get_allocator(), b1.get_allocator());
+  auto const *address = &*b.find_left(149);
+  auto [lower, upper] = b.split_left(120);
+  EXPECT_EQ(&*upper.find_left(149), address);
+  lower.merge(std::move(upper));
+  EXPECT_EQ(&*lower.find_left(149), address);
+  auto handle = lower.extract_left(lower.find_left(149));
+  EXPECT_EQ(&*b1.insert(std::move(handle)), address);
+  EXPECT_EQ(b1.size(), 1);
+  lower.clear();
+  EXPECT_EQ(b1.at_right(-149), 149);
+}
+
+TEST(bimap, pool_allocator_release_after_move) {
+  pool_bimap<int, int> b;
+  auto const *first = &*b.insert(0, 0);
+  for (int i = 1; i < 100; i++)
+    b.insert(i, -i);
+  auto alloc = b.get_allocator();
+  auto used = alloc.memory_usage();
+  {
+    pool_bimap<int, int> moved(std::move(b));
+    pool_bimap<int, int> sharing({}, {}, alloc);
+    sharing.insert(-1, 1);
+    // `sharing` holds a block, so nodes are freed one by one
+    moved.clear();
+    EXPECT_NE(&*moved.insert(0, 0), first);
+    sharing.clear();
+    moved.clear();
+    for (int i = 0; i < 100; i++)
+      moved.insert(i, -i);
+    // moved bimap holds every block, so clear resets whole pool and refill
+    // reuses its chunks from the first block
+    moved.clear();
+    EXPECT_EQ(&*moved.insert(0, 0), first);
+    for (int i = 1; i < 100; i++)
+      moved.insert(i, -i);
+    EXPECT_EQ(alloc.memory_usage(), used);
+  }
+  // chunks are freed with the last bimap holding blocks
+  EXPECT_EQ(alloc.memory_usage(), 0);
+}
+
+TEST(bimap, pool_allocator_non_trivial) {
+  pool_bimap<std::string, std::string> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(std::string(40, 'a') + std::to_string(i), std::to_string(i));
+  EXPECT_EQ(b.at_right("42"), std::string(40, 'a') + "42");
+  b.erase_right("42");
+  EXPECT_EQ(b.size(), 99);
+  b.clear();
+  b.insert("a", "b");
+  EXPECT_EQ(b.at_left("a"), "b");
+}
+
+TEST(bimap, range_construction) {
+  std::vector<std::pair<int, int>> data = {
+      {5, 1}, {3, 2}, {5, 7}, {8, 2}, {1, 9}, {4, 4}, {9, 9}};
+  bimap<int, int> b(data.begin(), data.end());
+  bimap<int, int> expected;
+  for (auto const &p : data)
+    expected.insert(p.first, p.second);
+  EXPECT_EQ(b.size(), 4);
+  EXPECT_EQ(b, expected);
+  EXPECT_EQ(b.at_left(5), 1);
+  EXPECT_THROW(b.at_left(8), std::out_of_range);
+
+  b.insert(100, 100);
+  EXPECT_EQ(*--b.end_left(), 100);
+  b.assign(data.begin() + 3, data.end());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_right(2), 8);
+}
+
+TEST(bimap, ordered_range_construction) {
+  std::vector<std::pair<std::string, int>> data;
+  for (int i = 0; i < 1000; i++)
+    data.emplace_back(std::to_string(1000 + i), (i * 7) % 1000);
+  bimap<std::string, int> b(bimap_helper::ordered_left,
+                            std::make_move_iterator(data.begin()),
+                            std::make_move_iterator(data.end()));
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.at_right(7), "1001");
+  EXPECT_EQ(*b.begin_left(), "1000");
+  EXPECT_EQ(*b.begin_right(), 0);
+
+  std::vector<std::pair<int, int>> by_right = {{3, 1}, {1, 2}, {2, 2}};
+  bimap<int, int> b1(bimap_helper::ordered_right, by_right.begin(),
+                     by_right.end());
+  EXPECT_EQ(b1.size(), 2);
+  EXPECT_EQ(b1.at_right(2), 1);
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -328,6 +541,1554 @@ TEST(bimap_randomized, comparison) {
   EXPECT_EQ(b1, b2);
 }
 
+TEST(bimap_randomized, range_construction) {
+  std::mt19937 e(seed);
+  std::vector<std::pair<int, int>> data(20000);
+  for (auto &p : data)
+    p = {e() % 5000, e() % 5000};
+  bimap<int, int> b(data.begin(), data.end());
+  bimap<int, int> expected;
+  for (auto const &p : data)
+    expected.insert(p.first, p.second);
+  EXPECT_EQ(b.size(), expected.size());
+  EXPECT_EQ(b, expected);
+  for (int i = 0; i < 1000; i++)
+    b.insert(e() % 10000, e() % 10000);
+  EXPECT_TRUE(std::is_sorted(b.begin_right(), b.end_right()));
+}
+
+template <typename L, typename R>
+using avl_bimap = bimap<L, R, std::less<L>, std::less<R>,
+                        std::allocator<std::pair<L, R>>, avl::policy>;
+
+TEST(bimap, avl_policy) {
+  avl_bimap<int, std::string> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, std::to_string(i));
+  EXPECT_EQ(b.at_left(42), "42");
+  EXPECT_EQ(b.at_right("42"), 42);
+  EXPECT_EQ(*b.lower_bound_right("420"), "43");
+  EXPECT_EQ(*b.upper_bound_left(98), 99);
+  EXPECT_EQ(*--b.end_left(), 99);
+  EXPECT_EQ(b.insert(5, "x"), b.end_left());
+  EXPECT_EQ(b.insert(500, "5"), b.end_left());
+  EXPECT_EQ(*b.erase_left(b.find_left(10)), 11);
+  EXPECT_TRUE(b.erase_right("11"));
+  auto it = b.erase_left(b.find_left(20), b.find_left(30));
+  EXPECT_EQ(*it, 30);
+  EXPECT_EQ(b.size(), 88);
+
+  avl_bimap<int, std::string> b1(b);
+  EXPECT_EQ(b, b1);
+  b1.insert(-1, "-1");
+  EXPECT_EQ(*b1.begin_left(), -1);
+  auto view = b1.freeze();
+  EXPECT_EQ(view.at_left(-1), "-1");
+}
+
+TEST(bimap_randomized, avl_compare_to_two_maps) {
+  avl_bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 30000; i++) {
+    unsigned int op = e() % 10;
+    if (op > 3) {
+      int l = e() % 20000, r = e() % 20000;
+      bool inserted = b.insert(l, r) != b.end_left();
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 0) {
+      if (b.empty())
+        continue;
+      auto it = b.lower_bound_right(e() % 20000);
+      if (it == b.end_right())
+        continue;
+      EXPECT_EQ(right_view.erase(*it), 1);
+      EXPECT_EQ(left_view.erase(*it.flip()), 1);
+      b.erase_right(it);
+    } else {
+      int l = e() % 20000;
+      auto f = b.lower_bound_left(l), t = b.lower_bound_left(l + 50);
+      for (auto it = f; it != t; ++it)
+        right_view.erase(*it.flip());
+      left_view.erase(left_view.lower_bound(l), left_view.lower_bound(l + 50));
+      b.erase_left(f, t);
+    }
+    if (i % 500 == 0) {
+      EXPECT_EQ(b.size(), left_view.size());
+      EXPECT_TRUE(std::equal(b.begin_left(), b.end_left(), left_view.begin(),
+                             left_view.end(),
+                             [](int a, auto const &p) { return a == p.first; }));
+      EXPECT_TRUE(std::equal(b.begin_right(), b.end_right(),
+                             right_view.begin(), right_view.end(),
+                             [](int a, auto const &p) { return a == p.first; }));
+    }
+  }
+}
+
+template <typename L, typename R, typename Policy = splay::policy>
+using hashed_bimap =
+    bimap<L, R, std::less<L>, std::less<R>, std::allocator<std::pair<L, R>>,
+          Policy, bimap_helper::hash_index<std::hash<L>, std::hash<R>>>;
+
+TEST(bimap, hash_index) {
+  hashed_bimap<int, std::string> b;
+  b.insert(1, "a");
+  b.insert(2, "b");
+  b.insert(3, "c");
+  EXPECT_EQ(b.insert(1, "d"), b.end_left());
+  EXPECT_EQ(b.at_left(2), "b");
+  EXPECT_EQ(b.at_right("c"), 3);
+  EXPECT_EQ(b.find_left(4), b.end_left());
+  EXPECT_EQ(*++b.find_right("a"), "b");
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_EQ(b.find_right("b"), b.end_right());
+
+  auto copy = b;
+  b.clear();
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(copy.at_right("a"), 1);
+  b = std::move(copy);
+  EXPECT_EQ(b.at_left(3), "c");
+
+  std::vector<std::pair<int, std::string>> pairs = {
+      {5, "x"}, {4, "y"}, {5, "z"}};
+  hashed_bimap<int, std::string> ranged(pairs.begin(), pairs.end());
+  EXPECT_EQ(ranged.at_left(5), "x");
+  EXPECT_EQ(ranged.find_right("z"), ranged.end_right());
+  EXPECT_EQ(ranged.freeze().at_right("y"), 4);
+}
+
+// key which counts its constructions from int
+struct counted_key {
+  static inline int constructed = 0;
+  int value;
+  explicit counted_key(int value) : value(value) { constructed++; }
+};
+struct counted_less {
+  using is_transparent = void;
+  static int get(counted_key const &k) { return k.value; }
+  static int get(int k) { return k; }
+  template <typename A, typename B>
+  bool operator()(A const &a, B const &b) const {
+    return get(a) < get(b);
+  }
+};
+
+template <typename Policy> void check_transparent_lookup() {
+  bimap<counted_key, std::string, counted_less, std::less<>,
+        std::allocator<std::pair<counted_key, std::string>>, Policy>
+      b;
+  for (int i = 0; i < 100; i++)
+    b.insert(counted_key(i * 2), std::to_string(i * 2));
+  counted_key::constructed = 0;
+  EXPECT_EQ(b.find_left(10).flip()->size(), 2);
+  EXPECT_EQ(b.find_left(11), b.end_left());
+  EXPECT_EQ(b.at_left(40), "40");
+  EXPECT_THROW(b.at_left(41), std::out_of_range);
+  EXPECT_EQ(b.lower_bound_left(41)->value, 42);
+  EXPECT_EQ(b.upper_bound_left(42)->value, 44);
+  EXPECT_EQ(b.upper_bound_left(198), b.end_left());
+  EXPECT_TRUE(b.erase_left(42));
+  EXPECT_FALSE(b.erase_left(42));
+  EXPECT_EQ(counted_key::constructed, 0);
+
+  std::string_view key = "64";
+  EXPECT_EQ(b.find_right(key).flip()->value, 64);
+  EXPECT_EQ(b.at_right(key).value, 64);
+  EXPECT_EQ(*b.lower_bound_right(std::string_view("641")), "66");
+  EXPECT_EQ(*b.upper_bound_right(key), "66");
+  EXPECT_TRUE(b.erase_right(key));
+  EXPECT_EQ(b.find_right("64"), b.end_right());
+
+  auto view = b.freeze();
+  EXPECT_EQ(view.at_left(2), "2");
+  EXPECT_EQ(view.find_right(std::string_view("8")).flip()->value, 8);
+  EXPECT_EQ(view.lower_bound_left(3)->value, 4);
+  EXPECT_EQ(*view.upper_bound_right(std::string_view("8")), "80");
+  EXPECT_EQ(counted_key::constructed, 0);
+}
+
+TEST(bimap, transparent_lookup) {
+  check_transparent_lookup<splay::policy>();
+  check_transparent_lookup<avl::policy>();
+}
+
+// neither copyable nor movable, counts constructions
+struct pinned_value {
+  static inline int constructed = 0;
+  int value;
+  pinned_value(int a, int b) : value(a * 100 + b) { constructed++; }
+  pinned_value(pinned_value const &) = delete;
+  friend bool operator<(pinned_value const &a, pinned_value const &b) {
+    return a.value < b.value;
+  }
+};
+
+template <typename Policy> void check_emplace() {
+  bimap<int, pinned_value, std::less<int>, std::less<pinned_value>,
+        std::allocator<std::pair<int, pinned_value>>, Policy>
+      b;
+  pinned_value::constructed = 0;
+  EXPECT_NE(b.emplace(std::piecewise_construct, std::forward_as_tuple(1),
+                      std::forward_as_tuple(1, 2)),
+            b.end_left());
+  EXPECT_EQ(b.emplace(std::piecewise_construct, std::forward_as_tuple(2),
+                      std::forward_as_tuple(1, 2)),
+            b.end_left());
+  EXPECT_EQ(pinned_value::constructed, 2);
+
+  // key is present, so value is not constructed
+  EXPECT_EQ(b.try_emplace_left(1, 3, 4), b.end_left());
+  EXPECT_EQ(pinned_value::constructed, 2);
+  auto it = b.try_emplace_left(2, 3, 4);
+  ASSERT_NE(it, b.end_left());
+  EXPECT_EQ(it.flip()->value, 304);
+  EXPECT_EQ(pinned_value::constructed, 3);
+  // right value clashes, constructed one is destroyed
+  EXPECT_EQ(b.try_emplace_left(3, 3, 4), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+
+  bimap<std::string, std::vector<int>, std::less<std::string>,
+        std::less<std::vector<int>>,
+        std::allocator<std::pair<std::string, std::vector<int>>>, Policy>
+      v;
+  EXPECT_NE(v.try_emplace_right(std::vector<int>(3, 7), "abc"), v.end_left());
+  EXPECT_EQ(v.try_emplace_right(std::vector<int>(3, 7), "x"), v.end_left());
+  EXPECT_EQ(*v.try_emplace_right(std::vector<int>{1}, 2, 'z'), "zz");
+  EXPECT_EQ(v.at_right(std::vector<int>(3, 7)), "abc");
+  EXPECT_EQ(v.at_left("zz"), std::vector<int>{1});
+}
+
+TEST(bimap, emplace) {
+  check_emplace<splay::policy>();
+  check_emplace<avl::policy>();
+}
+
+// counts its calls
+struct counting_less {
+  static inline int calls = 0;
+  bool operator()(int a, int b) const {
+    calls++;
+    return a < b;
+  }
+};
+
+TEST(bimap, try_emplace_looks_key_up_once) {
+  // avl lookups do not restructure, so equal lookups compare equally often
+  bimap<int, int, counting_less, std::less<int>,
+        std::allocator<std::pair<int, int>>, avl::policy>
+      b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(i * 2, i);
+  counting_less::calls = 0;
+  EXPECT_EQ(b.find_left(777), b.end_left());
+  auto lookup = counting_less::calls;
+  counting_less::calls = 0;
+  EXPECT_NE(b.try_emplace_left(777, 5000), b.end_left());
+  EXPECT_EQ(counting_less::calls, lookup);
+  EXPECT_EQ(b.at_right(5000), 777);
+  // clash on right side, left place is not searched again either
+  counting_less::calls = 0;
+  EXPECT_EQ(b.find_left(779), b.end_left());
+  lookup = counting_less::calls;
+  counting_less::calls = 0;
+  EXPECT_EQ(b.try_emplace_left(779, 5000), b.end_left());
+  EXPECT_EQ(counting_less::calls, lookup);
+  EXPECT_EQ(b.size(), 1001);
+}
+
+TEST(bimap_randomized, hash_index_compare_to_two_maps) {
+  hashed_bimap<int, int, avl::policy> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 30000; i++) {
+    unsigned int op = e() % 10;
+    int l = e() % 5000, r = e() % 5000;
+    if (op > 4) {
+      bool inserted = b.insert(l, r) != b.end_left();
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 1) {
+      auto it = left_view.find(l);
+      EXPECT_EQ(b.erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else {
+      auto it = b.find_right(r);
+      auto mit = right_view.find(r);
+      EXPECT_EQ(it == b.end_right(), mit == right_view.end());
+      if (it != b.end_right()) {
+        EXPECT_EQ(*it.flip(), mit->second);
+      }
+    }
+    if (i % 5000 == 0) {
+      auto copy = b;
+      for (auto const &p : left_view)
+        EXPECT_EQ(copy.at_left(p.first), p.second);
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+}
+
+TEST(bimap, order_statistics) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i * 2, -i);
+  EXPECT_EQ(b.rank_left(b.find_left(10)), 5);
+  EXPECT_EQ(b.rank_right(b.find_right(0)), 99);
+  EXPECT_EQ(b.rank_left(b.end_left()), 100);
+  EXPECT_EQ(*b.nth_left(42), 84);
+  EXPECT_EQ(*b.nth_right(0), -99);
+  EXPECT_EQ(b.nth_left(100), b.end_left());
+  EXPECT_EQ(b.count_range_left(10, 20), 5);
+  EXPECT_EQ(b.count_range_left(11, 21), 5);
+  EXPECT_EQ(b.count_range_left(20, 10), 0);
+  EXPECT_EQ(b.count_range_right(-1000, 1000), 100);
+
+  auto view = b.freeze();
+  EXPECT_EQ(view.rank_left(view.find_left(10)), 5);
+  EXPECT_EQ(*view.nth_right(1), -98);
+  EXPECT_EQ(view.count_range_right(-10, 0), 10);
+}
+
+template <typename Bimap> void check_order_statistics() {
+  Bimap b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    unsigned int op = e() % 10;
+    int l = e() % 10000, r = e() % 10000;
+    if (op > 3) {
+      if (b.insert(l, r) != b.end_left()) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 1) {
+      auto it = b.lower_bound_left(l);
+      if (it == b.end_left())
+        continue;
+      right_view.erase(*it.flip());
+      left_view.erase(*it);
+      b.erase_left(it);
+    } else if (!left_view.empty()) {
+      auto k = e() % left_view.size();
+      auto it = b.nth_right(k);
+      EXPECT_EQ(*it, std::next(right_view.begin(), k)->first);
+      EXPECT_EQ(b.rank_left(it.flip()),
+                std::distance(left_view.begin(), left_view.find(*it.flip())));
+      EXPECT_EQ(b.count_range_left(l, l + 500),
+                std::distance(left_view.lower_bound(l),
+                              left_view.lower_bound(l + 500)));
+    }
+  }
+  auto copy = b;
+  for (size_t k = 0; k < copy.size(); k += 97)
+    EXPECT_EQ(copy.rank_right(copy.nth_right(k)), k);
+}
+
+TEST(bimap_randomized, order_statistics) {
+  check_order_statistics<bimap<int, int>>();
+  check_order_statistics<avl_bimap<int, int>>();
+}
+
+template <typename Bimap>
+void expect_contents(Bimap const &b, std::map<int, int> const &left_view) {
+  std::map<int, int> right_view;
+  for (auto const &p : left_view)
+    right_view.emplace(p.second, p.first);
+  ASSERT_EQ(b.size(), left_view.size());
+  auto lit = left_view.begin();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++lit) {
+    EXPECT_EQ(*it, lit->first);
+    EXPECT_EQ(*it.flip(), lit->second);
+  }
+  auto rit = right_view.begin();
+  for (auto it = b.begin_right(); it != b.end_right(); ++it, ++rit) {
+    EXPECT_EQ(*it, rit->first);
+    EXPECT_EQ(*it.flip(), rit->second);
+  }
+  for (size_t k = 0; k < b.size(); k += 7) {
+    EXPECT_EQ(b.rank_left(b.nth_left(k)), k);
+    EXPECT_EQ(b.rank_right(b.nth_right(k)), k);
+  }
+}
+
+template <typename Bimap> void check_split_merge() {
+  std::mt19937 e(seed);
+  for (int round = 0; round < 30; round++) {
+    Bimap b;
+    std::map<int, int> view;
+    // even rounds are monotone on both sides, so split takes fast path
+    int sign = round % 4 == 0 ? 1 : -1;
+    for (int i = 0; i < 300; i++) {
+      int l = e() % 1000;
+      int r = round % 2 == 0 ? sign * l : static_cast<int>(e() % 1000);
+      if (b.insert(l, r) != b.end_left())
+        view.emplace(l, r);
+    }
+    int key = e() % 1000;
+    auto [lower, upper] = b.split_left(key);
+    EXPECT_TRUE(b.empty());
+    auto mid = view.lower_bound(key);
+    expect_contents(lower, std::map<int, int>(view.begin(), mid));
+    expect_contents(upper, std::map<int, int>(mid, view.end()));
+
+    if (round % 3 == 0)
+      upper.merge(std::move(lower));
+    else
+      lower.merge(std::move(upper));
+    auto &merged = round % 3 == 0 ? upper : lower;
+    expect_contents(merged, view);
+    for (auto const &p : view) {
+      EXPECT_EQ(merged.at_left(p.first), p.second);
+      EXPECT_EQ(merged.at_right(p.second), p.first);
+    }
+
+    auto [small, big] = merged.split_right(key);
+    for (auto it = small.begin_right(); it != small.end_right(); ++it)
+      EXPECT_LT(*it, key);
+    for (auto it = big.begin_right(); it != big.end_right(); ++it)
+      EXPECT_GE(*it, key);
+    EXPECT_EQ(small.size() + big.size(), view.size());
+    small.merge(std::move(big));
+    expect_contents(small, view);
+  }
+}
+
+TEST(bimap, split_merge) {
+  check_split_merge<bimap<int, int>>();
+  check_split_merge<avl_bimap<int, int>>();
+  check_split_merge<hashed_bimap<int, int>>();
+  check_split_merge<pool_bimap<int, int>>();
+}
+
+template <typename Bimap> void check_extract() {
+  Bimap b;
+  for (int i = 0; i < 50; i++)
+    b.insert(i, i * 10);
+  auto it = b.find_left(7);
+  auto const *address = &*it;
+  auto handle = b.extract_left(it);
+  EXPECT_EQ(b.size(), 49);
+  EXPECT_EQ(b.find_right(70), b.end_right());
+  ASSERT_FALSE(handle.empty());
+  EXPECT_EQ(handle.right(), 70);
+  handle.left() = 1000;
+  auto inserted = b.insert(std::move(handle));
+  EXPECT_TRUE(handle.empty());
+  ASSERT_NE(inserted, b.end_left());
+  // same node is linked back
+  EXPECT_EQ(&*inserted, address);
+  EXPECT_EQ(b.at_left(1000), 70);
+  EXPECT_EQ(b.at_right(70), 1000);
+  EXPECT_EQ(b.find_left(7), b.end_left());
+
+  // clashing handle stays owned
+  auto other = b.extract_right(b.find_right(30));
+  other.right() = 40;
+  EXPECT_EQ(b.insert(std::move(other)), b.end_left());
+  EXPECT_FALSE(other.empty());
+  other.right() = 35;
+  EXPECT_NE(b.insert(std::move(other)), b.end_left());
+  EXPECT_EQ(b.at_right(35), 3);
+  EXPECT_EQ(b.size(), 50);
+
+  // handle frees node it owns
+  auto dropped = b.extract_left(b.begin_left());
+  auto moved = std::move(dropped);
+  EXPECT_TRUE(dropped.empty());
+  EXPECT_EQ(moved.left(), 0);
+  EXPECT_EQ(b.size(), 49);
+  EXPECT_EQ(b.insert(typename Bimap::node_type()), b.end_left());
+
+  std::map<int, int> view;
+  for (int i = 1; i < 50; i++)
+    view[i == 7 ? 1000 : i] = i == 3 ? 35 : i * 10;
+  expect_contents(b, view);
+}
+
+TEST(bimap, extract) {
+  check_extract<bimap<int, int>>();
+  check_extract<avl_bimap<int, int>>();
+  check_extract<hashed_bimap<int, int>>();
+  check_extract<pool_bimap<int, int>>();
+}
+
+TEST(bimap, extract_pool_handle) {
+  pool_bimap<int, int> a, b;
+  for (int i = 0; i < 10; i++)
+    a.insert(i, i * 10);
+  auto handle = a.extract_left(a.find_left(3));
+  // separate pools, node can not move between them
+  EXPECT_THROW(b.insert(std::move(handle)), std::invalid_argument);
+  EXPECT_EQ(handle.left(), 3);
+
+  // bimap given allocator of `a` shares its pool
+  auto c = std::make_unique<pool_bimap<int, int>>(
+      std::less<int>(), std::less<int>(), a.get_allocator());
+  c->insert(5, 50);
+  auto kept = c->extract_left(c->find_left(5));
+  c.reset();
+  // handle shares the pool, so node outlives its bimap
+  EXPECT_EQ(kept.right(), 50);
+  a.erase_left(5);
+  EXPECT_NE(a.insert(std::move(kept)), a.end_left());
+  EXPECT_NE(a.insert(std::move(handle)), a.end_left());
+  EXPECT_EQ(a.size(), 10);
+  EXPECT_EQ(a.at_left(5), 50);
+}
+
+template <typename Bimap> void check_replace() {
+  Bimap b;
+  std::map<int, int> view, right_view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 300; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (b.insert(l, r) != b.end_left()) {
+      view.emplace(l, r);
+      right_view.emplace(r, l);
+    }
+  }
+  for (int i = 0; i < 3000; i++) {
+    // small steps keep node in place sometimes
+    int value = e() % 2 == 0 ? static_cast<int>(e() % 1000) : e() % 5;
+    if (e() % 2 == 0) {
+      auto it = b.nth_left(e() % b.size());
+      int l = *it, old = view[l];
+      int r = e() % 2 == 0 ? value : old + value;
+      bool free = right_view.count(r) == 0 || right_view[r] == l;
+      EXPECT_EQ(b.replace_right(it, r), free);
+      if (free) {
+        right_view.erase(old);
+        right_view[r] = l;
+        view[l] = r;
+        EXPECT_EQ(*it.flip(), r);
+      }
+    } else {
+      auto it = b.nth_right(e() % b.size());
+      int r = *it, old = right_view[r];
+      int l = e() % 2 == 0 ? value : old - value;
+      bool free = view.count(l) == 0 || view[l] == r;
+      EXPECT_EQ(b.replace_left(it, l), free);
+      if (free) {
+        view.erase(old);
+        view[l] = r;
+        right_view[r] = l;
+        EXPECT_EQ(*it.flip(), l);
+      }
+    }
+    if (i % 300 == 0)
+      expect_contents(b, view);
+  }
+  expect_contents(b, view);
+  for (auto const &p : view)
+    EXPECT_EQ(b.at_right(p.second), p.first);
+}
+
+TEST(bimap, replace) {
+  check_replace<bimap<int, int>>();
+  check_replace<avl_bimap<int, int>>();
+  check_replace<hashed_bimap<int, int>>();
+  check_replace<pool_bimap<int, int>>();
+}
+
+// move assignment throws when armed
+struct throwing_assign {
+  static inline bool armed = false;
+  int value;
+  explicit throwing_assign(int value) : value(value) {}
+  throwing_assign(throwing_assign const &) = default;
+  throwing_assign &operator=(throwing_assign &&other) {
+    if (armed)
+      throw std::runtime_error("assignment failed");
+    value = other.value;
+    return *this;
+  }
+  friend bool operator<(throwing_assign const &a, throwing_assign const &b) {
+    return a.value < b.value;
+  }
+};
+
+TEST(bimap, replace_throwing_assignment) {
+  bimap<int, throwing_assign> b;
+  for (int i = 0; i < 20; i++)
+    b.insert(i, throwing_assign(i * 10));
+  EXPECT_TRUE(b.replace_right(b.find_left(3), throwing_assign(35)));
+  throwing_assign::armed = true;
+  // pair is dropped, rest stays intact
+  EXPECT_THROW(b.replace_right(b.find_left(5), throwing_assign(1000)),
+               std::runtime_error);
+  throwing_assign::armed = false;
+  EXPECT_EQ(b.size(), 19);
+  EXPECT_EQ(b.find_left(5), b.end_left());
+  EXPECT_EQ(b.at_right(throwing_assign(35)), 3);
+  int expected = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++expected) {
+    if (expected == 5)
+      expected++;
+    EXPECT_EQ(*it, expected);
+  }
+  EXPECT_EQ(b.at_left(19).value, 190);
+}
+
+// hash throws on one value when armed
+struct throwing_hash {
+  static inline bool armed = false;
+  std::size_t operator()(int value) const {
+    if (armed && value == 1000)
+      throw std::runtime_error("hash failed");
+    return std::hash<int>()(value);
+  }
+};
+
+TEST(bimap, replace_throwing_hash) {
+  bimap<int, int, std::less<int>, std::less<int>,
+        std::allocator<std::pair<int, int>>, splay::policy,
+        bimap_helper::hash_index<std::hash<int>, throwing_hash>>
+      b;
+  for (int i = 0; i < 20; i++)
+    b.insert(i, i * 10);
+  throwing_hash::armed = true;
+  // pair is left untouched
+  EXPECT_THROW(b.replace_right(b.find_left(5), 1000), std::runtime_error);
+  EXPECT_EQ(b.size(), 20);
+  EXPECT_EQ(b.at_right(50), 5);
+  EXPECT_EQ(b.at_left(5), 50);
+  EXPECT_TRUE(b.replace_right(b.find_left(5), 55));
+  throwing_hash::armed = false;
+  EXPECT_EQ(b.at_right(55), 5);
+  EXPECT_EQ(b.find_right(50), b.end_right());
+  EXPECT_EQ(*++b.find_right(55), 60);
+}
+
+// throws on every n-th comparison when armed
+struct throwing_less {
+  static inline int countdown = -1;
+  bool operator()(int a, int b) const {
+    if (countdown >= 0 && countdown-- == 0)
+      throw std::runtime_error("comparison failed");
+    return a < b;
+  }
+};
+
+TEST(bimap, throwing_comparator_keeps_tree) {
+  bimap<int, int, throwing_less> b;
+  std::map<int, int> view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 500; i++) {
+    int l = e() % 2000;
+    if (b.insert(l, i) != b.end_left())
+      view.emplace(l, i);
+  }
+  for (int round = 0; round < 200; round++) {
+    throwing_less::countdown = e() % 12;
+    try {
+      b.find_left(e() % 2000);
+    } catch (std::runtime_error const &) {
+    }
+    throwing_less::countdown = -1;
+    if (round % 20 == 0)
+      expect_contents(b, view);
+  }
+  expect_contents(b, view);
+}
+
+TEST(bimap_randomized, alternating_sides) {
+  bimap<int, int> b;
+  std::map<int, int> view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 2000; i++) {
+    int l = e() % 4000, r = e() % 4000;
+    if (b.insert(l, r) != b.end_left())
+      view.emplace(l, r);
+  }
+  for (int round = 0; round < 3000; round++) {
+    int key = e() % 4000;
+    auto lit = b.lower_bound_left(key);
+    auto mlit = view.lower_bound(key);
+    ASSERT_EQ(lit == b.end_left(), mlit == view.end());
+    if (lit == b.end_left())
+      continue;
+    EXPECT_EQ(*lit, mlit->first);
+    auto rit = b.find_right(mlit->second);
+    ASSERT_NE(rit, b.end_right());
+    EXPECT_EQ(*rit.flip(), mlit->first);
+    switch (round % 7) {
+    case 0:
+      // hints must forget nodes which left the bimap
+      view.erase(mlit);
+      b.erase_right(rit);
+      break;
+    case 1: {
+      auto handle = b.extract_right(rit);
+      b.insert(std::move(handle));
+      break;
+    }
+    case 2: {
+      auto [lower, upper] = b.split_left(key);
+      lower.merge(std::move(upper));
+      b = std::move(lower);
+      break;
+    }
+    }
+  }
+  expect_contents(b, view);
+}
+
+TEST(bimap, merge_clashing) {
+  bimap<int, int> a, b;
+  a.insert(1, 10);
+  a.insert(2, 20);
+  b.insert(3, 20);
+  b.insert(4, 40);
+  b.insert(1, 50);
+  a.merge(std::move(b));
+  expect_contents(a, {{1, 10}, {2, 20}, {4, 40}});
+  expect_contents(b, {{1, 50}, {3, 20}});
+}
+
+template <typename Bimap> void check_erase_range() {
+  std::mt19937 e(seed);
+  Bimap b;
+  std::map<int, int> view;
+  for (int round = 0; round < 200; round++) {
+    for (int i = 0; i < 100; i++) {
+      int l = e() % 3000, r = e() % 3000;
+      if (b.insert(l, r) != b.end_left())
+        view.emplace(l, r);
+    }
+    int from = e() % 3000, to = from + e() % (round % 2 == 0 ? 100 : 2000);
+    if (round % 4 < 2) {
+      b.erase_left(b.lower_bound_left(from), b.lower_bound_left(to));
+      view.erase(view.lower_bound(from), view.lower_bound(to));
+    } else {
+      auto it = b.erase_right(b.lower_bound_right(from),
+                              b.lower_bound_right(to));
+      EXPECT_EQ(it, b.lower_bound_right(to));
+      for (auto vit = view.begin(); vit != view.end();)
+        if (vit->second >= from && vit->second < to)
+          vit = view.erase(vit);
+        else
+          ++vit;
+    }
+    if (round % 20 == 0)
+      expect_contents(b, view);
+  }
+  expect_contents(b, view);
+  for (auto const &p : view)
+    EXPECT_EQ(b.at_right(p.second), p.first);
+}
+
+TEST(bimap_randomized, erase_range) {
+  check_erase_range<bimap<int, int>>();
+  check_erase_range<avl_bimap<int, int>>();
+  check_erase_range<hashed_bimap<int, int>>();
+}
+
+template <typename Bimap> void check_insert_batch() {
+  std::mt19937 e(seed);
+  Bimap b;
+  std::map<int, int> left_view, right_view;
+  for (int round = 0; round < 100; round++) {
+    // small batches are looked up and linked one by one, big ones are swept
+    // and rebuilt
+    std::vector<std::pair<int, int>> batch(round % 3 == 0 ? 500 : e() % 10);
+    for (auto &p : batch)
+      p = {static_cast<int>(e() % 5000), static_cast<int>(e() % 5000)};
+    auto flags = b.insert_batch(batch);
+    ASSERT_EQ(flags.size(), batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      auto [l, r] = batch[i];
+      bool expected = left_view.count(l) == 0 && right_view.count(r) == 0;
+      EXPECT_EQ(flags[i], expected);
+      if (expected) {
+        left_view.emplace(l, r);
+        right_view.emplace(r, l);
+      }
+    }
+    if (round % 10 == 0) {
+      int from = e() % 5000;
+      b.erase_left(b.lower_bound_left(from), b.end_left());
+      for (auto it = left_view.lower_bound(from); it != left_view.end();) {
+        right_view.erase(it->second);
+        it = left_view.erase(it);
+      }
+    }
+    expect_contents(b, left_view);
+  }
+}
+
+TEST(bimap_randomized, insert_batch) {
+  check_insert_batch<bimap<int, int>>();
+  check_insert_batch<avl_bimap<int, int>>();
+  check_insert_batch<hashed_bimap<int, int>>();
+}
+
+TEST(unordered_bimap, simple) {
+  unordered_bimap<int, std::string> b;
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_EQ(b.insert(1, "c"), b.end_left());
+  EXPECT_EQ(b.insert(3, "b"), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(1), "a");
+  EXPECT_EQ(b.at_right("b"), 2);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_EQ(*b.find_right("a").flip(), 1);
+  EXPECT_EQ(b.find_left(5), b.end_left());
+
+  auto copy = b;
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_FALSE(b.erase_right("a"));
+  EXPECT_EQ(b.at_left(2), "b");
+  EXPECT_NE(copy, b);
+  b.insert(1, "a");
+  EXPECT_EQ(copy, b);
+
+  std::vector<std::pair<int, std::string>> pairs = {
+      {5, "x"}, {4, "y"}, {5, "z"}};
+  unordered_bimap<int, std::string> ranged(pairs.begin(), pairs.end());
+  EXPECT_EQ(ranged.size(), 2);
+  EXPECT_EQ(ranged.at_right("y"), 4);
+}
+
+TEST(unordered_bimap, erase_while_iterating) {
+  unordered_bimap<int, int> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, -i);
+  for (auto it = b.begin_left(); it != b.end_left();)
+    if (*it % 3 == 0)
+      it = b.erase_left(it);
+    else
+      ++it;
+  EXPECT_EQ(b.size(), 66);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(b.find_right(-i) == b.end_right(), i % 3 == 0);
+}
+
+TEST(unordered_bimap, erase_throwing_move) {
+  struct hash_value {
+    std::size_t operator()(throwing_assign const &a) const {
+      return std::hash<int>()(a.value);
+    }
+  };
+  struct equal_value {
+    bool operator()(throwing_assign const &a,
+                    throwing_assign const &b) const {
+      return a.value == b.value;
+    }
+  };
+  unordered_bimap<throwing_assign, int, hash_value, std::hash<int>,
+                  equal_value>
+      b;
+  for (int i = 0; i < 20; i++)
+    b.insert(throwing_assign(i), i * 10);
+  throwing_assign::armed = true;
+  // last pair can not fill the hole, so nothing is erased
+  EXPECT_THROW(b.erase_right(30), std::runtime_error);
+  throwing_assign::armed = false;
+  EXPECT_EQ(b.size(), 20);
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(b.at_right(i * 10).value, i);
+    EXPECT_EQ(b.at_left(throwing_assign(i)), i * 10);
+  }
+}
+
+template <typename Map, typename = void> struct is_ordered : std::false_type {};
+template <typename Map>
+struct is_ordered<Map, std::void_t<decltype(std::declval<Map const &>()
+                                                .lower_bound_right(0))>>
+    : std::true_type {};
+
+// random inserts, erases and lookups mirrored into two maps, then erase of
+// everything left. ordered maps also get erase of `range` wide key ranges
+template <typename Map>
+void check_compare_to_two_maps(int keys, size_t ops = 50000, int range = 20) {
+  constexpr bool ordered = is_ordered<Map>::value;
+  Map b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < ops; i++) {
+    unsigned int op = e() % 10;
+    int l = e() % keys, r = e() % keys;
+    if (op > 4) {
+      bool inserted = b.insert(l, r) != b.end_left();
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 2 || (!ordered && op > 1)) {
+      auto it = right_view.find(r);
+      EXPECT_EQ(b.erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    } else if (op > 1) {
+      if constexpr (ordered) {
+        // iterators past erased range are kept valid by erase
+        auto f = b.lower_bound_left(l), t = b.lower_bound_left(l + range);
+        f = b.erase_left(f, t);
+        EXPECT_EQ(f, b.lower_bound_left(l + range));
+        for (auto it = left_view.lower_bound(l);
+             it != left_view.end() && it->first < l + range;) {
+          right_view.erase(it->second);
+          it = left_view.erase(it);
+        }
+      }
+    } else {
+      auto it = b.find_left(l);
+      auto mit = left_view.find(l);
+      EXPECT_EQ(it == b.end_left(), mit == left_view.end());
+      if (it != b.end_left()) {
+        EXPECT_EQ(*it.flip(), mit->second);
+      }
+      if constexpr (ordered) {
+        auto bit = op == 0 ? b.lower_bound_right(r) : b.upper_bound_right(r);
+        auto bmit = op == 0 ? right_view.lower_bound(r)
+                            : right_view.upper_bound(r);
+        EXPECT_EQ(bit == b.end_right(), bmit == right_view.end());
+        if (bit != b.end_right()) {
+          EXPECT_EQ(*bit, bmit->first);
+          EXPECT_EQ(*bit.flip(), bmit->second);
+        }
+      }
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+  std::map<int, int> got;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it)
+    got[*it] = *it.flip();
+  EXPECT_EQ(got, left_view);
+  if constexpr (ordered) {
+    std::map<int, int> got_right;
+    for (auto it = b.end_right(); it != b.begin_right();) {
+      --it;
+      got_right[*it] = *it.flip();
+    }
+    EXPECT_EQ(got_right, right_view);
+  }
+
+  std::vector<int> rest;
+  for (auto const &p : right_view)
+    rest.push_back(p.first);
+  std::shuffle(rest.begin(), rest.end(), e);
+  for (int r : rest)
+    EXPECT_TRUE(b.erase_right(r));
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+}
+
+TEST(bimap_randomized, unordered_compare_to_two_maps) {
+  check_compare_to_two_maps<unordered_bimap<int, int>>(5000);
+}
+
+TEST(compact_bimap, simple) {
+  compact_bimap<int, std::string> b;
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_EQ(b.insert(1, "c"), b.end_left());
+  EXPECT_EQ(b.insert(3, "b"), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(1), "a");
+  EXPECT_EQ(b.at_right("b"), 2);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_EQ(*b.begin_left(), 1);
+  EXPECT_EQ(*std::prev(b.end_right()), "b");
+  EXPECT_EQ(*b.lower_bound_left(2), 2);
+  EXPECT_EQ(b.upper_bound_left(2), b.end_left());
+  EXPECT_EQ(*b.upper_bound_right("a").flip(), 2);
+
+  auto copy = b;
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_FALSE(b.erase_right("a"));
+  EXPECT_NE(copy, b);
+  b.insert(1, "a");
+  EXPECT_EQ(copy, b);
+
+  compact_bimap<int, int> small;
+  small.reserve(1000);
+  for (int i = 0; i < 1000; i++)
+    small.insert(i, -i);
+  // links take 32 bytes per pair
+  EXPECT_LE(small.memory_usage(), 1000 * (2 * sizeof(int) + 32));
+}
+
+TEST(bimap_randomized, compact_compare_to_two_maps) {
+  check_compare_to_two_maps<compact_bimap<int, int>>(5000);
+}
+
+TEST(btree_bimap, simple) {
+  btree_bimap<int, std::string> b;
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_EQ(b.insert(1, "c"), b.end_left());
+  EXPECT_EQ(b.insert(3, "b"), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(1), "a");
+  EXPECT_EQ(b.at_right("b"), 2);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_EQ(*b.begin_left(), 1);
+  EXPECT_EQ(*std::prev(b.end_right()), "b");
+  EXPECT_EQ(*b.lower_bound_left(2), 2);
+  EXPECT_EQ(b.upper_bound_left(2), b.end_left());
+  EXPECT_EQ(*b.upper_bound_right("a").flip(), 2);
+
+  auto copy = b;
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_FALSE(b.erase_right("a"));
+  EXPECT_NE(copy, b);
+  b.insert(1, "a");
+  EXPECT_EQ(copy, b);
+  b = std::move(copy);
+  EXPECT_EQ(b.size(), 2);
+
+  btree_bimap<int, int> big;
+  auto kept = big.insert(-1, -1);
+  for (int i = 0; i < 100000; i++)
+    big.insert(i * 7 % 100000, i);
+  // records do not move when nodes split and merge
+  EXPECT_EQ(*kept.flip(), -1);
+  EXPECT_EQ(big.erase_left(big.lower_bound_left(10), big.end_left()),
+            big.end_left());
+  EXPECT_EQ(*kept, -1);
+  EXPECT_EQ(big.size(), 11);
+  EXPECT_EQ(*std::prev(big.end_right()).flip(), 5);
+  for (int i = 0; i < 10; i++)
+    EXPECT_TRUE(big.erase_right(big.at_left(i)));
+  EXPECT_EQ(big.begin_left(), kept);
+  EXPECT_EQ(big.begin_right(), kept.flip());
+}
+
+TEST(btree_bimap, erase_keeps_nodes_filled) {
+  constexpr int order = bimap_helper::btree_side<
+      int, bimap_helper::btree_record<int, int>, true>::order;
+  constexpr int half = order / 2, leaves = 2000;
+  // ascending inserts split leaves in halves: leaf `j` holds keys
+  // 4 * (half * j + t) for `t` below `half`
+  btree_bimap<int, int> b;
+  for (int i = 0; i < leaves * half; i++)
+    b.insert(4 * i, -4 * i);
+  auto key = [](int j, int t) { return 4 * (half * j + t); };
+  // fill odd leaves up, then empty even ones but one key, so they underflow
+  // next to full sibling, and shrink odd ones to quarter
+  for (int j = 1; j < leaves; j += 2)
+    for (int t = 0; t < half; t++)
+      b.insert(key(j, t) + 1, -key(j, t) - 1);
+  for (int j = 0; j < leaves; j += 2)
+    for (int t = 1; t < half; t++)
+      EXPECT_TRUE(b.erase_left(key(j, t)));
+  for (int j = 1; j < leaves; j += 2) {
+    for (int t = 0; t < half; t++)
+      EXPECT_TRUE(b.erase_left(key(j, t) + 1));
+    for (int t = order / 4; t < half; t++)
+      EXPECT_TRUE(b.erase_left(key(j, t)));
+  }
+  EXPECT_EQ(b.size(), leaves / 2 * (1 + order / 4));
+
+  btree_bimap<int, int> fresh;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it)
+    fresh.insert(*it, *it.flip());
+  // nodes are at least quarter full, ascending inserts leave them half full
+  EXPECT_LE(b.memory_usage(), 2 * fresh.memory_usage());
+  EXPECT_LE(b.height(), fresh.height() + 1);
+
+  // last children underflow when pairs are erased from the back, so they
+  // take entries from their left neighbours, which are often nearly full
+  // after random inserts
+  std::mt19937 e(seed);
+  std::vector<int> rest(100000);
+  for (int i = 0; i < 100000; i++)
+    rest[i] = i;
+  std::shuffle(rest.begin(), rest.end(), e);
+  btree_bimap<int, int> c;
+  for (int k : rest)
+    c.insert(k, -k);
+  std::sort(rest.begin(), rest.end());
+  for (size_t i = rest.size(); i-- > 0;) {
+    EXPECT_TRUE(c.erase_left(rest[i]));
+    if (i % 1000 == 0) {
+      EXPECT_TRUE(std::equal(c.begin_left(), c.end_left(), rest.begin(),
+                             rest.begin() + i));
+      EXPECT_TRUE(std::equal(c.begin_right(), c.end_right(),
+                             std::make_reverse_iterator(rest.begin() + i),
+                             rest.rend(),
+                             [](int r, int l) { return r == -l; }));
+    }
+  }
+  EXPECT_TRUE(c.empty());
+}
+
+TEST(bimap_randomized, btree_compare_to_two_maps) {
+  // about 20000 pairs, so both sides are at least three levels deep, and
+  // draining them at the end merges inner nodes
+  check_compare_to_two_maps<btree_bimap<int, int>>(1000000, 100000, 200);
+}
+
+TEST(persistent_bimap, snapshots) {
+  persistent_bimap<int, std::string> b;
+  EXPECT_TRUE(b.insert(1, "a"));
+  EXPECT_TRUE(b.insert(2, "b"));
+  EXPECT_FALSE(b.insert(3, "b"));
+  auto before = b.snapshot();
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_TRUE(b.insert(3, "c"));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_THROW(b.at_left(1), std::out_of_range);
+  EXPECT_EQ(b.at_right("c"), 3);
+
+  // snapshot does not see later changes
+  EXPECT_EQ(before.size(), 2);
+  EXPECT_EQ(before.at_left(1), "a");
+  EXPECT_FALSE(before.contains_right("c"));
+  EXPECT_EQ(before.find_right("b")->first, 2);
+  EXPECT_EQ(before.lower_bound_left(2)->second, "b");
+  EXPECT_EQ(before.upper_bound_left(2), before.end_left());
+  b.clear();
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(std::distance(before.begin_right(), before.end_right()), 2);
+}
+
+TEST(bimap_randomized, persistent_compare_to_two_maps) {
+  persistent_bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+  std::vector<std::pair<decltype(b.snapshot()), std::map<int, int>>> versions;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    unsigned int op = e() % 10;
+    int l = e() % 2000, r = e() % 2000;
+    if (op > 4) {
+      bool inserted = b.insert(l, r);
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else {
+      auto it = right_view.find(r);
+      EXPECT_EQ(b.erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    }
+    if (i % 2000 == 0)
+      versions.emplace_back(b.snapshot(), left_view);
+  }
+  versions.emplace_back(b.snapshot(), left_view);
+  for (auto const &[snapshot, expected] : versions) {
+    ASSERT_EQ(snapshot.size(), expected.size());
+    std::map<int, int> got(snapshot.begin_left(), snapshot.end_left());
+    EXPECT_EQ(got, expected);
+    std::map<int, int> got_right;
+    for (auto it = snapshot.begin_right(); it != snapshot.end_right(); ++it) {
+      EXPECT_TRUE(got_right.empty() || got_right.rbegin()->first < it->second);
+      got_right[it->second] = it->first;
+    }
+    EXPECT_EQ(got_right.size(), expected.size());
+  }
+}
+
+TEST(persistent_bimap, concurrent_readers) {
+  persistent_bimap<int, int> b;
+  std::atomic<bool> done = false;
+  std::atomic<size_t> checked = 0;
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; t++)
+    readers.emplace_back([&] {
+      while (!done) {
+        // writer keeps invariant: pairs are (i, -i) for i in [from, to)
+        auto view = b.snapshot();
+        if (view.empty())
+          continue;
+        int from = view.begin_left()->first;
+        int count = 0;
+        for (auto it = view.begin_left(); it != view.end_left(); ++it) {
+          EXPECT_EQ(it->first, from + count);
+          EXPECT_EQ(it->second, -it->first);
+          count++;
+        }
+        EXPECT_EQ(count, view.size());
+        checked++;
+      }
+    });
+  for (int i = 0; i < 3000; i++) {
+    b.insert(i, -i);
+    if (i >= 100)
+      b.erase_right(-(i - 100));
+  }
+  done = true;
+  for (auto &t : readers)
+    t.join();
+  EXPECT_EQ(b.size(), 100);
+}
+
+TEST(concurrent_bimap, simple) {
+  concurrent_bimap<int, std::string> b;
+  EXPECT_TRUE(b.insert(1, "a"));
+  EXPECT_TRUE(b.insert(2, "b"));
+  EXPECT_FALSE(b.insert(3, "a"));
+  EXPECT_EQ(b.find_left(1), "a");
+  EXPECT_EQ(b.find_right("b"), 2);
+  EXPECT_EQ(b.find_left(3), std::nullopt);
+  EXPECT_TRUE(b.replace_right(1, "c"));
+  EXPECT_FALSE(b.replace_right(1, "b"));
+  EXPECT_FALSE(b.contains_right("a"));
+  EXPECT_TRUE(b.erase_right("b"));
+  EXPECT_EQ(b.size(), 1);
+  std::vector<std::pair<int, std::string>> pairs;
+  b.for_each([&](int l, std::string const &r) { pairs.emplace_back(l, r); });
+  EXPECT_EQ(pairs, (std::vector<std::pair<int, std::string>>{{1, "c"}}));
+}
+
+TEST(concurrent_bimap, across_shards) {
+  concurrent_bimap<int, int> b({}, {}, {}, {}, {}, 8);
+  for (int i = 0; i < 100; i++)
+    EXPECT_TRUE(b.insert(i, -i));
+  // most new left values belong to other shard, pair moves there
+  for (int i = 0; i < 100; i += 2)
+    EXPECT_TRUE(b.replace_left(-i, i + 1000));
+  EXPECT_FALSE(b.replace_left(-1, 1000));
+  EXPECT_FALSE(b.replace_left(-1000, 5));
+  for (int i = 1; i < 100; i += 2)
+    EXPECT_TRUE(b.replace_right(i, -i - 1000));
+  EXPECT_FALSE(b.replace_right(1, 0));
+  EXPECT_EQ(b.size(), 100);
+  for (int i = 0; i < 100; i++) {
+    int l = i % 2 == 0 ? i + 1000 : i;
+    int r = i % 2 == 0 ? -i : -i - 1000;
+    EXPECT_EQ(b.find_left(l), r);
+    EXPECT_EQ(b.find_right(r), l);
+  }
+  EXPECT_FALSE(b.contains_left(0));
+  EXPECT_FALSE(b.contains_right(-1));
+  std::vector<int> lefts;
+  b.for_each([&](int l, int) { lefts.push_back(l); });
+  EXPECT_EQ(lefts.size(), 100);
+  EXPECT_TRUE(std::is_sorted(lefts.begin(), lefts.end()));
+  EXPECT_TRUE(b.erase_right(-2));
+  EXPECT_TRUE(b.erase_left(1002 + 2));
+  b.clear();
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(concurrent_bimap, parallel_readers_and_writers) {
+  concurrent_bimap<int, int> b({}, {}, {}, {}, {}, 4);
+  constexpr int n = 2000;
+  std::atomic<bool> done = false;
+  std::vector<std::thread> threads;
+  // writers own disjoint keys, pair (k, -k) is inserted and erased atomically
+  for (int t = 0; t < 2; t++)
+    threads.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      for (int i = 0; i < 4000; i++) {
+        int k = static_cast<int>(e() % (n / 2)) * 2 + t;
+        if (e() % 2 == 0)
+          b.insert(k, -k);
+        else
+          b.erase_right(-k);
+      }
+    });
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back([&, t] {
+      std::mt19937 e(seed + 10 + t);
+      while (!done) {
+        int k = e() % n;
+        auto r = b.find_left(k);
+        if (r.has_value()) {
+          EXPECT_EQ(*r, -k);
+        }
+        auto l = b.find_right(-k);
+        if (l.has_value()) {
+          EXPECT_EQ(*l, k);
+        }
+      }
+    });
+  for (int t = 0; t < 2; t++)
+    threads[t].join();
+  done = true;
+  for (size_t t = 2; t < threads.size(); t++)
+    threads[t].join();
+  size_t count = 0;
+  b.for_each([&](int l, int r) {
+    EXPECT_EQ(r, -l);
+    count++;
+  });
+  EXPECT_EQ(count, b.size());
+}
+
+TEST(sharded_bimap, simple) {
+  sharded_bimap<int, std::string, 4> b;
+  EXPECT_TRUE(b.insert(1, "a"));
+  EXPECT_TRUE(b.insert(2, "b"));
+  EXPECT_FALSE(b.insert(3, "a"));
+  EXPECT_FALSE(b.insert(2, "c"));
+  // lookups do not need mutable access
+  auto const &view = b;
+  EXPECT_EQ(view.find_left(1), "a");
+  EXPECT_EQ(view.find_right("b"), 2);
+  EXPECT_EQ(view.find_right("c"), std::nullopt);
+  EXPECT_TRUE(view.contains_right("a"));
+  EXPECT_TRUE(b.erase_right("a"));
+  EXPECT_FALSE(b.erase_right("a"));
+  EXPECT_TRUE(b.insert(3, "a"));
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_FALSE(view.contains_left(2));
+  EXPECT_FALSE(view.contains_right("b"));
+  EXPECT_EQ(view.size(), 1);
+  b.clear();
+  EXPECT_TRUE(view.empty());
+  EXPECT_TRUE(b.insert(2, "b"));
+}
+
+TEST(sharded_bimap, parallel_uniqueness) {
+  sharded_bimap<int, int, 8> b;
+  constexpr int n = 4000, m = 300;
+  std::atomic<int> inserted = 0;
+  std::vector<std::thread> threads;
+  // lefts of one right value land in different shards, only one may win
+  for (int t = 0; t < 4; t++)
+    threads.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      for (int i = 0; i < n; i++) {
+        int l = e() % n;
+        if (b.insert(l, l % m))
+          inserted++;
+        if (e() % 4 == 0 && b.erase_right(static_cast<int>(e() % m)))
+          inserted--;
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+  EXPECT_EQ(b.size(), static_cast<size_t>(inserted));
+  for (int r = 0; r < m; r++) {
+    auto l = b.find_right(r);
+    if (l.has_value()) {
+      EXPECT_EQ(*l % m, r);
+      EXPECT_EQ(b.find_left(*l), r);
+    }
+  }
+}
+
+template <typename Mapped, typename Map>
+void expect_same_pairs(Mapped const &m, Map const &b) {
+  ASSERT_EQ(m.size(), b.size());
+  auto it = b.begin_left();
+  for (auto l = m.begin_left(); l != m.end_left(); ++l, ++it) {
+    EXPECT_EQ(*l, *it);
+    EXPECT_EQ(*l.flip(), *it.flip());
+    EXPECT_EQ(*l.flip().flip(), *l);
+  }
+  auto jt = b.begin_right();
+  for (auto r = m.begin_right(); r != m.end_right(); ++r, ++jt) {
+    EXPECT_EQ(*r, *jt);
+    EXPECT_EQ(*r.flip(), *jt.flip());
+  }
+}
+
+TEST(mapped_bimap, stream_round_trip) {
+  std::mt19937 e(seed);
+  bimap<int, long long> b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(static_cast<int>(e() % 5000), static_cast<long long>(e()));
+  std::stringstream ss;
+  mapped_bimap<int, long long>::save(b, ss);
+  mapped_bimap<int, long long> m(ss);
+  expect_same_pairs(m, b);
+  for (int i = -1; i < 5001; i++) {
+    auto it = m.find_left(i);
+    EXPECT_EQ(it == m.end_left(), b.find_left(i) == b.end_left());
+    if (it != m.end_left()) {
+      EXPECT_EQ(m.at_left(i), b.at_left(i));
+    }
+    auto lb = m.lower_bound_left(i);
+    EXPECT_EQ(lb == m.end_left(), b.lower_bound_left(i) == b.end_left());
+    if (lb != m.end_left()) {
+      EXPECT_EQ(*lb, *b.lower_bound_left(i));
+    }
+  }
+  auto r = *b.begin_right();
+  EXPECT_EQ(m.at_right(r), b.at_right(r));
+  EXPECT_EQ(*m.upper_bound_right(r), *b.upper_bound_right(r));
+  EXPECT_EQ(m.lower_bound_right(r), m.find_right(r));
+  EXPECT_THROW(m.at_left(-1), std::out_of_range);
+  EXPECT_EQ(m.to_bimap(), b);
+
+  compact_bimap<int, long long> c;
+  for (auto it = b.begin_right(); it != b.end_right(); ++it)
+    c.insert(*it.flip(), *it);
+  std::stringstream cs;
+  mapped_bimap<int, long long>::save(c, cs);
+  EXPECT_EQ(cs.str(), ss.str());
+}
+
+TEST(mapped_bimap, unseekable_stream) {
+  // buffer over string, which can not seek, so size of image is not known
+  struct unseekable : std::streambuf {
+    explicit unseekable(std::string &s) {
+      setg(&s[0], &s[0], &s[0] + s.size());
+    }
+  };
+  bimap<int, int> b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(i, 1000 - i);
+  std::stringstream ss;
+  mapped_bimap<int, int>::save(b, ss);
+  auto image = ss.str();
+  unseekable buf(image);
+  std::istream in(&buf);
+  mapped_bimap<int, int> m(in);
+  m.verify();
+  EXPECT_EQ(m.to_bimap(), b);
+}
+
+TEST(mapped_bimap, mmap_file) {
+  char path[] = "/tmp/bimap-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  bimap<int, double> b;
+  for (int i = 0; i < 300; i++)
+    b.insert(i * 7 % 300, i * 0.5);
+  mapped_bimap<int, double>::save(b, fd);
+  {
+    mapped_bimap<int, double> m(fd);
+    close(fd);
+    expect_same_pairs(m, b);
+    mapped_bimap<int, double> moved(std::move(m));
+    EXPECT_EQ(moved.at_right(10.0), b.at_right(10.0));
+  }
+  mapped_bimap<int, double> m(path);
+  unlink(path);
+  expect_same_pairs(m, b);
+  EXPECT_EQ(m.find_right(0.25), m.end_right());
+
+  std::stringstream empty, bad("not a bimap image at all, definitely not");
+  EXPECT_THROW((mapped_bimap<int, double>(empty)), std::runtime_error);
+  EXPECT_THROW((mapped_bimap<int, double>(bad)), std::runtime_error);
+  std::stringstream ss;
+  mapped_bimap<int, double>::save(b, ss);
+  EXPECT_THROW((mapped_bimap<int, float>(ss)), std::runtime_error);
+}
+
+TEST(mapped_bimap, corrupt_cross_index) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, (i * 37) % 100);
+  std::stringstream ss;
+  mapped_bimap<int, int>::save(b, ss);
+  auto image = ss.str();
+  bimap_helper::image_header h;
+  std::memcpy(&h, image.data(), sizeof(h));
+  // rewrites right index of left value `i` and opens the image, which
+  // checks only bounds of sections
+  auto open_with = [&](std::uint32_t i, std::uint32_t value) {
+    auto copy = image;
+    std::memcpy(&copy[h.offset[2] + i * sizeof(value)], &value,
+                sizeof(value));
+    std::stringstream in(copy);
+    return mapped_bimap<int, int>(in);
+  };
+  EXPECT_NO_THROW(open_with(5, (5 * 37) % 100).verify());
+  EXPECT_NO_THROW(open_with(5, 100));
+  EXPECT_THROW(open_with(5, 100).verify(), std::runtime_error);
+  // still in bounds, but two left values point to one right value
+  EXPECT_THROW(open_with(5, (6 * 37) % 100).verify(), std::runtime_error);
+}
+
+TEST(flat_bimap, simple) {
+  std::vector<std::pair<int, std::string>> pairs{
+      {3, "c"}, {1, "b"}, {2, "a"}, {1, "x"}, {4, "a"}};
+  flat_bimap<int, std::string> f(pairs.begin(), pairs.end());
+  EXPECT_EQ(f.size(), 3);
+  EXPECT_EQ(f.at_left(1), "b");
+  EXPECT_EQ(f.at_right("a"), 2);
+  EXPECT_EQ(f.find_left(4), f.end_left());
+  EXPECT_THROW(f.at_right("x"), std::out_of_range);
+  EXPECT_EQ(*f.lower_bound_right("aa"), "b");
+  EXPECT_EQ(*f.upper_bound_left(2), 3);
+  EXPECT_EQ(f.upper_bound_left(3), f.end_left());
+  EXPECT_EQ(*--f.end_right(), "c");
+  std::vector<int> lefts(f.begin_left(), f.end_left());
+  EXPECT_EQ(lefts, (std::vector<int>{1, 2, 3}));
+
+  flat_bimap<int, std::string> empty(pairs.begin(), pairs.begin());
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.begin_left(), empty.end_left());
+  EXPECT_EQ(empty.lower_bound_right("a"), empty.end_right());
+}
+
+// keys around zero, so unsigned ones wrap to large values
+template <typename L, typename R, typename CL = std::less<L>,
+          typename CR = std::less<R>>
+void check_flat(std::mt19937 &e, int n) {
+  auto key = [&](long long k) { return static_cast<L>(k - 2 * n); };
+  auto rkey = [&](long long k) { return static_cast<R>(k - 2 * n); };
+  bimap<L, R, CL, CR> b;
+  for (int i = 0; i < n; i++)
+    b.insert(key(e() % (4 * n)), rkey(e() % (4 * n)));
+  flat_bimap<L, R, CL, CR> f(b);
+  ASSERT_EQ(f.size(), b.size());
+  auto it = f.begin_left();
+  for (auto jt = b.begin_left(); jt != b.end_left(); ++jt, ++it) {
+    EXPECT_EQ(*it, *jt);
+    EXPECT_EQ(*it.flip(), *jt.flip());
+    EXPECT_EQ(it.flip().flip(), it);
+  }
+  EXPECT_EQ(it, f.end_left());
+  auto rt = f.end_right();
+  for (auto jt = b.end_right(); jt != b.begin_right();) {
+    --jt, --rt;
+    EXPECT_EQ(*rt, *jt);
+    EXPECT_EQ(*rt.flip(), *jt.flip());
+  }
+  auto check = [&](auto got, auto expected, auto got_end, auto exp_end) {
+    ASSERT_EQ(got == got_end, expected == exp_end);
+    if (got != got_end) {
+      EXPECT_EQ(*got, *expected);
+    }
+  };
+  for (long long k = -1; k <= 4 * n; k++) {
+    check(f.find_left(key(k)), b.find_left(key(k)), f.end_left(),
+          b.end_left());
+    check(f.find_right(rkey(k)), b.find_right(rkey(k)), f.end_right(),
+          b.end_right());
+    check(f.lower_bound_left(key(k)), b.lower_bound_left(key(k)),
+          f.end_left(), b.end_left());
+    check(f.upper_bound_left(key(k)), b.upper_bound_left(key(k)),
+          f.end_left(), b.end_left());
+    check(f.lower_bound_right(rkey(k)), b.lower_bound_right(rkey(k)),
+          f.end_right(), b.end_right());
+    check(f.upper_bound_right(rkey(k)), b.upper_bound_right(rkey(k)),
+          f.end_right(), b.end_right());
+  }
+}
+
+TEST(bimap_randomized, flat_compare_to_bimap) {
+  std::mt19937 e(seed);
+  for (int n : {1, 2, 7, 16, 17, 100, 289, 1000, 4097}) {
+    check_flat<int, int>(e, n);
+    check_flat<unsigned, float>(e, n);
+    check_flat<long long, unsigned long long>(e, n);
+    check_flat<double, short>(e, n);
+    check_flat<int, int, std::greater<int>, std::less<>>(e, n);
+  }
+}
+
 TEST(bimap_randomized, invariant_check) {
   std::cout << "Seed used for randomized invariant test is " << seed
             << std::endl;
@@ -0,0 +1,514 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ios>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BIMAP_HAS_MMAP 1
+#else
+#define BIMAP_HAS_MMAP 0
+#endif
+
+#include "bimap.h"
+
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct mapped_bimap;
+
+namespace bimap_helper {
+/**
+ * image of bimap: header followed by sections, each aligned to 64 bytes:
+ * sorted left values, sorted right values, index of right value for every
+ * left one and index of left value for every right one. values are stored
+ * in native byte order, version read in other order does not match
+ */
+struct image_header {
+  static constexpr char signature[8] = {'b', 'i', 'm', 'a', 'p', 'i', 'm', 'g'};
+  static constexpr std::uint32_t current_version = 1;
+  static constexpr std::size_t alignment = 64;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t left_size;
+  std::uint32_t right_size;
+  std::uint32_t index_size;
+  std::uint64_t count;
+  // lefts, rights, right_of_left, left_of_right
+  std::uint64_t offset[4];
+};
+static_assert(sizeof(image_header) == image_header::alignment);
+
+inline std::uint64_t align_image(std::uint64_t n) noexcept {
+  constexpr std::uint64_t mask = image_header::alignment - 1;
+  return (n + mask) & ~mask;
+}
+
+#if BIMAP_HAS_MMAP
+// read only mapping of whole file, unmapped on destruction
+class mapped_file {
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+
+public:
+  mapped_file() = default;
+  explicit mapped_file(int fd) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+      throw std::system_error(errno, std::generic_category(), "fstat");
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ == 0)
+      return;
+    data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+  }
+  mapped_file(mapped_file &&other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+  mapped_file &operator=(mapped_file &&other) noexcept {
+    mapped_file tmp(std::move(other));
+    std::swap(data_, tmp.data_);
+    std::swap(size_, tmp.size_);
+    return *this;
+  }
+  ~mapped_file() {
+    if (data_ != nullptr)
+      ::munmap(data_, size_);
+  }
+
+  char const *data() const noexcept { return static_cast<char const *>(data_); }
+  std::size_t size() const noexcept { return size_; }
+};
+#endif
+
+/**
+ * iterator of mapped_bimap, holds position in sorted array of its side
+ */
+template <typename Map, bool IsLeft> struct mapped_bimap_iterator {
+private:
+  using index_t = typename Map::index_t;
+
+  Map const *map;
+  index_t pos;
+
+public:
+  using value_type =
+      std::conditional_t<IsLeft, typename Map::left_t, typename Map::right_t>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  friend Map;
+
+  mapped_bimap_iterator() = default;
+  mapped_bimap_iterator(Map const *map, index_t pos) noexcept
+      : map(map), pos(pos) {}
+
+  pointer_type operator->() const noexcept {
+    return &map->template key<IsLeft>(pos);
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  mapped_bimap_iterator &operator++() noexcept {
+    pos++;
+    return *this;
+  }
+  mapped_bimap_iterator operator++(int) noexcept {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+  mapped_bimap_iterator &operator--() noexcept {
+    pos--;
+    return *this;
+  }
+  mapped_bimap_iterator operator--(int) noexcept {
+    auto copy = *this;
+    operator--();
+    return copy;
+  }
+
+  auto flip() const noexcept {
+    return mapped_bimap_iterator<Map, !IsLeft>(
+        map, map->template cross<IsLeft>(pos));
+  }
+
+  bool operator==(mapped_bimap_iterator const &r) const noexcept {
+    return pos == r.pos;
+  }
+  bool operator!=(mapped_bimap_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * read only bimap over image written by `save`, lookups are binary searches
+ * in sorted arrays of image, so opening it costs only O(1) validation of
+ * header and section bounds, and pages of mapped file are read on first
+ * touch. image from untrusted source should be checked by `verify`.
+ * image is either mapped from file or read from stream into memory.
+ * comparators must order values as ones of saved bimap did
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+struct mapped_bimap
+    : private bimap_helper::tagged_comparator<CompareLeft>,
+      private bimap_helper::tagged_comparator<
+          CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>> {
+  static_assert(std::is_trivially_copyable_v<Left> &&
+                    std::is_trivially_copyable_v<Right>,
+                "image stores values as raw bytes");
+
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_iterator = bimap_helper::mapped_bimap_iterator<mapped_bimap, true>;
+  using right_iterator =
+      bimap_helper::mapped_bimap_iterator<mapped_bimap, false>;
+
+private:
+  template <typename, bool> friend struct bimap_helper::mapped_bimap_iterator;
+
+  using left_comparator_holder = bimap_helper::tagged_comparator<CompareLeft>;
+  using right_comparator_holder = bimap_helper::tagged_comparator<
+      CompareRight, bimap_helper::second_tag<CompareLeft, CompareRight>>;
+  using header_t = bimap_helper::image_header;
+
+  using index_t = std::uint32_t;
+
+  struct alignas(header_t::alignment) block {
+    char bytes[header_t::alignment];
+  };
+
+#if BIMAP_HAS_MMAP
+  bimap_helper::mapped_file file;
+#endif
+  std::unique_ptr<block[]> owned;
+
+  index_t count = 0;
+  Left const *lefts = nullptr;
+  Right const *rights = nullptr;
+  index_t const *cross_index[2] = {nullptr, nullptr};
+
+  template <bool IsLeft> using key_t = std::conditional_t<IsLeft, Left, Right>;
+  template <bool IsLeft>
+  using iterator_t = bimap_helper::mapped_bimap_iterator<mapped_bimap, IsLeft>;
+
+  template <bool IsLeft> auto const &key(index_t i) const noexcept {
+    if constexpr (IsLeft)
+      return lefts[i];
+    else
+      return rights[i];
+  }
+  template <bool IsLeft> auto const *keys() const noexcept {
+    if constexpr (IsLeft)
+      return lefts;
+    else
+      return rights;
+  }
+  // position of pair in other side, end maps to end
+  template <bool IsLeft> index_t cross(index_t i) const noexcept {
+    return i == count ? count : cross_index[IsLeft ? 0 : 1][i];
+  }
+  template <bool IsLeft> auto const &comparator() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<CompareLeft const &>(
+          static_cast<left_comparator_holder const &>(*this));
+    else
+      return static_cast<CompareRight const &>(
+          static_cast<right_comparator_holder const &>(*this));
+  }
+
+  [[noreturn]] static void bad_image() {
+    throw std::runtime_error("mapped_bimap: bad image");
+  }
+
+  void attach(char const *base, std::size_t size) {
+    header_t h;
+    if (size < sizeof(h))
+      bad_image();
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic, header_t::signature, sizeof(h.magic)) != 0 ||
+        h.version != header_t::current_version ||
+        h.left_size != sizeof(Left) || h.right_size != sizeof(Right) ||
+        h.index_size != sizeof(index_t) ||
+        h.count > std::numeric_limits<index_t>::max())
+      bad_image();
+    std::uint64_t const sizes[4] = {h.count * sizeof(Left),
+                                    h.count * sizeof(Right),
+                                    h.count * sizeof(index_t),
+                                    h.count * sizeof(index_t)};
+    for (int i = 0; i < 4; i++)
+      if (h.offset[i] % header_t::alignment != 0 || h.offset[i] > size ||
+          sizes[i] > size - h.offset[i])
+        bad_image();
+    count = static_cast<index_t>(h.count);
+    lefts = reinterpret_cast<Left const *>(base + h.offset[0]);
+    rights = reinterpret_cast<Right const *>(base + h.offset[1]);
+    cross_index[0] = reinterpret_cast<index_t const *>(base + h.offset[2]);
+    cross_index[1] = reinterpret_cast<index_t const *>(base + h.offset[3]);
+  }
+
+  template <bool IsLeft> index_t find_ge(key_t<IsLeft> const &k) const {
+    return static_cast<index_t>(
+        std::lower_bound(keys<IsLeft>(), keys<IsLeft>() + count, k,
+                         comparator<IsLeft>()) -
+        keys<IsLeft>());
+  }
+  template <bool IsLeft>
+  iterator_t<IsLeft> find_impl(key_t<IsLeft> const &k) const {
+    auto i = find_ge<IsLeft>(k);
+    if (i != count && comparator<IsLeft>()(k, key<IsLeft>(i)))
+      i = count;
+    return iterator_t<IsLeft>(this, i);
+  }
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &k) const {
+    auto it = find_impl<IsLeft>(k);
+    if (it.pos == count)
+      throw std::out_of_range("at_left bad");
+    return *it.flip();
+  }
+  template <bool IsLeft>
+  iterator_t<IsLeft> upper_bound_impl(key_t<IsLeft> const &k) const {
+    return iterator_t<IsLeft>(
+        this, static_cast<index_t>(
+                  std::upper_bound(keys<IsLeft>(), keys<IsLeft>() + count, k,
+                                   comparator<IsLeft>()) -
+                  keys<IsLeft>()));
+  }
+
+  // passes image of `map` to `write(data, size)` piece by piece
+  template <typename Map, typename F>
+  static void write_image(Map const &map, F const &write) {
+    auto left_of_right = bimap_helper::left_ranks<index_t>(map);
+    std::size_t n = left_of_right.size();
+    std::vector<index_t> right_of_left(n);
+    for (std::size_t i = 0; i < n; i++)
+      right_of_left[left_of_right[i]] = static_cast<index_t>(i);
+
+    header_t h{};
+    std::memcpy(h.magic, header_t::signature, sizeof(h.magic));
+    h.version = header_t::current_version;
+    h.left_size = sizeof(Left);
+    h.right_size = sizeof(Right);
+    h.index_size = sizeof(index_t);
+    h.count = n;
+    std::uint64_t const sizes[4] = {n * sizeof(Left), n * sizeof(Right),
+                                    n * sizeof(index_t), n * sizeof(index_t)};
+    std::uint64_t end = sizeof(h);
+    for (int i = 0; i < 4; i++) {
+      h.offset[i] = bimap_helper::align_image(end);
+      end = h.offset[i] + sizes[i];
+    }
+    write(&h, sizeof(h));
+
+    char const zeros[header_t::alignment] = {};
+    std::uint64_t pos = sizeof(h);
+    auto section = [&](int i, auto const &emit) {
+      write(zeros, static_cast<std::size_t>(h.offset[i] - pos));
+      emit();
+      pos = h.offset[i] + sizes[i];
+    };
+    section(0, [&] {
+      for (auto it = map.begin_left(); it != map.end_left(); ++it)
+        write(&*it, sizeof(Left));
+    });
+    section(1, [&] {
+      for (auto it = map.begin_right(); it != map.end_right(); ++it)
+        write(&*it, sizeof(Right));
+    });
+    section(2, [&] { write(right_of_left.data(), n * sizeof(index_t)); });
+    section(3, [&] { write(left_of_right.data(), n * sizeof(index_t)); });
+  }
+
+public:
+  /**
+   * writes image of `map` (bimap, compact_bimap or other container with
+   * the same ordering and iterators with `flip`, see left_ranks)
+   */
+  template <typename Map> static void save(Map const &map, std::ostream &out) {
+    write_image(map, [&](void const *data, std::size_t size) {
+      out.write(static_cast<char const *>(data),
+                static_cast<std::streamsize>(size));
+      if (!out)
+        throw std::ios_base::failure("mapped_bimap: write failed");
+    });
+  }
+
+#if BIMAP_HAS_MMAP
+  template <typename Map> static void save(Map const &map, int fd) {
+    write_image(map, [&](void const *data, std::size_t size) {
+      auto p = static_cast<char const *>(data);
+      while (size != 0) {
+        auto done = ::write(fd, p, size);
+        if (done < 0) {
+          if (errno == EINTR)
+            continue;
+          throw std::system_error(errno, std::generic_category(), "write");
+        }
+        p += done;
+        size -= static_cast<std::size_t>(done);
+      }
+    });
+  }
+
+  // maps image from `fd`, which may be closed afterwards
+  explicit mapped_bimap(int fd, CompareLeft cl = CompareLeft(),
+                        CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)), file(fd) {
+    attach(file.data(), file.size());
+  }
+
+  explicit mapped_bimap(char const *path, CompareLeft cl = CompareLeft(),
+                        CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    try {
+      file = bimap_helper::mapped_file(fd);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+    attach(file.data(), file.size());
+  }
+#endif
+
+  // reads whole image from `in` into memory
+  explicit mapped_bimap(std::istream &in, CompareLeft cl = CompareLeft(),
+                        CompareRight cr = CompareRight())
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)) {
+    // size of seekable stream is known, so image is read into place at once,
+    // other streams are read in growing chunks
+    std::size_t blocks = 0, size = 0;
+    auto start = in.tellg();
+    if (start != std::istream::pos_type(-1) &&
+        in.seekg(0, std::ios_base::end)) {
+      auto bytes = static_cast<std::size_t>(in.tellg() - start);
+      blocks = (bytes + sizeof(block) - 1) / sizeof(block);
+      in.seekg(start);
+    }
+    in.clear();
+    if (blocks != 0)
+      owned.reset(new block[blocks]);
+    for (;;) {
+      auto data = reinterpret_cast<char *>(owned.get());
+      auto capacity = blocks * sizeof(block);
+      in.read(data + size, static_cast<std::streamsize>(capacity - size));
+      size += static_cast<std::size_t>(in.gcount());
+      if (size < capacity ||
+          in.peek() == std::istream::traits_type::eof())
+        break;
+      blocks = std::max<std::size_t>(blocks * 2, 64);
+      std::unique_ptr<block[]> grown(new block[blocks]);
+      if (size != 0)
+        std::memcpy(grown.get(), data, size);
+      owned = std::move(grown);
+    }
+    attach(reinterpret_cast<char const *>(owned.get()), size);
+  }
+
+  /**
+   * O(n) check that cross indexes are permutations inverse to each other,
+   * throws std::runtime_error if not. values are not checked to be sorted.
+   * images written by `save` always pass it, so only images which may be
+   * damaged or forged need it: flip of bad image reads out of bounds
+   */
+  void verify() const {
+    // every flip must stay in bounds and lead back
+    for (index_t i = 0; i < count; i++) {
+      auto j = cross_index[0][i];
+      if (j >= count || cross_index[1][j] != i)
+        bad_image();
+    }
+  }
+
+  // moved from bimap may only be destroyed or assigned to
+  mapped_bimap(mapped_bimap &&) = default;
+  mapped_bimap &operator=(mapped_bimap &&) = default;
+
+  /**
+   * copies pairs into mutable container, left side is already sorted, so
+   * only right one is sorted while building
+   */
+  template <typename Map = bimap<Left, Right, CompareLeft, CompareRight>>
+  Map to_bimap() const {
+    std::vector<std::pair<Left, Right>> pairs;
+    pairs.reserve(count);
+    for (index_t i = 0; i < count; i++)
+      pairs.emplace_back(lefts[i], rights[cross<true>(i)]);
+    return Map(bimap_helper::ordered_left, pairs.begin(), pairs.end(),
+               comparator<true>(), comparator<false>());
+  }
+
+  left_iterator begin_left() const noexcept { return left_iterator(this, 0); }
+  left_iterator end_left() const noexcept {
+    return left_iterator(this, count);
+  }
+  right_iterator begin_right() const noexcept {
+    return right_iterator(this, 0);
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(this, count);
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return find_impl<true>(left);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return find_impl<false>(right);
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(this, find_ge<true>(left));
+  }
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(this, find_ge<false>(right));
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return upper_bound_impl<true>(left);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return upper_bound_impl<false>(right);
+  }
+
+  std::size_t size() const noexcept { return count; }
+  bool empty() const noexcept { return count == 0; }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace bimap_helper {
+struct pool_free_block {
+  pool_free_block *next;
+};
+// blocks of one size and alignment in pool_allocator
+struct pool_bucket {
+  std::size_t size, alignment;
+  std::vector<void *> chunks;
+  pool_free_block *free_list = nullptr;
+  // count of chunks blocks are carved from, the last of them still has
+  // `untouched` never used blocks, the rest of chunks are spare
+  std::size_t used = 0;
+  std::size_t untouched = 0;
+  // count of handed out blocks which are not freed yet
+  std::size_t live = 0;
+
+  pool_bucket(std::size_t size, std::size_t alignment) noexcept
+      : size(size), alignment(alignment) {}
+  pool_bucket(pool_bucket const &) = delete;
+  pool_bucket &operator=(pool_bucket const &) = delete;
+  ~pool_bucket() { release(); }
+
+  // makes every block free, chunks are kept for reuse
+  void reset() noexcept {
+    free_list = nullptr;
+    used = 0;
+    untouched = 0;
+    live = 0;
+  }
+  void release() noexcept {
+    for (auto ch : chunks)
+      ::operator delete(ch, std::align_val_t(alignment));
+    chunks.clear();
+    reset();
+  }
+};
+
+// state shared by copies of pool_allocator, one bucket per block size
+struct pool_state {
+  std::vector<std::unique_ptr<pool_bucket>> buckets;
+};
+
+/**
+ * slab allocator for bimap nodes
+ * hands out single blocks from contiguous chunks and recycles freed blocks
+ * through an intrusive free list. copies, rebound ones too, share the pool
+ * and compare equal, so bimaps using them can exchange nodes by split,
+ * merge and node handles. copy of container gets new pool, so containers
+ * share pool only when it is passed on explicitly. pool is freed with its
+ * last copy, or earlier by `release(owned)` once the caller owns every live
+ * block
+ *
+ * pool is not synchronized, bimaps sharing it must be used from one thread
+ */
+template <typename T, std::size_t ChunkSize = 512> class pool_allocator {
+  static_assert(ChunkSize != 0, "chunk must contain at least one block");
+
+  template <typename, std::size_t> friend class pool_allocator;
+
+  static constexpr std::size_t block_alignment =
+      std::max(alignof(T), alignof(pool_free_block));
+  static constexpr std::size_t block_size =
+      (std::max(sizeof(T), sizeof(pool_free_block)) + block_alignment - 1) /
+      block_alignment * block_alignment;
+
+  std::shared_ptr<pool_state> state;
+  // bucket of `T` in `state`, found on first use
+  pool_bucket *blocks = nullptr;
+
+  pool_bucket *find_bucket() const noexcept {
+    if (blocks != nullptr)
+      return blocks;
+    for (auto &b : state->buckets)
+      if (b->size == block_size && b->alignment == block_alignment)
+        return b.get();
+    return nullptr;
+  }
+  // whether `owned` is the count of live blocks in all buckets
+  bool holds_all(std::size_t owned) const noexcept {
+    std::size_t live = 0;
+    for (auto &b : state->buckets)
+      live += b->live;
+    return live == owned;
+  }
+  pool_bucket &own_bucket() {
+    blocks = find_bucket();
+    if (blocks == nullptr) {
+      auto b = std::make_unique<pool_bucket>(block_size, block_alignment);
+      state->buckets.push_back(std::move(b));
+      blocks = state->buckets.back().get();
+    }
+    return *blocks;
+  }
+
+public:
+  using value_type = T;
+  template <typename U> struct rebind {
+    using other = pool_allocator<U, ChunkSize>;
+  };
+
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  pool_allocator() : state(std::make_shared<pool_state>()) {}
+  // moved from allocator keeps sharing the pool, so it stays usable
+  pool_allocator(pool_allocator const &) noexcept = default;
+  template <typename U>
+  pool_allocator(pool_allocator<U, ChunkSize> const &other) noexcept
+      : state(other.state) {}
+
+  pool_allocator &operator=(pool_allocator const &) noexcept = default;
+
+  // copied container must not share unsynchronized pool with its source
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator();
+  }
+
+  T *allocate(std::size_t n) {
+    if (n != 1)
+      return std::allocator<T>().allocate(n);
+    auto &b = own_bucket();
+    b.live++;
+    if (b.free_list != nullptr) {
+      auto ret = b.free_list;
+      b.free_list = ret->next;
+      return reinterpret_cast<T *>(ret);
+    }
+    if (b.untouched == 0) {
+      if (b.used == b.chunks.size()) {
+        b.chunks.reserve(b.chunks.size() + 1);
+        b.chunks.push_back(::operator new(ChunkSize * block_size,
+                                          std::align_val_t(block_alignment)));
+      }
+      b.used++;
+      b.untouched = ChunkSize;
+    }
+    auto ch = static_cast<unsigned char *>(b.chunks[b.used - 1]);
+    return reinterpret_cast<T *>(ch + --b.untouched * block_size);
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    if (n != 1) {
+      std::allocator<T>().deallocate(p, n);
+      return;
+    }
+    // block was allocated from this pool, so its bucket exists
+    auto b = find_bucket();
+    b->live--;
+    b->free_list =
+        ::new (static_cast<void *>(p)) pool_free_block{b->free_list};
+  }
+
+  /**
+   * makes every block free at once, keeping chunks for reuse, if `owned` is
+   * the count of blocks handed out and not deallocated yet in all buckets,
+   * that is, if nobody but the caller holds a block. those blocks become
+   * invalid, objects inside are not destroyed. returns whether the pool was
+   * reset
+   */
+  bool reset(std::size_t owned = 0) noexcept {
+    if (!holds_all(owned))
+      return false;
+    for (auto &b : state->buckets)
+      b->reset();
+    return true;
+  }
+  // as `reset`, but frees chunks too
+  bool release(std::size_t owned = 0) noexcept {
+    if (!holds_all(owned))
+      return false;
+    for (auto &b : state->buckets)
+      b->release();
+    return true;
+  }
+
+  // bytes of chunks held by the pool
+  std::size_t memory_usage() const noexcept {
+    std::size_t res = 0;
+    for (auto &b : state->buckets)
+      res += b->chunks.size() * ChunkSize * b->size;
+    return res;
+  }
+
+  friend void swap(pool_allocator &a, pool_allocator &b) noexcept {
+    std::swap(a.state, b.state);
+    std::swap(a.blocks, b.blocks);
+  }
+
+  template <typename U>
+  bool operator==(pool_allocator<U, ChunkSize> const &r) const noexcept {
+    return state == r.state;
+  }
+  template <typename U>
+  bool operator!=(pool_allocator<U, ChunkSize> const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+
+template <typename A, typename = void>
+static constexpr bool has_release_v = false;
+template <typename A>
+static constexpr bool
+    has_release_v<A, std::void_t<decltype(std::declval<A &>().release())>> =
+        true;
+} // namespace bimap_helper
@@ -0,0 +1,421 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bimap-helper.h"
+
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class persistent_bimap;
+
+namespace bimap_helper {
+/**
+ * immutable avl node, shared between versions of tree
+ */
+template <typename Value> struct persistent_node {
+  using ptr = std::shared_ptr<persistent_node const>;
+
+  std::shared_ptr<Value const> value;
+  ptr left, right;
+  std::size_t size;
+  int height;
+
+  static std::size_t size_of(ptr const &n) noexcept {
+    return n == nullptr ? 0 : n->size;
+  }
+  static int height_of(ptr const &n) noexcept {
+    return n == nullptr ? 0 : n->height;
+  }
+
+  static ptr make(std::shared_ptr<Value const> value, ptr left, ptr right) {
+    auto size = 1 + size_of(left) + size_of(right);
+    auto height = 1 + std::max(height_of(left), height_of(right));
+    return std::make_shared<persistent_node const>(persistent_node{
+        std::move(value), std::move(left), std::move(right), size, height});
+  }
+
+  /**
+   * new node over subtrees which heights differ by at most 2, rotations copy
+   * at most 3 nodes
+   */
+  static ptr balance(std::shared_ptr<Value const> value, ptr l, ptr r) {
+    auto hl = height_of(l), hr = height_of(r);
+    if (hl > hr + 1) {
+      if (height_of(l->left) >= height_of(l->right))
+        return make(l->value, l->left, make(std::move(value), l->right, r));
+      return make(l->right->value, make(l->value, l->left, l->right->left),
+                  make(std::move(value), l->right->right, r));
+    }
+    if (hr > hl + 1) {
+      if (height_of(r->right) >= height_of(r->left))
+        return make(r->value, make(std::move(value), l, r->left), r->right);
+      return make(r->left->value, make(std::move(value), l, r->left->left),
+                  make(r->value, r->left->right, r->right));
+    }
+    return make(std::move(value), std::move(l), std::move(r));
+  }
+
+  static ptr erase_min(ptr const &t) {
+    if (t->left == nullptr)
+      return t->right;
+    return balance(t->value, erase_min(t->left), t->right);
+  }
+
+  // joins subtrees of removed node
+  static ptr join(ptr const &l, ptr const &r) {
+    if (l == nullptr)
+      return r;
+    if (r == nullptr)
+      return l;
+    auto min = r.get();
+    while (min->left != nullptr)
+      min = min->left.get();
+    return balance(min->value, l, erase_min(r));
+  }
+};
+
+/**
+ * in order iterator over persistent tree, keeps path from root since nodes
+ * have no parent links. valid while version it was taken from is alive
+ */
+template <typename Node> class persistent_iterator {
+  // current node on top, below are ancestors which are greater than it
+  std::vector<Node const *> path;
+
+  template <typename, typename, typename, typename>
+  friend class persistent_view;
+
+  void push_left_spine(Node const *n) {
+    for (; n != nullptr; n = n->left.get())
+      path.push_back(n);
+  }
+
+public:
+  using value_type =
+      std::remove_const_t<typename decltype(Node::value)::element_type>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::forward_iterator_tag;
+
+  persistent_iterator() = default;
+
+  pointer_type operator->() const noexcept {
+    return path.back()->value.get();
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  persistent_iterator &operator++() {
+    auto cur = path.back();
+    path.pop_back();
+    push_left_spine(cur->right.get());
+    return *this;
+  }
+  persistent_iterator operator++(int) {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+
+  bool operator==(persistent_iterator const &r) const noexcept {
+    if (path.empty() || r.path.empty())
+      return path.empty() == r.path.empty();
+    return path.back() == r.path.back();
+  }
+  bool operator!=(persistent_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+
+/**
+ * immutable version of persistent_bimap. copying is O(1), versions share
+ * nodes, so views may be read from any thread without locks. only taking
+ * a view by `persistent_bimap::snapshot` synchronizes
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+class persistent_view
+    : private tagged_comparator<CompareLeft>,
+      private tagged_comparator<CompareRight,
+                                second_tag<CompareLeft, CompareRight>> {
+public:
+  using left_t = Left;
+  using right_t = Right;
+  using value_type = std::pair<Left, Right>;
+
+protected:
+  using left_comparator_holder = tagged_comparator<CompareLeft>;
+  using right_comparator_holder =
+      tagged_comparator<CompareRight, second_tag<CompareLeft, CompareRight>>;
+  using node = persistent_node<value_type>;
+  using node_ptr = typename node::ptr;
+
+  struct state {
+    node_ptr left, right;
+  };
+  std::shared_ptr<state const> st;
+
+  template <bool IsLeft> static auto const &key(value_type const &v) noexcept {
+    if constexpr (IsLeft)
+      return v.first;
+    else
+      return v.second;
+  }
+  template <bool IsLeft> auto const &comparator() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<CompareLeft const &>(
+          static_cast<left_comparator_holder const &>(*this));
+    else
+      return static_cast<CompareRight const &>(
+          static_cast<right_comparator_holder const &>(*this));
+  }
+  template <bool IsLeft> using key_t = std::conditional_t<IsLeft, Left, Right>;
+
+  template <bool IsLeft> node const *root() const noexcept {
+    if (st == nullptr)
+      return nullptr;
+    return IsLeft ? st->left.get() : st->right.get();
+  }
+
+  template <bool IsLeft> node const *find_node(key_t<IsLeft> const &k) const {
+    auto const &c = comparator<IsLeft>();
+    auto cur = root<IsLeft>();
+    while (cur != nullptr) {
+      auto const &ck = key<IsLeft>(*cur->value);
+      if (c(k, ck))
+        cur = cur->left.get();
+      else if (c(ck, k))
+        cur = cur->right.get();
+      else
+        return cur;
+    }
+    return nullptr;
+  }
+
+  /**
+   * first element not less (`Strict`: greater) than `k`
+   */
+  template <bool IsLeft, bool Strict = false>
+  persistent_iterator<node> bound(key_t<IsLeft> const &k) const {
+    auto const &c = comparator<IsLeft>();
+    persistent_iterator<node> res;
+    for (auto cur = root<IsLeft>(); cur != nullptr;) {
+      auto const &ck = key<IsLeft>(*cur->value);
+      if (Strict ? c(k, ck) : !c(ck, k)) {
+        res.path.push_back(cur);
+        cur = cur->left.get();
+      } else {
+        cur = cur->right.get();
+      }
+    }
+    return res;
+  }
+
+  template <bool IsLeft>
+  persistent_iterator<node> find_impl(key_t<IsLeft> const &k) const {
+    auto res = bound<IsLeft>(k);
+    if (!res.path.empty() &&
+        comparator<IsLeft>()(k, key<IsLeft>(*res.path.back()->value)))
+      return {};
+    return res;
+  }
+
+  template <bool IsLeft> persistent_iterator<node> begin_impl() const {
+    persistent_iterator<node> res;
+    res.push_left_spine(root<IsLeft>());
+    return res;
+  }
+
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &k) const {
+    auto found = find_node<IsLeft>(k);
+    if (found == nullptr)
+      throw std::out_of_range("at_left bad");
+    return key<!IsLeft>(*found->value);
+  }
+
+  friend class persistent_bimap<Left, Right, CompareLeft, CompareRight>;
+  persistent_view(CompareLeft cl, CompareRight cr,
+                  std::shared_ptr<state const> st)
+      : left_comparator_holder(std::move(cl)),
+        right_comparator_holder(std::move(cr)), st(std::move(st)) {}
+
+public:
+  // elements are pairs, ordered by their left or right values
+  using left_iterator = persistent_iterator<node>;
+  using right_iterator = persistent_iterator<node>;
+
+  left_iterator begin_left() const { return begin_impl<true>(); }
+  left_iterator end_left() const noexcept { return {}; }
+  right_iterator begin_right() const { return begin_impl<false>(); }
+  right_iterator end_right() const noexcept { return {}; }
+
+  left_iterator find_left(left_t const &left) const {
+    return find_impl<true>(left);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return find_impl<false>(right);
+  }
+  left_iterator lower_bound_left(left_t const &left) const {
+    return bound<true>(left);
+  }
+  right_iterator lower_bound_right(right_t const &right) const {
+    return bound<false>(right);
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return bound<true, true>(left);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return bound<false, true>(right);
+  }
+
+  bool contains_left(left_t const &left) const {
+    return find_node<true>(left) != nullptr;
+  }
+  bool contains_right(right_t const &right) const {
+    return find_node<false>(right) != nullptr;
+  }
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  std::size_t size() const noexcept {
+    auto r = root<true>();
+    return r == nullptr ? 0 : r->size;
+  }
+  bool empty() const noexcept { return size() == 0; }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap with persistent trees: updates copy O(log n) nodes on path to
+ * changed ones and never modify shared nodes, so `snapshot` is O(1) and
+ * snapshots stay consistent while bimap is modified. one writer, any
+ * number of threads reading snapshots
+ */
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+class persistent_bimap
+    : public bimap_helper::persistent_view<Left, Right, CompareLeft,
+                                           CompareRight> {
+public:
+  using view =
+      bimap_helper::persistent_view<Left, Right, CompareLeft, CompareRight>;
+  using typename view::left_t;
+  using typename view::right_t;
+  using typename view::value_type;
+
+private:
+  using typename view::node;
+  using typename view::node_ptr;
+  using typename view::state;
+  template <bool IsLeft> using key_t = typename view::template key_t<IsLeft>;
+
+  template <bool IsLeft>
+  node_ptr insert_rec(node_ptr const &t,
+                      std::shared_ptr<value_type const> const &v) const {
+    if (t == nullptr)
+      return node::make(v, nullptr, nullptr);
+    if (this->template comparator<IsLeft>()(
+            view::template key<IsLeft>(*v),
+            view::template key<IsLeft>(*t->value)))
+      return node::balance(t->value, insert_rec<IsLeft>(t->left, v), t->right);
+    return node::balance(t->value, t->left, insert_rec<IsLeft>(t->right, v));
+  }
+
+  // key must be present
+  template <bool IsLeft>
+  node_ptr erase_rec(node_ptr const &t, key_t<IsLeft> const &k) const {
+    auto const &c = this->template comparator<IsLeft>();
+    auto const &ck = view::template key<IsLeft>(*t->value);
+    if (c(k, ck))
+      return node::balance(t->value, erase_rec<IsLeft>(t->left, k), t->right);
+    if (c(ck, k))
+      return node::balance(t->value, t->left, erase_rec<IsLeft>(t->right, k));
+    return node::join(t->left, t->right);
+  }
+
+  // new version becomes visible to `snapshot` at once
+  void publish(node_ptr left, node_ptr right) {
+    auto next = std::make_shared<state const>(
+        state{std::move(left), std::move(right)});
+    std::atomic_store(&this->st, std::shared_ptr<state const>(next));
+  }
+
+  node_ptr const &left_root() const noexcept {
+    static node_ptr const none;
+    return this->st == nullptr ? none : this->st->left;
+  }
+  node_ptr const &right_root() const noexcept {
+    static node_ptr const none;
+    return this->st == nullptr ? none : this->st->right;
+  }
+
+  template <bool IsLeft> bool erase_impl(key_t<IsLeft> const &k) {
+    auto found = this->template find_node<IsLeft>(k);
+    if (found == nullptr)
+      return false;
+    // keeps pair alive while both trees are rebuilt
+    auto value = found->value;
+    publish(erase_rec<true>(left_root(), value->first),
+            erase_rec<false>(right_root(), value->second));
+    return true;
+  }
+
+public:
+  persistent_bimap(CompareLeft cl = CompareLeft(),
+                   CompareRight cr = CompareRight())
+      : view(std::move(cl), std::move(cr), nullptr) {}
+
+  template <typename InputIt>
+  persistent_bimap(InputIt first, InputIt last, CompareLeft cl = CompareLeft(),
+                   CompareRight cr = CompareRight())
+      : persistent_bimap(std::move(cl), std::move(cr)) {
+    for (; first != last; ++first)
+      insert(std::get<0>(*first), std::get<1>(*first));
+  }
+
+  /**
+   * current version, O(1). may be called concurrently with modifications.
+   * atomic access to shared_ptr is not lock-free in common standard
+   * libraries, so it briefly takes an internal lock shared with `publish`,
+   * reading the returned view takes none
+   */
+  view snapshot() const {
+    return view(this->template comparator<true>(),
+                this->template comparator<false>(),
+                std::atomic_load(&this->st));
+  }
+
+  /**
+   * returns false if pair clashes with existing one. strong exception
+   * guarantee: nothing changes if allocation throws
+   */
+  bool insert(left_t l, right_t r) {
+    if (this->contains_left(l) || this->contains_right(r))
+      return false;
+    auto value =
+        std::make_shared<value_type const>(std::move(l), std::move(r));
+    publish(insert_rec<true>(left_root(), value),
+            insert_rec<false>(right_root(), value));
+    return true;
+  }
+
+  bool erase_left(left_t const &left) { return erase_impl<true>(left); }
+  bool erase_right(right_t const &right) { return erase_impl<false>(right); }
+
+  void clear() {
+    std::atomic_store(&this->st, std::shared_ptr<state const>());
+  }
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "bimap.h"
+#include "hash-index.h"
+
+namespace bimap_helper {
+// fibonacci hashing, so weak hashes still spread over all `n` shards
+inline std::size_t shard_of(std::size_t h, std::size_t n) noexcept {
+  return static_cast<std::size_t>(
+      ((static_cast<std::uint64_t>(h) * 0x9E3779B97F4A7C15ull) >> 32) % n);
+}
+template <std::size_t N> std::size_t shard_of(std::size_t h) noexcept {
+  return shard_of(h, N);
+}
+
+/**
+ * directory entry points to right value inside node of shard. it is read
+ * only under stripe lock, and node is not destroyed before its entry is
+ * erased under the same lock
+ */
+template <typename Right> struct shard_entry {
+  Right const *right = nullptr;
+  std::size_t shard = 0;
+
+  friend bool operator==(shard_entry const &a, shard_entry const &b) noexcept {
+    return a.right == b.right && a.shard == b.shard;
+  }
+  friend bool operator!=(shard_entry const &a, shard_entry const &b) noexcept {
+    return !(a == b);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap split into `N` shards by hash of left value, each with its own lock,
+ * so operations on different shards run in parallel. right values are
+ * tracked by directory, which is split into `N` stripes by hash of right
+ * value and maps each right value to shard holding its pair. thus every
+ * lookup probes exactly one shard and both sides stay unique globally.
+ *
+ * lock order is shard, then stripe. operations which start from right value
+ * read directory first, release it and retry if pair moved meanwhile
+ */
+template <typename Left, typename Right, std::size_t N = 16,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+class sharded_bimap {
+  static_assert(N > 0, "sharded_bimap needs at least one shard");
+
+public:
+  using map_t = bimap<Left, Right, CompareLeft, CompareRight>;
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  using entry = bimap_helper::shard_entry<Right>;
+
+  struct alignas(64) shard {
+    mutable std::mutex mutex;
+    map_t map;
+  };
+  struct alignas(64) stripe {
+    mutable std::mutex mutex;
+    bimap_helper::hash_table<entry> table;
+  };
+
+  std::array<shard, N> shards;
+  std::array<stripe, N> stripes;
+  CompareRight compare_right;
+  HashLeft hash_left;
+  HashRight hash_right;
+
+  entry find_entry(stripe const &st, right_t const &right,
+                   std::size_t h) const {
+    return st.table.find(h, [&](entry e) {
+      return !compare_right(right, *e.right) &&
+             !compare_right(*e.right, right);
+    });
+  }
+
+  // shard holding `right` at the moment of call, `N` if there is none
+  std::size_t locate(right_t const &right, std::size_t h) const {
+    auto &st = stripes[bimap_helper::shard_of<N>(h)];
+    std::lock_guard<std::mutex> lock(st.mutex);
+    auto e = find_entry(st, right, h);
+    return e.right == nullptr ? N : e.shard;
+  }
+
+  /**
+   * calls `f(s, it)` under lock of shard `s` holding `right`, returns
+   * std::nullopt if there is no such value
+   */
+  template <typename F>
+  auto with_right(right_t const &right, F const &f) const
+      -> std::optional<decltype(f(N, shards[0].map.end_right()))> {
+    auto h = hash_right(right);
+    for (;;) {
+      auto s = locate(right, h);
+      if (s == N)
+        return std::nullopt;
+      auto &sh = shards[s];
+      std::lock_guard<std::mutex> lock(sh.mutex);
+      auto it = sh.map.find_right(right);
+      // pair was erased or moved to other shard after directory was read
+      if (it == sh.map.end_right())
+        continue;
+      return f(s, it);
+    }
+  }
+
+public:
+  explicit sharded_bimap(CompareLeft cl = CompareLeft(),
+                         CompareRight cr = CompareRight(),
+                         HashLeft hl = HashLeft(), HashRight hr = HashRight())
+      : compare_right(cr), hash_left(std::move(hl)),
+        hash_right(std::move(hr)) {
+    for (auto &sh : shards)
+      sh.map = map_t(cl, cr);
+  }
+
+  sharded_bimap(sharded_bimap const &) = delete;
+  sharded_bimap &operator=(sharded_bimap const &) = delete;
+
+  // returns false if pair clashes with existing one
+  bool insert(left_t left, right_t right) {
+    auto s = bimap_helper::shard_of<N>(hash_left(left));
+    auto h = hash_right(right);
+    auto &sh = shards[s];
+    auto &st = stripes[bimap_helper::shard_of<N>(h)];
+    std::lock_guard<std::mutex> shard_lock(sh.mutex);
+    std::lock_guard<std::mutex> stripe_lock(st.mutex);
+    if (find_entry(st, right, h).right != nullptr)
+      return false;
+    // after this directory insertion can not throw
+    st.table.reserve(st.table.size() + 1);
+    auto it = sh.map.insert(std::move(left), std::move(right));
+    if (it == sh.map.end_left())
+      return false;
+    st.table.insert(entry{&*it.flip(), s}, h);
+    return true;
+  }
+
+  bool erase_left(left_t const &left) {
+    auto s = bimap_helper::shard_of<N>(hash_left(left));
+    auto &sh = shards[s];
+    std::lock_guard<std::mutex> shard_lock(sh.mutex);
+    auto it = sh.map.find_left(left);
+    if (it == sh.map.end_left())
+      return false;
+    auto const &right = *it.flip();
+    auto h = hash_right(right);
+    auto &st = stripes[bimap_helper::shard_of<N>(h)];
+    std::lock_guard<std::mutex> stripe_lock(st.mutex);
+    st.table.erase(entry{&right, s}, h);
+    sh.map.erase_left(it);
+    return true;
+  }
+
+  bool erase_right(right_t const &right) {
+    auto erased = with_right(right, [&](std::size_t s, auto it) {
+      auto h = hash_right(right);
+      auto &st = stripes[bimap_helper::shard_of<N>(h)];
+      std::lock_guard<std::mutex> stripe_lock(st.mutex);
+      st.table.erase(entry{&*it, s}, h);
+      shards[s].map.erase_right(it);
+      return true;
+    });
+    return erased.has_value();
+  }
+
+  std::optional<right_t> find_left(left_t const &left) const {
+    auto &sh = shards[bimap_helper::shard_of<N>(hash_left(left))];
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    auto it = sh.map.find_left(left);
+    if (it == sh.map.end_left())
+      return std::nullopt;
+    return *it.flip();
+  }
+  std::optional<left_t> find_right(right_t const &right) const {
+    return with_right(right,
+                      [](std::size_t, auto it) { return *it.flip(); });
+  }
+
+  bool contains_left(left_t const &left) const {
+    auto &sh = shards[bimap_helper::shard_of<N>(hash_left(left))];
+    std::lock_guard<std::mutex> lock(sh.mutex);
+    return sh.map.find_left(left) != sh.map.end_left();
+  }
+  // directory alone is enough, it changes together with shards
+  bool contains_right(right_t const &right) const {
+    return locate(right, hash_right(right)) != N;
+  }
+
+  /**
+   * sum of shard sizes, each read under its own lock, so it is exact only
+   * when there are no concurrent modifications
+   */
+  std::size_t size() const {
+    std::size_t res = 0;
+    for (auto &sh : shards) {
+      std::lock_guard<std::mutex> lock(sh.mutex);
+      res += sh.map.size();
+    }
+    return res;
+  }
+  bool empty() const { return size() == 0; }
+
+  void clear() {
+    for (auto &sh : shards)
+      sh.mutex.lock();
+    for (auto &st : stripes)
+      st.mutex.lock();
+    for (auto &st : stripes) {
+      st.table.clear();
+      st.mutex.unlock();
+    }
+    for (auto &sh : shards) {
+      sh.map.clear();
+      sh.mutex.unlock();
+    }
+  }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace bimap_helper {
+/**
+ * comparator is plain `<` on arithmetic type, so values can be compared by
+ * vector instructions
+ */
+template <typename Key, typename Compare>
+static constexpr bool plain_less_v =
+    std::is_arithmetic_v<Key> && !std::is_same_v<Key, bool> &&
+    (std::is_same_v<Compare, std::less<Key>> ||
+     std::is_same_v<Compare, std::less<>>);
+
+#if defined(__SSE2__)
+// vector types lose alignment attributes as template arguments, it does
+// not matter for values passed in registers
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wignored-attributes"
+#endif
+
+template <typename Key> static constexpr bool simd_rank_v = [] {
+  if constexpr (std::is_floating_point_v<Key>)
+    return std::is_same_v<Key, float> || std::is_same_v<Key, double>;
+  else if constexpr (sizeof(Key) == 4)
+    return true;
+#if defined(__SSE4_2__)
+  else if constexpr (sizeof(Key) == 8)
+    return true;
+#endif
+  else
+    return false;
+}();
+
+// compares `x` with 128 (256) bit vector of values, returns mask of lanes
+template <bool Upper, typename Key, typename V>
+V compare_lanes(V keys, V x) noexcept {
+  if constexpr (std::is_same_v<V, __m128i>) {
+    if constexpr (sizeof(Key) == 4)
+      return Upper ? _mm_cmpgt_epi32(keys, x) : _mm_cmpgt_epi32(x, keys);
+#if defined(__SSE4_2__)
+    else
+      return Upper ? _mm_cmpgt_epi64(keys, x) : _mm_cmpgt_epi64(x, keys);
+#endif
+  } else if constexpr (std::is_same_v<V, __m128>) {
+    return Upper ? _mm_cmpgt_ps(keys, x) : _mm_cmplt_ps(keys, x);
+  } else if constexpr (std::is_same_v<V, __m128d>) {
+    return Upper ? _mm_cmpgt_pd(keys, x) : _mm_cmplt_pd(keys, x);
+  }
+#if defined(__AVX2__)
+  else if constexpr (std::is_same_v<V, __m256i>) {
+    if constexpr (sizeof(Key) == 4)
+      return Upper ? _mm256_cmpgt_epi32(keys, x)
+                   : _mm256_cmpgt_epi32(x, keys);
+    else
+      return Upper ? _mm256_cmpgt_epi64(keys, x)
+                   : _mm256_cmpgt_epi64(x, keys);
+  } else if constexpr (std::is_same_v<V, __m256>) {
+    return _mm256_cmp_ps(keys, x, Upper ? _CMP_GT_OQ : _CMP_LT_OQ);
+  } else {
+    return _mm256_cmp_pd(keys, x, Upper ? _CMP_GT_OQ : _CMP_LT_OQ);
+  }
+#endif
+}
+
+template <typename V> unsigned lane_bits(V mask) noexcept {
+  if constexpr (std::is_same_v<V, __m128i>)
+    return static_cast<unsigned>(_mm_movemask_epi8(mask));
+  else if constexpr (std::is_same_v<V, __m128>)
+    return static_cast<unsigned>(_mm_movemask_ps(mask));
+  else if constexpr (std::is_same_v<V, __m128d>)
+    return static_cast<unsigned>(_mm_movemask_pd(mask));
+#if defined(__AVX2__)
+  else if constexpr (std::is_same_v<V, __m256i>)
+    return static_cast<unsigned>(_mm256_movemask_epi8(mask));
+  else if constexpr (std::is_same_v<V, __m256>)
+    return static_cast<unsigned>(_mm256_movemask_ps(mask));
+  else
+    return static_cast<unsigned>(_mm256_movemask_pd(mask));
+#endif
+}
+
+template <typename V, typename Key> V broadcast(Key x) noexcept {
+  if constexpr (std::is_same_v<V, __m128i>) {
+    if constexpr (sizeof(Key) == 4)
+      return _mm_set1_epi32(static_cast<std::int32_t>(x));
+    else
+      return _mm_set1_epi64x(static_cast<std::int64_t>(x));
+  } else if constexpr (std::is_same_v<V, __m128>) {
+    return _mm_set1_ps(x);
+  } else if constexpr (std::is_same_v<V, __m128d>) {
+    return _mm_set1_pd(x);
+  }
+#if defined(__AVX2__)
+  else if constexpr (std::is_same_v<V, __m256i>) {
+    if constexpr (sizeof(Key) == 4)
+      return _mm256_set1_epi32(static_cast<std::int32_t>(x));
+    else
+      return _mm256_set1_epi64x(static_cast<std::int64_t>(x));
+  } else if constexpr (std::is_same_v<V, __m256>) {
+    return _mm256_set1_ps(x);
+  } else {
+    return _mm256_set1_pd(x);
+  }
+#endif
+}
+
+template <typename V, typename Key> V load_lanes(Key const *p) noexcept {
+  if constexpr (std::is_same_v<V, __m128i>)
+    return _mm_load_si128(reinterpret_cast<__m128i const *>(p));
+  else if constexpr (std::is_same_v<V, __m128>)
+    return _mm_load_ps(p);
+  else if constexpr (std::is_same_v<V, __m128d>)
+    return _mm_load_pd(p);
+#if defined(__AVX2__)
+  else if constexpr (std::is_same_v<V, __m256i>)
+    return _mm256_load_si256(reinterpret_cast<__m256i const *>(p));
+  else if constexpr (std::is_same_v<V, __m256>)
+    return _mm256_load_ps(p);
+  else
+    return _mm256_load_pd(p);
+#endif
+}
+
+#if defined(__AVX2__)
+using simd_float_t = __m256;
+using simd_double_t = __m256d;
+using simd_int_t = __m256i;
+#else
+using simd_float_t = __m128;
+using simd_double_t = __m128d;
+using simd_int_t = __m128i;
+#endif
+template <typename Key>
+using simd_vector_t = std::conditional_t<
+    std::is_same_v<Key, float>, simd_float_t,
+    std::conditional_t<std::is_same_v<Key, double>, simd_double_t,
+                       simd_int_t>>;
+
+// unsigned values are compared as signed ones after flip of sign bit
+template <typename Key> auto biased(Key x) noexcept {
+  if constexpr (std::is_unsigned_v<Key>) {
+    using signed_t = std::make_signed_t<Key>;
+    return static_cast<signed_t>(x ^ (Key(1) << (sizeof(Key) * 8 - 1)));
+  } else {
+    return x;
+  }
+}
+template <typename Key, typename V> V biased_lanes(V keys) noexcept {
+  if constexpr (std::is_unsigned_v<Key>) {
+    auto sign = broadcast<V>(
+        std::numeric_limits<std::make_signed_t<Key>>::min());
+#if defined(__AVX2__)
+    return _mm256_xor_si256(keys, sign);
+#else
+    return _mm_xor_si128(keys, sign);
+#endif
+  } else {
+    return keys;
+  }
+}
+#else
+template <typename Key> static constexpr bool simd_rank_v = false;
+#endif
+
+/**
+ * count of `B` values of aligned `block` which are less than `x` (not
+ * greater, if `Upper`). integers of 4 and 8 bytes, floats and doubles are
+ * compared by one vector instruction per 16 (32 with avx2) bytes, other
+ * types by loop which compiler may vectorize by itself
+ */
+template <bool Upper, std::size_t B, typename Key>
+unsigned block_rank(Key const *block, Key const &x) noexcept {
+#if defined(__SSE2__)
+  if constexpr (simd_rank_v<Key>) {
+    using vector_t = simd_vector_t<Key>;
+    constexpr std::size_t lanes = sizeof(vector_t) / sizeof(Key);
+    // movemask of integer vector gives bit per byte
+    constexpr unsigned bits_per_lane =
+        std::is_integral_v<Key> ? static_cast<unsigned>(sizeof(Key)) : 1;
+    static_assert(B % lanes == 0);
+    auto xv = broadcast<vector_t>(biased(x));
+    unsigned count = 0;
+    for (std::size_t j = 0; j < B; j += lanes) {
+      auto keys = biased_lanes<Key>(load_lanes<vector_t>(block + j));
+      count += static_cast<unsigned>(
+          __builtin_popcount(lane_bits(compare_lanes<Upper, Key>(keys, xv))));
+    }
+    count /= bits_per_lane;
+    return Upper ? static_cast<unsigned>(B) - count : count;
+  }
+#endif
+  unsigned count = 0;
+  for (std::size_t j = 0; j < B; j++)
+    count += Upper ? !(x < block[j]) : block[j] < x;
+  return count;
+}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+} // namespace bimap_helper
@@ -1,14 +1,19 @@
 #pragma once
 
-#include <cassert>
+#include <cstddef>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
 #include <string>
 
-template <typename T, typename C>
-static constexpr bool is_nothrow_comparable_v = noexcept(
-    std::declval<C>()(std::declval<T const &>(), std::declval<T const &>()));
+// `K` is type of searched key, it differs from `T` for transparent `C`
+template <typename T, typename C, typename K = T>
+static constexpr bool is_nothrow_comparable_v =
+    noexcept(std::declval<C>()(std::declval<K const &>(),
+                               std::declval<T const &>())) &&
+    noexcept(std::declval<C>()(std::declval<T const &>(),
+                               std::declval<K const &>()));
 
 namespace splay {
 template <typename T> struct default_tag_t {};
@@ -21,6 +26,8 @@ template <typename T> struct default_tag2_t {};
  */
 template <typename Tag> struct splay_node {
   mutable splay_node *left = nullptr, *right = nullptr, *up = nullptr;
+  // count of nodes in subtree, for order statistics
+  mutable std::size_t size = 1;
 
 #if 0
     template<splay_node* splay_node::* getter>
@@ -40,6 +47,11 @@ template <typename Tag> struct splay_node {
 #endif
 
 private:
+  static std::size_t size_of(splay_node const *n) noexcept {
+    return n == nullptr ? 0 : n->size;
+  }
+  void update() const noexcept { size = 1 + size_of(left) + size_of(right); }
+
   template <splay_node *splay_node::*getter> void rotate() const noexcept {
     constexpr auto cogetter = cogetter_v<getter>;
     auto p = up;
@@ -59,6 +71,8 @@ private:
     r->up = p;
     if (auto got = this->*cogetter; got != nullptr)
       got->up = const_cast<splay_node *>(this);
+    update();
+    r->update();
   }
 
 public:
@@ -88,28 +102,29 @@ public:
     return this;
   }
 
-  template <splay_node *splay_node::*getter>
+  template <splay_node *splay_node::*getter, bool Splay = true>
   splay_node const *left_right_most() const noexcept {
     auto cur = this;
     while (cur->*getter != nullptr)
       cur = cur->*getter;
-    return cur->splay();
+    if constexpr (Splay)
+      return cur->splay();
+    else
+      return cur;
   }
 
-  template <splay_node *splay_node::*getter>
+  template <splay_node *splay_node::*getter, bool Splay = true>
   splay_node const *next_prev_impl() const noexcept {
     constexpr auto cogetter = cogetter_v<getter>;
     if (auto r = this->*getter; r != nullptr)
-      return r->template left_right_most<cogetter>();
-    if (up == nullptr)
-      return nullptr;
+      return r->template left_right_most<cogetter, Splay>();
     auto prev = this;
     auto cur = up;
     while (cur != nullptr && cur->*getter == prev) {
       prev = cur;
       cur = cur->up;
     }
-    return cur ?: prev;
+    return cur;
   }
   splay_node const *next() const noexcept {
     return next_prev_impl<&splay_node::right>();
@@ -125,6 +140,168 @@ public:
     return left_right_most<&splay_node::right>();
   }
 
+  // first and last elements of whole tree
+  splay_node const *front() const noexcept {
+    splay();
+    return left_most();
+  }
+  splay_node const *back() const noexcept {
+    splay();
+    return right_most();
+  }
+
+  /**
+   * `frozen` functions never restructure the tree, so they may be called
+   * concurrently. they are cheap only if tree is balanced
+   */
+  splay_node const *top() const noexcept {
+    auto cur = this;
+    while (cur->up != nullptr)
+      cur = cur->up;
+    return cur;
+  }
+  splay_node const *next_frozen() const noexcept {
+    return next_prev_impl<&splay_node::right, false>();
+  }
+  splay_node const *prev_frozen() const noexcept {
+    return next_prev_impl<&splay_node::left, false>();
+  }
+  splay_node const *left_most_frozen() const noexcept {
+    return top()->template left_right_most<&splay_node::left, false>();
+  }
+  splay_node const *right_most_frozen() const noexcept {
+    return top()->template left_right_most<&splay_node::right, false>();
+  }
+
+  /**
+   * top down splay of the tree whose top is `top`: path to target is
+   * restructured during the single descent, only spines of split parts are
+   * walked again to fix sizes and parents, parent links are not read.
+   * `dir(node)` is negative if target is less than node, positive if greater
+   * and zero on target. `top` is set to new top of the tree, also if `dir`
+   * throws. returns whether it is the least node not less than target,
+   * otherwise whole tree is less than target
+   */
+  template <typename F>
+  static bool splay_down_ge(splay_node const *&top, F const &dir) noexcept(
+      noexcept(dir(std::declval<splay_node const *>()))) {
+    auto t = const_cast<splay_node *>(top);
+    // header.right is tree of nodes less than target, header.left of greater
+    splay_node header;
+    splay_node *l = &header, *r = &header;
+    // node above `r` in right part
+    splay_node *r_up = &header;
+    std::size_t l_size = 0, r_size = 0;
+    bool less = false;
+
+    auto assemble = [&]() noexcept {
+      l_size += size_of(t->left);
+      r_size += size_of(t->right);
+      l->right = t->left;
+      r->left = t->right;
+      if (l != &header)
+        for (auto y = header.right;; y = y->right) {
+          y->size = l_size;
+          l_size -= 1 + size_of(y->left);
+          if (y->right != nullptr)
+            y->right->up = y;
+          if (y == l)
+            break;
+        }
+      if (r != &header)
+        for (auto y = header.left;; y = y->left) {
+          y->size = r_size;
+          r_size -= 1 + size_of(y->right);
+          if (y->left != nullptr)
+            y->left->up = y;
+          if (y == r)
+            break;
+        }
+      t->left = header.right;
+      t->right = header.left;
+      if (t->left != nullptr)
+        t->left->up = t;
+      if (t->right != nullptr)
+        t->right->up = t;
+      t->up = nullptr;
+      t->update();
+    };
+
+    try {
+      while (true) {
+        auto d = dir(t);
+        if (d < 0) {
+          auto y = t->left;
+          if (y == nullptr)
+            break;
+          if (dir(y) < 0) { // zig-zig, rotate right
+            t->left = y->right;
+            if (t->left != nullptr)
+              t->left->up = t;
+            y->right = t;
+            t->up = y;
+            t->update();
+            t = y;
+            if (t->left == nullptr)
+              break;
+          }
+          // link right
+          r_up = r;
+          r->left = t;
+          r = t;
+          t = t->left;
+          r_size += 1 + size_of(r->right);
+        } else if (d > 0) {
+          auto y = t->right;
+          if (y == nullptr) {
+            less = true;
+            break;
+          }
+          if (dir(y) > 0) { // zig-zig, rotate left
+            t->right = y->left;
+            if (t->right != nullptr)
+              t->right->up = t;
+            y->left = t;
+            t->up = y;
+            t->update();
+            t = y;
+            if (t->right == nullptr) {
+              less = true;
+              break;
+            }
+          }
+          // link left
+          l->right = t;
+          l = t;
+          t = t->right;
+          l_size += 1 + size_of(l->left);
+        } else {
+          break;
+        }
+      }
+    } catch (...) {
+      // parts are still ordered, so they form valid tree
+      assemble();
+      top = t;
+      throw;
+    }
+    if (less && r != &header) {
+      // `t` is less than target, so answer is least node of right part, `r`.
+      // `t` goes to left part and `r` becomes the root
+      l->right = t;
+      l = t;
+      l_size += 1 + size_of(t->left);
+      t = r;
+      r = r_up;
+      r_size -= 1 + size_of(t->right);
+      t->left = nullptr;
+      less = false;
+    }
+    assemble();
+    top = t;
+    return !less;
+  }
+
   /**
    * cuts as {[0..cur), [cur..end]}
    */
@@ -134,6 +311,7 @@ public:
     if (left != nullptr) {
       left->up = nullptr;
       left = nullptr;
+      update();
     }
     return {l, this};
   }
@@ -147,6 +325,7 @@ public:
     if (c->right != nullptr) {
       c->right->up = nullptr;
       c->right = nullptr;
+      c->update();
     }
     return {l, c, r};
   }
@@ -154,12 +333,15 @@ public:
   void merge_side(splay_node const *tree) const noexcept {
     if (tree == nullptr)
       return;
-    assert(tree->up == nullptr);
+    // any node of tree may be given, like in avl
+    tree = tree->splay();
     splay();
     auto cur = left_right_most<getter>();
     const_cast<splay_node *>(cur)->*getter = const_cast<splay_node *>(tree);
     if (tree != nullptr)
       tree->up = const_cast<splay_node *>(cur);
+    // cur is root after left_right_most, so only it changed size
+    cur->update();
     splay();
   }
   void merge_l(splay_node const *tree) const noexcept {
@@ -183,6 +365,82 @@ public:
     r->merge_l(l);
     return r;
   }
+
+  /**
+   * copies balancing information, used for structural copy
+   */
+  void copy_metadata(splay_node const *from) const noexcept {
+    size = from->size;
+  }
+
+  /**
+   * links `n` nodes given in increasing order into perfectly balanced tree
+   * `get` maps iterator value to node, returns root
+   */
+  template <typename It, typename F>
+  static splay_node const *build(It first, std::size_t n, F const &get) {
+    if (n == 0)
+      return nullptr;
+    auto mid = n / 2;
+    splay_node const *cur = get(first[mid]);
+    auto l = build(first, mid, get);
+    auto r = build(first + mid + 1, n - mid - 1, get);
+    cur->left = const_cast<splay_node *>(l);
+    cur->right = const_cast<splay_node *>(r);
+    cur->up = nullptr;
+    if (l != nullptr)
+      l->up = const_cast<splay_node *>(cur);
+    if (r != nullptr)
+      r->up = const_cast<splay_node *>(cur);
+    cur->update();
+    return cur;
+  }
+
+  /**
+   * position of node in its tree, splays it
+   */
+  std::size_t rank() const noexcept {
+    splay();
+    return size_of(left);
+  }
+  std::size_t rank_frozen() const noexcept {
+    auto res = size_of(left);
+    for (auto cur = this; cur->up != nullptr; cur = cur->up)
+      if (cur->up->right == cur)
+        res += size_of(cur->up->left) + 1;
+    return res;
+  }
+
+  /**
+   * `k`-th node of tree which contains this one, `k` must be less than size
+   * of the tree
+   */
+  template <bool Splay>
+  splay_node const *select_impl(std::size_t k) const noexcept {
+    // splay first, so that walk to the top is amortized too
+    auto cur = Splay ? splay() : top();
+    while (true) {
+      auto ls = size_of(cur->left);
+      if (k == ls)
+        break;
+      if (k < ls) {
+        cur = cur->left;
+      } else {
+        k -= ls + 1;
+        cur = cur->right;
+      }
+    }
+    if constexpr (Splay)
+      return cur->splay();
+    else
+      return cur;
+  }
+  splay_node const *select(std::size_t k) const noexcept {
+    return select_impl<true>(k);
+  }
+  splay_node const *select_frozen(std::size_t k) const noexcept {
+    return select_impl<false>(k);
+  }
 };
 
 template <typename T, typename Tag = default_tag_t<T>>
@@ -199,6 +457,10 @@ public:
   explicit splay_holder(T &&data) noexcept(
       std::is_nothrow_constructible_v<T, T &&>)
       : data(std::move(data)) {}
+  // constructs value in place from arguments
+  template <typename... A>
+  splay_holder(std::piecewise_construct_t, std::tuple<A...> args)
+      : data(std::make_from_tuple<T>(std::move(args))) {}
 
   constexpr node_t const *as_node() const noexcept {
     return static_cast<node_t const *>(this);
@@ -215,33 +477,38 @@ public:
     return cast((this->*f)(std::forward<A>(a)...));
   }
 
-  template <typename C>
-  splay_holder const *find_ge(T const &e, C const &c) const
-      noexcept(is_nothrow_comparable_v<T, C>) {
-    this->splay();
-    splay_holder const *cur = this;
+  /**
+   * least element not less than `e` in tree whose top is `top`, or nullptr.
+   * lookup splays the tree, so `top` is updated, also if `c` throws
+   */
+  template <typename K, typename C>
+  static splay_holder const *find_ge(K const &e, C const &c,
+                                     node_t const *&top)
+      noexcept(is_nothrow_comparable_v<T, C, K>) {
+    bool found = node_t::splay_down_ge(top, [&](node_t const *n) {
+      auto const &nd = cast(n)->data;
+      return c(e, nd) ? -1 : c(nd, e) ? 1 : 0;
+    });
+    return found ? cast(top) : nullptr;
+  }
+
+  template <typename K, typename C>
+  splay_holder const *find_ge_frozen(K const &e, C const &c) const
+      noexcept(is_nothrow_comparable_v<T, C, K>) {
+    node_t const *cur = this->top();
     splay_holder const *best = nullptr;
-    do {
+    while (cur != nullptr) {
       auto const &cd = cast(cur)->data;
       if (c(e, cd)) {
-        best = cur;
-        cur = cast(cur->left);
-      } else if (!c(cd, e)) // eq
-      {
-        return cast(cur->splay());
+        best = cast(cur);
+        cur = cur->left;
+      } else if (!c(cd, e)) { // eq
+        return cast(cur);
       } else {
-        if (cur->right == nullptr) {
-          if (best == nullptr)
-            return nullptr;
-          else
-            return cast(best->splay());
-        }
-        cur = cast(cur->right);
+        cur = cur->right;
       }
-    } while (cur != nullptr);
-    if (best == nullptr)
-      return nullptr;
-    return cast(best->splay());
+    }
+    return best;
   }
 
   /**
@@ -262,4 +529,12 @@ public:
     return mestr;
   }
 };
+
+/**
+ * bimap tree policy: amortized logarithmic operations, fast access to
+ * recently used elements
+ */
+struct policy {
+  template <typename T, typename Tag> using holder = splay_holder<T, Tag>;
+};
 } // namespace splay
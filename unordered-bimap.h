@@ -0,0 +1,370 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bimap-helper.h"
+#include "hash-index.h"
+
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>,
+          typename EqualRight = std::equal_to<Right>>
+struct unordered_bimap;
+
+namespace bimap_helper {
+/**
+ * iterator over dense storage of unordered_bimap, `IsLeft` selects the side
+ * it dereferences to. end is not tied to size, so it stays valid on insert
+ */
+template <typename Left, typename Right, bool IsLeft>
+struct unordered_bimap_iterator {
+private:
+  static constexpr std::size_t end_pos = static_cast<std::size_t>(-1);
+
+  std::vector<std::pair<Left, Right>> const *entries;
+  std::size_t pos;
+
+public:
+  using value_type = std::conditional_t<IsLeft, Left, Right>;
+  using pointer_type = value_type const *;
+  using reference_type = value_type const &;
+  using pointer = pointer_type;
+  using reference = reference_type;
+  using difference_type = std::ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+
+  template <typename, typename, typename, typename, typename, typename>
+  friend struct ::unordered_bimap;
+
+  unordered_bimap_iterator() = default;
+  unordered_bimap_iterator(decltype(entries) entries, std::size_t pos) noexcept
+      : entries(entries), pos(pos) {}
+
+  pointer_type operator->() const noexcept {
+    if constexpr (IsLeft)
+      return &(*entries)[pos].first;
+    else
+      return &(*entries)[pos].second;
+  }
+  reference_type operator*() const noexcept { return *operator->(); }
+
+  unordered_bimap_iterator &operator++() noexcept {
+    if (++pos == entries->size())
+      pos = end_pos;
+    return *this;
+  }
+  unordered_bimap_iterator operator++(int) noexcept {
+    auto copy = *this;
+    operator++();
+    return copy;
+  }
+  unordered_bimap_iterator &operator--() noexcept {
+    if (pos == end_pos)
+      pos = entries->size();
+    pos--;
+    return *this;
+  }
+  unordered_bimap_iterator operator--(int) noexcept {
+    auto copy = *this;
+    operator--();
+    return copy;
+  }
+
+  auto flip() const noexcept {
+    return unordered_bimap_iterator<Left, Right, !IsLeft>(entries, pos);
+  }
+
+  bool operator==(unordered_bimap_iterator const &r) const noexcept {
+    return pos == r.pos;
+  }
+  bool operator!=(unordered_bimap_iterator const &r) const noexcept {
+    return !operator==(r);
+  }
+};
+} // namespace bimap_helper
+
+/**
+ * bimap without order: pairs are stored once in dense array and both sides
+ * are looked up through open addressing tables of 32 bit indices into it,
+ * so pair costs its payload plus 21 to 43 bytes of table slots, depending on
+ * load. no per pair allocations are made. erase moves last pair into
+ * the hole, so it invalidates iterators to the last pair. iteration order is
+ * insertion order until first erase
+ */
+template <typename Left, typename Right, typename HashLeft, typename HashRight,
+          typename EqualLeft, typename EqualRight>
+struct unordered_bimap
+    : private bimap_helper::tagged_comparator<HashLeft>,
+      private bimap_helper::tagged_comparator<
+          HashRight, bimap_helper::second_tag<HashLeft, HashRight>>,
+      private bimap_helper::tagged_comparator<EqualLeft>,
+      private bimap_helper::tagged_comparator<
+          EqualRight, bimap_helper::second_tag<EqualLeft, EqualRight>> {
+  using left_t = Left;
+  using right_t = Right;
+
+  using left_iterator =
+      bimap_helper::unordered_bimap_iterator<Left, Right, true>;
+  using right_iterator =
+      bimap_helper::unordered_bimap_iterator<Left, Right, false>;
+
+private:
+  using hash_left_holder = bimap_helper::tagged_comparator<HashLeft>;
+  using hash_right_holder = bimap_helper::tagged_comparator<
+      HashRight, bimap_helper::second_tag<HashLeft, HashRight>>;
+  using equal_left_holder = bimap_helper::tagged_comparator<EqualLeft>;
+  using equal_right_holder = bimap_helper::tagged_comparator<
+      EqualRight, bimap_helper::second_tag<EqualLeft, EqualRight>>;
+
+  // handle is index + 1, zero marks empty slot
+  using table_t = bimap_helper::hash_table<std::uint32_t, std::uint32_t>;
+
+  std::vector<std::pair<Left, Right>> entries;
+  table_t left_table, right_table;
+
+  template <bool IsLeft> auto const &hasher() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<HashLeft const &>(
+          static_cast<hash_left_holder const &>(*this));
+    else
+      return static_cast<HashRight const &>(
+          static_cast<hash_right_holder const &>(*this));
+  }
+  template <bool IsLeft> auto const &equal() const noexcept {
+    if constexpr (IsLeft)
+      return static_cast<EqualLeft const &>(
+          static_cast<equal_left_holder const &>(*this));
+    else
+      return static_cast<EqualRight const &>(
+          static_cast<equal_right_holder const &>(*this));
+  }
+  template <bool IsLeft> table_t &table() noexcept {
+    if constexpr (IsLeft)
+      return left_table;
+    else
+      return right_table;
+  }
+  template <bool IsLeft> table_t const &table() const noexcept {
+    if constexpr (IsLeft)
+      return left_table;
+    else
+      return right_table;
+  }
+
+  template <bool IsLeft>
+  static auto const &get(std::pair<Left, Right> const &p) noexcept {
+    if constexpr (IsLeft)
+      return p.first;
+    else
+      return p.second;
+  }
+
+  template <bool IsLeft>
+  using iterator_t =
+      bimap_helper::unordered_bimap_iterator<Left, Right, IsLeft>;
+  template <bool IsLeft>
+  using key_t = std::conditional_t<IsLeft, Left, Right>;
+
+  // returns handle or 0
+  template <bool IsLeft>
+  std::uint32_t find_handle(key_t<IsLeft> const &key, std::size_t h) const {
+    return table<IsLeft>().find(h, [&](std::uint32_t handle) {
+      return equal<IsLeft>()(get<IsLeft>(entries[handle - 1]), key);
+    });
+  }
+
+  template <typename T1, typename T2>
+  left_iterator insert_impl(T1 &&l, T2 &&r) {
+    auto hl = hasher<true>()(l);
+    if (find_handle<true>(l, hl) != 0)
+      return end_left();
+    auto hr = hasher<false>()(r);
+    if (find_handle<false>(r, hr) != 0)
+      return end_left();
+    if (entries.size() >= std::numeric_limits<std::uint32_t>::max() - 1)
+      throw std::length_error("unordered_bimap is too large");
+
+    entries.emplace_back(std::forward<T1>(l), std::forward<T2>(r));
+    auto handle = static_cast<std::uint32_t>(entries.size());
+    try {
+      left_table.insert(handle, hl);
+      try {
+        right_table.insert(handle, hr);
+      } catch (...) {
+        left_table.erase(handle, hl);
+        throw;
+      }
+    } catch (...) {
+      entries.pop_back();
+      throw;
+    }
+    return left_iterator(&entries, handle - 1);
+  }
+
+  template <bool IsLeft>
+  iterator_t<IsLeft> find_impl(key_t<IsLeft> const &key) const {
+    auto handle = find_handle<IsLeft>(key, hasher<IsLeft>()(key));
+    if (handle == 0)
+      return iterator_t<IsLeft>(&entries, iterator_t<IsLeft>::end_pos);
+    return iterator_t<IsLeft>(&entries, handle - 1);
+  }
+
+  template <bool IsLeft> iterator_t<IsLeft> erase_impl(iterator_t<IsLeft> it) {
+    auto pos = it.pos;
+    auto handle = static_cast<std::uint32_t>(pos + 1);
+    auto hl = hasher<true>()(entries[pos].first);
+    auto hr = hasher<false>()(entries[pos].second);
+    auto last = static_cast<std::uint32_t>(entries.size());
+    if (handle != last) {
+      // last pair fills the hole. tables are changed after the move, so
+      // they stay intact if it throws
+      auto &moved = entries.back();
+      auto moved_hl = hasher<true>()(moved.first);
+      auto moved_hr = hasher<false>()(moved.second);
+      entries[pos] = std::move(moved);
+      left_table.erase(handle, hl);
+      right_table.erase(handle, hr);
+      left_table.relocate(last, handle, moved_hl);
+      right_table.relocate(last, handle, moved_hr);
+    } else {
+      left_table.erase(handle, hl);
+      right_table.erase(handle, hr);
+    }
+    entries.pop_back();
+    if (pos == entries.size())
+      it.pos = it.end_pos;
+    return it;
+  }
+
+  template <bool IsLeft> bool erase_impl(key_t<IsLeft> const &key) {
+    auto it = find_impl<IsLeft>(key);
+    if (it.pos == it.end_pos)
+      return false;
+    erase_impl<IsLeft>(it);
+    return true;
+  }
+
+  template <bool IsLeft> auto const &at_impl(key_t<IsLeft> const &key) const {
+    auto it = find_impl<IsLeft>(key);
+    if (it.pos == it.end_pos)
+      throw std::out_of_range("at_left bad");
+    return *it.flip();
+  }
+
+public:
+  unordered_bimap(HashLeft hl = HashLeft(), HashRight hr = HashRight(),
+                  EqualLeft el = EqualLeft(), EqualRight er = EqualRight())
+      : hash_left_holder(std::move(hl)), hash_right_holder(std::move(hr)),
+        equal_left_holder(std::move(el)), equal_right_holder(std::move(er)) {}
+
+  /**
+   * pairs which clash with previous ones are skipped, as with `insert`
+   */
+  template <typename InputIt>
+  unordered_bimap(InputIt first, InputIt last, HashLeft hl = HashLeft(),
+                  HashRight hr = HashRight(), EqualLeft el = EqualLeft(),
+                  EqualRight er = EqualRight())
+      : unordered_bimap(std::move(hl), std::move(hr), std::move(el),
+                        std::move(er)) {
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                                    typename std::iterator_traits<
+                                        InputIt>::iterator_category>)
+      reserve(std::distance(first, last));
+    for (; first != last; ++first)
+      insert(std::get<0>(*first), std::get<1>(*first));
+  }
+
+  void reserve(std::size_t n) {
+    entries.reserve(n);
+    left_table.reserve(n);
+    right_table.reserve(n);
+  }
+
+  void clear() noexcept {
+    entries.clear();
+    left_table.clear();
+    right_table.clear();
+  }
+
+  left_iterator begin_left() const noexcept {
+    return empty() ? end_left() : left_iterator(&entries, 0);
+  }
+  left_iterator end_left() const noexcept {
+    return left_iterator(&entries, left_iterator::end_pos);
+  }
+  right_iterator begin_right() const noexcept {
+    return empty() ? end_right() : right_iterator(&entries, 0);
+  }
+  right_iterator end_right() const noexcept {
+    return right_iterator(&entries, right_iterator::end_pos);
+  }
+
+  left_iterator insert(left_t const &a, right_t const &b) {
+    return insert_impl(a, b);
+  }
+  left_iterator insert(left_t const &a, right_t &&b) {
+    return insert_impl(a, std::move(b));
+  }
+  left_iterator insert(left_t &&a, right_t const &b) {
+    return insert_impl(std::move(a), b);
+  }
+  left_iterator insert(left_t &&a, right_t &&b) {
+    return insert_impl(std::move(a), std::move(b));
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return find_impl<true>(left);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return find_impl<false>(right);
+  }
+
+  right_t const &at_left(left_t const &key) const {
+    return at_impl<true>(key);
+  }
+  left_t const &at_right(right_t const &key) const {
+    return at_impl<false>(key);
+  }
+
+  /**
+   * returned iterator points to pair that took place of erased one
+   */
+  left_iterator erase_left(left_iterator it) { return erase_impl<true>(it); }
+  right_iterator erase_right(right_iterator it) {
+    return erase_impl<false>(it);
+  }
+  bool erase_left(left_t const &left) { return erase_impl<true>(left); }
+  bool erase_right(right_t const &right) { return erase_impl<false>(right); }
+
+  bool empty() const noexcept { return size() == 0; }
+  std::size_t size() const noexcept { return entries.size(); }
+
+  // bytes used by storage and both tables
+  std::size_t memory_usage() const noexcept {
+    return entries.capacity() * sizeof(std::pair<Left, Right>) +
+           left_table.memory_usage() + right_table.memory_usage();
+  }
+
+  // order of pairs does not matter
+  bool operator==(unordered_bimap const &b) const {
+    if (size() != b.size())
+      return false;
+    for (auto const &p : entries) {
+      auto handle =
+          b.template find_handle<true>(p.first, hasher<true>()(p.first));
+      if (handle == 0 ||
+          !equal<false>()(b.entries[handle - 1].second, p.second))
+        return false;
+    }
+    return true;
+  }
+  bool operator!=(unordered_bimap const &b) const { return !operator==(b); }
+};